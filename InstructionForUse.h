@@ -50,11 +50,13 @@
     };
     QString filePath = ""; // 待上传的文件
     QPixmap pixmap = QPixmap(); // 待上传的图片
+    QImage image = QImage(); // 待上传的截图，可在线程池中编码，推荐代替QPixmap
     QByteArray byteArray; // 待上传的数据（已转换到raw bytes）
     auto fileParam = std::make_shared<Net::UploadFilePathParam>("imageData", QFileInfo(filePath).fileName(), "application/octet-stream")->setResource(filePath);
     auto pixParam = std::make_shared<Net::UploadPixmapParam>("name", "filename", "image/jpeg")->setResource(std::move(pixmap));
+    auto imageParam = std::make_shared<Net::UploadImageParam>("shot", "shot.jpg", "image/jpeg")->setResource(std::move(image), "jpg", 80);
     auto byteParam = std::make_shared<Net::UploadByteArrayParam>("name", "filename", "multipart/form-data")->setResource(byteArray);
-    std::vector<Net::UploadResourceParamPtr> resourceVec{fileParam, pixParam, byteParam};
+    std::vector<Net::UploadResourceParamPtr> resourceVec{fileParam, pixParam, imageParam, byteParam};
     auto task = Net::Util::instance().getUploadTask(url, textParam, resourceVec);
     connect(task.get(), &Net::UploadTask::sigUploadProgress, this, [=](qint64 bytesSent, qint64 bytesTotal){}); // 处理进度
     task->run(this, [=](Net::ResultPtr result) {
@@ -66,9 +68,10 @@
     });
 ***/
 
-// 上传其他资源（QImage或自定义资源等）扩展说明
+// 上传其他自定义资源扩展说明
 /***
  * 1.继承于UploadResourceParam<T>
  * 2.实现接口isEmpty() 与 getByteArray()。然后按照上述上传使用例子创建扩展类即可。
+ * 3.资源较大时可再实现createDevice()，返回已打开的可读设备(如QFile)，上传时按需读取，不必整体读入内存。
  * ***/
 #endif // NETWORK_INSTRUCTION_FOR_USE_H
@@ -0,0 +1,712 @@
+﻿#include "archiveextractor.h"
+#include <QDir>
+#include <QFileInfo>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#else
+#include <QtZlib/zlib.h>
+#endif
+
+using namespace Net;
+static const int s_inflateBufferSize = 256 * 1024;
+static const qint64 s_tarBlockSize = 512;
+static const qint64 s_maxTarMetaSize = 1024 * 1024; // 长文件名、pax头的上限
+static const qint64 s_zipHeaderSize = 30; // 本地文件头的固定部分
+static const quint32 s_zipLocalSignature = 0x04034b50;
+static const quint32 s_zipCentralSignature = 0x02014b50;
+static const quint32 s_zipEndSignature = 0x06054b50;
+static const quint32 s_zipDescriptorSignature = 0x08074b50;
+static const quint16 s_zipEncryptedFlag = 0x0001;
+static const quint16 s_zipDescriptorFlag = 0x0008; // crc与大小写在数据之后的数据描述符中
+static const quint16 s_zipUtf8Flag = 0x0800;
+
+static quint16 readLe16(const char* data)
+{
+    const auto* bytes = reinterpret_cast<const uchar*>(data);
+    return static_cast<quint16>(bytes[0] | (bytes[1] << 8));
+}
+
+static quint32 readLe32(const char* data)
+{
+    return readLe16(data) | (static_cast<quint32>(readLe16(data + 2)) << 16);
+}
+
+static quint64 readLe64(const char* data)
+{
+    return readLe32(data) | (static_cast<quint64>(readLe32(data + 4)) << 32);
+}
+
+// tar的数值字段为八进制文本，首字节最高位为1时为大端二进制(GNU base-256)
+static qint64 parseTarNumber(const char* data, int length)
+{
+    const auto* bytes = reinterpret_cast<const uchar*>(data);
+    qint64 value = 0;
+    if (bytes[0] & 0x80) {
+        value = bytes[0] & 0x7F;
+        for (int i = 1; i < length; ++i) {
+            value = (value << 8) | bytes[i];
+        }
+        return value;
+    }
+
+    for (int i = 0; i < length && bytes[i] != 0; ++i) {
+        if (bytes[i] == ' ') {
+            continue;
+        }
+        if (bytes[i] < '0' || bytes[i] > '7') {
+            break;
+        }
+        value = value * 8 + (bytes[i] - '0');
+    }
+    return value;
+}
+
+static QString tarString(const char* data, int length)
+{
+    return QString::fromUtf8(data, static_cast<int>(qstrnlen(data, static_cast<uint>(length))));
+}
+
+struct ArchiveExtractor::Inflater {
+    z_stream stream;
+    bool initialized = false;
+    QByteArray buffer;
+
+    explicit Inflater(int windowBits)
+        : buffer(s_inflateBufferSize, Qt::Uninitialized)
+    {
+        memset(&stream, 0, sizeof(stream));
+        initialized = inflateInit2(&stream, windowBits) == Z_OK;
+    }
+    ~Inflater()
+    {
+        if (initialized) {
+            inflateEnd(&stream);
+        }
+    }
+};
+
+ArchiveExtractor::ArchiveExtractor(const QString& destDir, Format format)
+    : m_destDir(destDir)
+    , m_queue([this](Command& command) { execute(command); })
+    , m_format(format)
+{
+}
+
+ArchiveExtractor::~ArchiveExtractor()
+{
+}
+
+void ArchiveExtractor::write(const QByteArray& bytes)
+{
+    if (bytes.isEmpty()) {
+        return;
+    }
+
+    Command command;
+    command.type = Command::Type::Data;
+    command.bytes = bytes;
+    enqueue(std::move(command));
+}
+
+qint64 ArchiveExtractor::write(QIODevice* device, qint64 maxSize)
+{
+    const auto& bytes = device->read(maxSize);
+    write(bytes);
+    return bytes.size();
+}
+
+void ArchiveExtractor::setChecksum(std::shared_ptr<Checksum> checksum)
+{
+    Command command;
+    command.type = Command::Type::Call;
+    command.func = [this, checksum]() {
+        m_checksum = checksum;
+        if (m_checksum) {
+            m_checksum->reset();
+        }
+    };
+    enqueue(std::move(command));
+}
+
+Async::Future<bool> ArchiveExtractor::close(std::function<bool()> finisher)
+{
+    if (!m_queue.setClosing()) {
+        return Async::makeReadyFuture(!hasError());
+    }
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_finisher = std::move(finisher);
+    }
+
+    auto future = m_queue.closedFuture();
+    Command command;
+    command.type = Command::Type::Close;
+    enqueue(std::move(command));
+    return future;
+}
+
+void ArchiveExtractor::enqueue(Command&& command)
+{
+    m_queue.enqueue(std::move(command), shared_from_this());
+}
+
+void ArchiveExtractor::execute(Command& command)
+{
+    switch (command.type) {
+    case Command::Type::Data:
+        if (m_checksum) {
+            m_checksum->addData(command.bytes);
+        }
+        if (!hasError()) {
+            process(command.bytes.constData(), command.bytes.size());
+        }
+        break;
+    case Command::Type::Call:
+        command.func();
+        break;
+    case Command::Type::Close:
+        closeExtractor();
+        break;
+    }
+}
+
+void ArchiveExtractor::process(const char* data, qint64 length)
+{
+    if (m_format == Format::Auto) {
+        m_detectBuffer.append(data, static_cast<int>(length));
+        if (!detectFormat()) {
+            return;
+        }
+        const QByteArray bytes = std::move(m_detectBuffer);
+        m_detectBuffer = QByteArray();
+        process(bytes.constData(), bytes.size());
+        return;
+    }
+
+    switch (m_format) {
+    case Format::Zip:
+        processZip(data, length);
+        break;
+    case Format::Tar:
+        processTar(data, length);
+        break;
+    case Format::TarGz:
+        inflateGzip(data, length);
+        break;
+    default:
+        break;
+    }
+}
+
+// 按魔数识别：gzip为1f 8b，zip为PK\3\4(空包为PK\5\6)，tar在257处为ustar。返回false表示数据还不够或无法识别
+bool ArchiveExtractor::detectFormat()
+{
+    const auto& bytes = m_detectBuffer;
+    if (bytes.size() >= 2 && static_cast<uchar>(bytes[0]) == 0x1f && static_cast<uchar>(bytes[1]) == 0x8b) {
+        m_format = Format::TarGz;
+    } else if (bytes.size() >= 4 && (readLe32(bytes.constData()) == s_zipLocalSignature || readLe32(bytes.constData()) == s_zipEndSignature)) {
+        m_format = Format::Zip;
+    } else if (bytes.size() >= s_tarBlockSize) {
+        if (bytes.mid(257, 5) != "ustar") {
+            qInfo() << QStringLiteral("ArchiveExtractor unknown archive format, dest: %1").arg(m_destDir);
+            setError(Error::FormatError);
+            return false;
+        }
+        m_format = Format::Tar;
+    }
+    return m_format != Format::Auto;
+}
+
+// 解压gzip后交给tar解析，多个gzip成员首尾相接时依次解压
+void ArchiveExtractor::inflateGzip(const char* data, qint64 length)
+{
+    if (!m_inflater) {
+        m_inflater = std::make_unique<Inflater>(MAX_WBITS + 16);
+        if (!m_inflater->initialized) {
+            setError(Error::FormatError);
+            return;
+        }
+    }
+
+    auto& stream = m_inflater->stream;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(length);
+    do {
+        if (m_tarState == TarState::End) { // tar结束块之后的内容忽略
+            return;
+        }
+        if (m_inflateEnd) {
+            if (stream.avail_in == 0) {
+                break;
+            }
+            inflateReset(&stream);
+            m_inflateEnd = false;
+        }
+
+        stream.next_out = reinterpret_cast<Bytef*>(m_inflater->buffer.data());
+        stream.avail_out = static_cast<uInt>(m_inflater->buffer.size());
+        const int ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            qInfo() << QStringLiteral("ArchiveExtractor inflate gzip failed: %1").arg(ret);
+            setError(Error::FormatError);
+            return;
+        }
+        processTar(m_inflater->buffer.constData(), m_inflater->buffer.size() - stream.avail_out);
+        if (ret == Z_STREAM_END) {
+            m_inflateEnd = true;
+        }
+    } while (!hasError() && (stream.avail_in > 0 || stream.avail_out == 0));
+}
+
+void ArchiveExtractor::processTar(const char* data, qint64 length)
+{
+    while (length > 0 && !hasError()) {
+        qint64 size = 0;
+        switch (m_tarState) {
+        case TarState::Header:
+            size = qMin(s_tarBlockSize - m_header.size(), length);
+            m_header.append(data, static_cast<int>(size));
+            if (m_header.size() == s_tarBlockSize) {
+                parseTarHeader();
+                m_header.clear();
+            }
+            break;
+        case TarState::Data:
+            size = qMin(m_remaining, length);
+            if (m_tarEntry == TarEntry::File) {
+                writeEntry(data, size);
+            } else if (m_tarEntry == TarEntry::LongName || m_tarEntry == TarEntry::Pax) {
+                m_tarMeta.append(data, static_cast<int>(size));
+            }
+            m_remaining -= size;
+            if (m_remaining == 0) {
+                finishTarEntry();
+            }
+            break;
+        case TarState::Padding:
+            size = qMin(m_remaining, length);
+            m_remaining -= size;
+            if (m_remaining == 0) {
+                m_tarState = TarState::Header;
+            }
+            break;
+        case TarState::End:
+            return;
+        }
+        data += size;
+        length -= size;
+    }
+}
+
+void ArchiveExtractor::parseTarHeader()
+{
+    const char* header = m_header.constData();
+    if (std::all_of(header, header + s_tarBlockSize, [](char c) { return c == 0; })) { // 全零块表示结束
+        m_tarState = TarState::End;
+        return;
+    }
+
+    // 校验和：校验和字段按空格计算的所有字节之和
+    qint64 sum = 0;
+    for (int i = 0; i < s_tarBlockSize; ++i) {
+        sum += (i >= 148 && i < 156) ? ' ' : static_cast<uchar>(header[i]);
+    }
+    if (sum != parseTarNumber(header + 148, 8)) {
+        qInfo() << QStringLiteral("ArchiveExtractor tar header checksum mismatch, dest: %1").arg(m_destDir);
+        setError(Error::FormatError);
+        return;
+    }
+
+    QString name = tarString(header, 100);
+    if (memcmp(header + 257, "ustar", 6) == 0 && header[345] != 0) { // POSIX ustar才有前缀字段，GNU格式此处为其他字段
+        name = tarString(header + 345, 155) + '/' + name;
+    }
+    if (!m_tarLongName.isEmpty()) {
+        name = m_tarLongName;
+        m_tarLongName.clear();
+    }
+    qint64 size = parseTarNumber(header + 124, 12);
+    if (m_tarPaxSize >= 0) {
+        size = m_tarPaxSize;
+        m_tarPaxSize = -1;
+    }
+
+    const char type = header[156];
+    switch (type) {
+    case '0':
+    case '\0':
+    case '7':
+        m_tarEntry = TarEntry::File;
+        if (!openEntry(name)) {
+            return;
+        }
+        break;
+    case '5':
+        m_tarEntry = TarEntry::Skip;
+        if (!openEntry(name.endsWith('/') ? name : name + '/')) {
+            return;
+        }
+        break;
+    case 'L':
+    case 'x':
+        m_tarEntry = type == 'L' ? TarEntry::LongName : TarEntry::Pax;
+        m_tarMeta.clear();
+        if (size > s_maxTarMetaSize) {
+            setError(Error::FormatError);
+            return;
+        }
+        break;
+    default: // 链接、设备、全局pax头等
+        m_tarEntry = TarEntry::Skip;
+        break;
+    }
+
+    m_remaining = size;
+    m_tarPadding = (s_tarBlockSize - size % s_tarBlockSize) % s_tarBlockSize;
+    if (m_remaining > 0) {
+        m_tarState = TarState::Data;
+    } else {
+        finishTarEntry();
+    }
+}
+
+void ArchiveExtractor::finishTarEntry()
+{
+    if (m_tarEntry == TarEntry::File) {
+        closeEntry();
+    } else if (m_tarEntry == TarEntry::LongName) {
+        m_tarLongName = tarString(m_tarMeta.constData(), m_tarMeta.size());
+    } else if (m_tarEntry == TarEntry::Pax) {
+        // 每条记录为 "长度 key=value\n"，长度包含自身
+        int pos = 0;
+        while (pos < m_tarMeta.size()) {
+            const int space = m_tarMeta.indexOf(' ', pos);
+            const int recordLength = space > pos ? m_tarMeta.mid(pos, space - pos).toInt() : 0;
+            if (recordLength <= 0 || pos + recordLength > m_tarMeta.size()) {
+                break;
+            }
+            const auto& record = m_tarMeta.mid(space + 1, pos + recordLength - space - 2);
+            if (record.startsWith("path=")) {
+                m_tarLongName = QString::fromUtf8(record.mid(5));
+            } else if (record.startsWith("size=")) {
+                m_tarPaxSize = record.mid(5).toLongLong();
+            }
+            pos += recordLength;
+        }
+    }
+    m_tarMeta.clear();
+
+    m_remaining = m_tarPadding;
+    m_tarState = m_remaining > 0 ? TarState::Padding : TarState::Header;
+}
+
+// 按本地文件头顺序解压，遇到中央目录即结束，不需要等到文件末尾
+void ArchiveExtractor::processZip(const char* data, qint64 length)
+{
+    while (length > 0 && !hasError()) {
+        qint64 size = 0;
+        switch (m_zipState) {
+        case ZipState::Header:
+            size = qMin(zipHeaderLength() - m_header.size(), length);
+            m_header.append(data, static_cast<int>(size));
+            if (m_header.size() == 4) {
+                const quint32 signature = readLe32(m_header.constData());
+                if (signature == s_zipCentralSignature || signature == s_zipEndSignature) {
+                    m_zipState = ZipState::End;
+                    return;
+                }
+                if (signature != s_zipLocalSignature) {
+                    setError(Error::FormatError);
+                    return;
+                }
+            }
+            if (m_header.size() >= s_zipHeaderSize && m_header.size() == zipHeaderLength()) {
+                parseZipHeader();
+                m_header.clear();
+            }
+            break;
+        case ZipState::Data:
+            size = m_remaining >= 0 ? qMin(m_remaining, length) : length;
+            if (m_zipMethod == 0) {
+                writeEntry(data, size);
+                m_entryCrc = static_cast<quint32>(crc32(m_entryCrc, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size)));
+            } else {
+                size = inflateZip(data, size);
+            }
+            if (m_remaining >= 0) {
+                m_remaining -= size;
+            }
+            if (hasError()) {
+                return;
+            }
+            if (m_remaining == 0 || m_inflateEnd) {
+                endZipData();
+            }
+            break;
+        case ZipState::Descriptor: {
+            // [签名] crc32 压缩后大小 原始大小，签名可省略，zip64时大小各为8字节
+            qint64 need = 4;
+            if (m_header.size() >= 4) {
+                need = (readLe32(m_header.constData()) == s_zipDescriptorSignature ? 4 : 0) + 4 + (m_zip64 ? 16 : 8);
+            }
+            size = qMin(need - m_header.size(), length);
+            m_header.append(data, static_cast<int>(size));
+            if (m_header.size() > 4 && m_header.size() == need) {
+                const bool hasSignature = readLe32(m_header.constData()) == s_zipDescriptorSignature;
+                finishZipEntry(readLe32(m_header.constData() + (hasSignature ? 4 : 0)));
+                m_header.clear();
+            }
+            break;
+        }
+        case ZipState::End:
+            return;
+        }
+        data += size;
+        length -= size;
+    }
+}
+
+// 先凑齐签名，再凑齐固定部分，最后是文件名与扩展字段
+qint64 ArchiveExtractor::zipHeaderLength() const
+{
+    if (m_header.size() < 4) {
+        return 4;
+    }
+    if (m_header.size() < s_zipHeaderSize) {
+        return s_zipHeaderSize;
+    }
+    return s_zipHeaderSize + readLe16(m_header.constData() + 26) + readLe16(m_header.constData() + 28);
+}
+
+void ArchiveExtractor::parseZipHeader()
+{
+    const char* header = m_header.constData();
+    m_zipFlags = readLe16(header + 6);
+    m_zipMethod = readLe16(header + 8);
+    m_zipCrc = readLe32(header + 14);
+    qint64 compressedSize = readLe32(header + 18);
+    qint64 size = readLe32(header + 22);
+    const int nameLength = readLe16(header + 26);
+    const int extraLength = readLe16(header + 28);
+
+    // zip64扩展字段中依次为原始大小、压缩后大小，只在对应字段为0xFFFFFFFF时出现
+    m_zip64 = false;
+    const char* extra = header + s_zipHeaderSize + nameLength;
+    for (int pos = 0; pos + 4 <= extraLength;) {
+        const int id = readLe16(extra + pos);
+        const int end = pos + 4 + readLe16(extra + pos + 2);
+        if (id == 0x0001 && end <= extraLength) {
+            m_zip64 = true;
+            int field = pos + 4;
+            if (size == 0xFFFFFFFF && field + 8 <= end) {
+                size = static_cast<qint64>(readLe64(extra + field));
+                field += 8;
+            }
+            if (compressedSize == 0xFFFFFFFF && field + 8 <= end) {
+                compressedSize = static_cast<qint64>(readLe64(extra + field));
+            }
+        }
+        pos = end;
+    }
+
+    const QByteArray rawName(header + s_zipHeaderSize, nameLength);
+    const QString name = (m_zipFlags & s_zipUtf8Flag) ? QString::fromUtf8(rawName) : QString::fromLocal8Bit(rawName);
+    if ((m_zipFlags & s_zipEncryptedFlag) || (m_zipMethod != 0 && m_zipMethod != Z_DEFLATED)
+        || (m_zipMethod == 0 && (m_zipFlags & s_zipDescriptorFlag))) { // stored且大小在数据之后时无法确定数据的结尾
+        qInfo() << QStringLiteral("ArchiveExtractor unsupported zip entry: %1, flags: %2, method: %3").arg(name).arg(m_zipFlags).arg(m_zipMethod);
+        setError(Error::FormatError);
+        return;
+    }
+
+    m_zipDirectory = name.endsWith('/') || name.endsWith('\\');
+    if (!openEntry(name)) {
+        return;
+    }
+    m_entryCrc = 0;
+    m_remaining = (m_zipFlags & s_zipDescriptorFlag) ? -1 : compressedSize;
+    m_inflateEnd = false;
+    if (m_zipMethod == Z_DEFLATED) {
+        m_inflater = std::make_unique<Inflater>(-MAX_WBITS);
+        if (!m_inflater->initialized) {
+            setError(Error::FormatError);
+            return;
+        }
+    }
+    Q_UNUSED(size);
+
+    m_zipState = ZipState::Data;
+    if (m_remaining == 0) {
+        endZipData();
+    }
+}
+
+// 返回消耗的压缩数据字节数，deflate流结束后剩余的数据属于数据描述符或下一个条目
+qint64 ArchiveExtractor::inflateZip(const char* data, qint64 length)
+{
+    auto& stream = m_inflater->stream;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(length);
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(m_inflater->buffer.data());
+        stream.avail_out = static_cast<uInt>(m_inflater->buffer.size());
+        const int ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            qInfo() << QStringLiteral("ArchiveExtractor inflate zip entry failed: %1").arg(ret);
+            setError(Error::FormatError);
+            return 0;
+        }
+
+        const qint64 produced = m_inflater->buffer.size() - stream.avail_out;
+        writeEntry(m_inflater->buffer.constData(), produced);
+        m_entryCrc = static_cast<quint32>(crc32(m_entryCrc, reinterpret_cast<const Bytef*>(m_inflater->buffer.constData()), static_cast<uInt>(produced)));
+        if (ret == Z_STREAM_END) {
+            m_inflateEnd = true;
+            break;
+        }
+    } while (!hasError() && (stream.avail_in > 0 || stream.avail_out == 0));
+    return length - stream.avail_in;
+}
+
+void ArchiveExtractor::endZipData()
+{
+    if (m_zipMethod == Z_DEFLATED && !m_inflateEnd) { // 压缩数据已读完而deflate流未结束
+        setError(Error::FormatError);
+        return;
+    }
+
+    m_inflater.reset();
+    m_inflateEnd = false;
+    if (m_zipFlags & s_zipDescriptorFlag) {
+        m_zipState = ZipState::Descriptor;
+    } else {
+        finishZipEntry(m_zipCrc);
+    }
+}
+
+void ArchiveExtractor::finishZipEntry(quint32 crc)
+{
+    closeEntry();
+    if (!m_zipDirectory && crc != m_entryCrc) {
+        qInfo() << QStringLiteral("ArchiveExtractor zip entry crc mismatch, dest: %1").arg(m_destDir);
+        setError(Error::FormatError);
+        return;
+    }
+    m_zipState = ZipState::Header;
+}
+
+// tar以结束块或完整的条目结尾；zip以中央目录结尾
+bool ArchiveExtractor::isComplete() const
+{
+    const bool tarComplete = m_tarState == TarState::End || (m_tarState == TarState::Header && m_header.isEmpty());
+    switch (m_format) {
+    case Format::Zip:
+        return m_zipState == ZipState::End;
+    case Format::Tar:
+        return tarComplete;
+    case Format::TarGz:
+        return tarComplete && (m_inflateEnd || m_tarState == TarState::End);
+    default:
+        return false;
+    }
+}
+
+// 条目路径规整后必须位于目标目录内
+QString ArchiveExtractor::entryPath(const QString& name)
+{
+    QString path = name;
+    path.replace('\\', '/');
+    path = QDir::cleanPath(path);
+    if (path.isEmpty() || QDir::isAbsolutePath(path) || path == ".." || path.startsWith("../")) {
+        return QString();
+    }
+#ifdef Q_OS_WIN
+    if (path.contains(':')) {
+        return QString();
+    }
+#endif
+    return QDir(m_destDir).filePath(path);
+}
+
+// 名称以/结尾的为目录
+bool ArchiveExtractor::openEntry(const QString& name)
+{
+    closeEntry();
+    const QString& path = entryPath(name);
+    if (path.isEmpty()) {
+        qInfo() << QStringLiteral("ArchiveExtractor unsafe entry path: %1").arg(name);
+        setError(Error::FormatError);
+        return false;
+    }
+
+    const bool directory = name.endsWith('/') || name.endsWith('\\');
+    if (!QDir().mkpath(directory ? path : QFileInfo(path).absolutePath())) {
+        setError(Error::WriteError);
+        return false;
+    }
+    if (directory) {
+        return true;
+    }
+
+    m_entryFile = std::make_unique<QFile>(path);
+    if (!m_entryFile->open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        qInfo() << QStringLiteral("ArchiveExtractor open entry failed: %1, %2").arg(path).arg(m_entryFile->errorString());
+        m_entryFile.reset();
+        setError(Error::WriteError);
+        return false;
+    }
+    return true;
+}
+
+void ArchiveExtractor::writeEntry(const char* data, qint64 length)
+{
+    if (!m_entryFile) {
+        return;
+    }
+
+    while (length > 0) {
+        const qint64 written = m_entryFile->write(data, length);
+        if (written <= 0) {
+#ifdef Q_OS_UNIX
+            setError(errno == ENOSPC ? Error::NoSpaceError : Error::WriteError);
+#else
+            setError(Error::WriteError);
+#endif
+            return;
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+void ArchiveExtractor::closeEntry()
+{
+    if (m_entryFile) {
+        m_entryFile->close();
+        m_entryFile.reset();
+    }
+}
+
+void ArchiveExtractor::closeExtractor()
+{
+    closeEntry();
+    if (!hasError() && !isComplete()) {
+        qInfo() << QStringLiteral("ArchiveExtractor archive incomplete, dest: %1").arg(m_destDir);
+        setError(Error::FormatError);
+    }
+    m_inflater.reset();
+    bool success = !hasError();
+
+    std::function<bool()> finisher;
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        finisher = std::move(m_finisher);
+    }
+    if (success && finisher) {
+        success = finisher();
+    }
+
+    m_queue.setClosed(success);
+}
@@ -0,0 +1,135 @@
+﻿#ifndef NETWORK_ARCHIVE_EXTRACTOR_H
+#define NETWORK_ARCHIVE_EXTRACTOR_H
+#include "async/future.h"
+#include "checksum.h"
+#include "network_global.h"
+#include "serialqueue.h"
+#include <QFile>
+#include <QIODevice>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace Net {
+/*** 流式解压：边接收压缩包数据边在线程池中解压，条目直接写到目标目录，压缩包本身不落盘 ***/
+// 支持tar、tar.gz与zip(按本地文件头顺序解析，stored/deflate，支持zip64与数据描述符)，Auto时按文件头魔数识别。
+// 与FileWriter共用SerialQueue的队列与背压：isFull()为true时读端暂停，降到低水位后通过readyCallback通知继续。
+// 条目路径经过规整，绝对路径或跳出目标目录的条目视为格式错误；tar中的链接、设备等特殊条目跳过。
+class NETWORK_EXPORT ArchiveExtractor : public std::enable_shared_from_this<ArchiveExtractor> {
+public:
+    enum class Format {
+        Auto = 0,
+        Zip,
+        Tar,
+        TarGz
+    };
+    enum class Error {
+        NoError = 0,
+        FormatError, // 格式错误、不支持或数据不完整
+        WriteError,
+        NoSpaceError // 磁盘空间不足
+    };
+
+    ArchiveExtractor(const QString& destDir, Format format = Format::Auto);
+    ~ArchiveExtractor();
+
+    // 以下接口只在调用线程(网络线程)使用
+    void write(const QByteArray& bytes);
+    qint64 write(QIODevice* device, qint64 maxSize); // 从device读取最多maxSize，返回读取的字节数
+    void setChecksum(std::shared_ptr<Checksum> checksum); // 对压缩包原始数据计算
+    // 压缩包不完整时返回false，finisher在解压结束后于解压线程执行
+    Async::Future<bool> close(std::function<bool()> finisher = nullptr);
+    bool isFull() { return m_queue.isFull(); }
+    Error error() const { return m_queue.error(); }
+    bool hasError() const { return m_queue.hasError(); }
+    bool isClosing() const { return m_queue.isClosing(); }
+    void setReadyCallback(std::function<void()> callback) { m_queue.setReadyCallback(std::move(callback)); } // 在解压线程中调用
+    // 解压结束后在解压线程中调用，已结束时立即在调用线程中调用
+    void setClosedCallback(std::function<void()> callback) { m_queue.setClosedCallback(std::move(callback)); }
+
+private:
+    struct Command {
+        enum class Type {
+            Data,
+            Call,
+            Close
+        };
+        Type type = Type::Data;
+        QByteArray bytes;
+        std::function<void()> func;
+    };
+    enum class TarState {
+        Header,
+        Data,
+        Padding,
+        End
+    };
+    enum class TarEntry {
+        File,
+        LongName, // GNU长文件名
+        Pax, // pax扩展头
+        Skip
+    };
+    enum class ZipState {
+        Header,
+        Data,
+        Descriptor,
+        End
+    };
+
+    void enqueue(Command&& command);
+    void execute(Command& command);
+    void process(const char* data, qint64 length);
+    bool detectFormat();
+    void inflateGzip(const char* data, qint64 length);
+    void processTar(const char* data, qint64 length);
+    void parseTarHeader();
+    void finishTarEntry();
+    void processZip(const char* data, qint64 length);
+    qint64 zipHeaderLength() const;
+    void parseZipHeader();
+    qint64 inflateZip(const char* data, qint64 length);
+    void endZipData();
+    void finishZipEntry(quint32 crc);
+    bool isComplete() const;
+    QString entryPath(const QString& name);
+    bool openEntry(const QString& name);
+    void writeEntry(const char* data, qint64 length);
+    void closeEntry();
+    void setError(Error error) { m_queue.setError(error); }
+    void closeExtractor();
+
+private:
+    QString m_destDir;
+    SerialQueue<Command, Error> m_queue;
+    std::mutex m_mutex;
+    std::function<bool()> m_finisher;
+
+    // 只在解压线程中访问
+    Format m_format;
+    QByteArray m_detectBuffer; // 识别格式前的数据
+    std::shared_ptr<Checksum> m_checksum;
+    std::unique_ptr<QFile> m_entryFile;
+    QByteArray m_header; // 尚不完整的tar头、zip本地文件头或数据描述符
+    qint64 m_remaining = 0; // 当前条目或填充剩余的字节数
+    struct Inflater;
+    std::unique_ptr<Inflater> m_inflater; // tar.gz的gzip流或zip当前条目的deflate流
+    bool m_inflateEnd = false;
+
+    TarState m_tarState = TarState::Header;
+    TarEntry m_tarEntry = TarEntry::Skip;
+    qint64 m_tarPadding = 0; // 条目数据之后补齐到512字节的填充
+    QByteArray m_tarMeta; // 长文件名或pax头的内容
+    QString m_tarLongName; // 由长文件名或pax头指定的下一个条目的路径
+    qint64 m_tarPaxSize = -1; // 由pax头指定的下一个条目的大小
+
+    ZipState m_zipState = ZipState::Header;
+    quint16 m_zipFlags = 0;
+    quint16 m_zipMethod = 0;
+    quint32 m_zipCrc = 0; // 本地文件头中的crc32
+    quint32 m_entryCrc = 0; // 已解压数据的crc32
+    bool m_zip64 = false;
+    bool m_zipDirectory = false;
+};
+}
+#endif // NETWORK_ARCHIVE_EXTRACTOR_H
@@ -1,14 +1,141 @@
+#include <algorithm>
 #include <cassert>
 #include "threadPool.h"
 
 namespace Async {
 std::thread::id ThreadPool::s_mainThread;
 
+namespace {
+// worker identity, used to push continuations onto the local queue
+thread_local ThreadPool *t_pool = nullptr;
+thread_local size_t t_index = 0;
+// picks the inbox of a submitting thread, so different submitters rarely share a lock
+thread_local size_t t_inject = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+const int64_t kInitialCapacity = 256;
+}
+
+WorkStealingQueue::Array::Array(int64_t cap)
+    : capacity(cap)
+    , mask(cap - 1)
+    , buffer(new std::atomic<Task *>[static_cast<size_t>(cap)])
+{
+}
+
+WorkStealingQueue::WorkStealingQueue()
+{
+    arrays_.emplace_back(new Array(kInitialCapacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+}
+
+WorkStealingQueue::~WorkStealingQueue()
+{
+    while (Task *task = pop()) {
+        delete task;
+    }
+}
+
+void WorkStealingQueue::push(Task *task)
+{
+    const int64_t b = bottom_.load(std::memory_order_relaxed);
+    const int64_t t = top_.load(std::memory_order_acquire);
+    Array *a = array_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+        a = _grow(a, b, t);
+    }
+    a->put(b, task);
+    // seq_cst also orders it before the idle_ check in ThreadPool::_push
+    bottom_.store(b + 1, std::memory_order_seq_cst);
+}
+
+WorkStealingQueue::Task *WorkStealingQueue::pop()
+{
+    const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array *a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_seq_cst);
+
+    if (t > b) {
+        // empty
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task *task = a->get(b);
+    if (t == b) {
+        // last element, race against thieves
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            task = nullptr;
+        }
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+WorkStealingQueue::Task *WorkStealingQueue::steal()
+{
+    int64_t t = top_.load(std::memory_order_seq_cst);
+    const int64_t b = bottom_.load(std::memory_order_seq_cst);
+    if (t >= b) {
+        return nullptr;
+    }
+
+    Array *a = array_.load(std::memory_order_acquire);
+    Task *task = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return task;
+}
+
+bool WorkStealingQueue::empty() const
+{
+    return size() == 0;
+}
+
+size_t WorkStealingQueue::size() const
+{
+    const int64_t b = bottom_.load(std::memory_order_seq_cst);
+    const int64_t t = top_.load(std::memory_order_seq_cst);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+}
+
+WorkStealingQueue::Array *WorkStealingQueue::_grow(Array *array, int64_t bottom, int64_t top)
+{
+    std::unique_ptr<Array> bigger(new Array(array->capacity * 2));
+    for (int64_t i = top; i < bottom; ++i) {
+        bigger->put(i, array->get(i));
+    }
+    Array *result = bigger.get();
+    arrays_.push_back(std::move(bigger));
+    array_.store(result, std::memory_order_release);
+    return result;
+}
+
+ThreadPool::BlockingRegion::BlockingRegion()
+    : pool_(t_pool)
+{
+    if (pool_) {
+        pool_->_enterBlocking();
+    }
+}
+
+ThreadPool::BlockingRegion::~BlockingRegion()
+{
+    if (pool_) {
+        pool_->_leaveBlocking();
+    }
+}
+
 ThreadPool::ThreadPool(int numThreads)
-    : numThreads_(numThreads)
+    : slots_(new Slot[kMaxThreads])
 {
     // init main thread id
     s_mainThread = std::this_thread::get_id();
+
+    const int cores = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    minThreads_ = std::min(numThreads > 0 ? numThreads : cores, kMaxThreads);
+    maxThreads_ = std::max(minThreads_, std::min(cores * 4, kMaxThreads));
 }
 
 ThreadPool *ThreadPool::globalInstance()
@@ -20,12 +147,49 @@ ThreadPool *ThreadPool::globalInstance()
 ThreadPool::~ThreadPool()
 {
     joinAll();
+    const size_t count = slotCount_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        for (Task *task : slots_[i].injected) {
+            delete task;
+        }
+    }
 }
 
 void ThreadPool::setNumOfThreads(int n)
 {
     assert(n >= 0 && n <= kMaxThreads);
-    numThreads_ = n;
+    if (n == 0) {
+        n = std::min(std::max(static_cast<int>(std::thread::hardware_concurrency()), 1), kMaxThreads);
+    }
+    setThreadRange(n, n);
+}
+
+void ThreadPool::setThreadRange(int minThreads, int maxThreads)
+{
+    assert(minThreads >= 1 && minThreads <= maxThreads && maxThreads <= kMaxThreads);
+
+    std::unique_lock<std::mutex> guard(mutex_);
+    minThreads_ = minThreads;
+    maxThreads_ = maxThreads;
+    if (started_ && !shutdown_) {
+        while (current_ < minThreads_ && _spawn()) {
+        }
+        // let idle workers above the new max exit
+        cond_.notify_all();
+    }
+}
+
+void ThreadPool::setGrowThreshold(std::chrono::milliseconds threshold)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    growThreshold_ = threshold;
+}
+
+void ThreadPool::setIdleTimeout(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    idleTimeout_ = timeout;
+    cond_.notify_all();
 }
 
 void ThreadPool::_start()
@@ -34,12 +198,61 @@ void ThreadPool::_start()
         return;
     }
 
-    assert(workers_.empty());
+    assert(current_ == 0);
 
-    for (int i = 0; i < numThreads_; i++) {
-        std::thread t([this]() { this->_workerRoutine(); });
-        workers_.push_back(std::move(t));
+    while (current_ < minThreads_ && _spawn()) {
     }
+    monitor_ = std::thread([this]() { this->_monitorRoutine(); });
+}
+
+// Start a worker in the first free slot
+bool ThreadPool::_spawn()
+{
+    if (shutdown_ || current_ >= maxThreads_) {
+        return false;
+    }
+
+    size_t index = 0;
+    while (slots_[index].active) {
+        ++index;
+    }
+    Slot &slot = slots_[index];
+    // a worker that exited on idle timeout left its handle here
+    if (slot.thread.joinable()) {
+        slot.thread.join();
+    }
+    if (!slot.owner) {
+        slot.owner.reset(new WorkStealingQueue());
+        slot.queue.store(slot.owner.get(), std::memory_order_release);
+    }
+    if (index >= slotCount_.load(std::memory_order_relaxed)) {
+        slotCount_.store(index + 1, std::memory_order_release);
+    }
+
+    slot.active = true;
+    const int current = current_.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (current > peak_.load(std::memory_order_relaxed)) {
+        peak_.store(current, std::memory_order_relaxed);
+    }
+    slot.thread = std::thread([this, index]() { this->_workerRoutine(index); });
+    return true;
+}
+
+bool ThreadPool::_ensureStarted()
+{
+    if (started_.load(std::memory_order_acquire)) {
+        return !shutdown_.load(std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (shutdown_) {
+        return false;
+    }
+    if (!started_) {
+        _start();
+        started_.store(true, std::memory_order_release);
+    }
+    return true;
 }
 
 void ThreadPool::joinAll()
@@ -47,7 +260,7 @@ void ThreadPool::joinAll()
     if (s_mainThread != std::this_thread::get_id())
         return;
 
-    decltype(workers_) tmp;
+    std::vector<std::thread> tmp;
 
     {
         std::unique_lock<std::mutex> guard(mutex_);
@@ -56,8 +269,13 @@ void ThreadPool::joinAll()
 
         shutdown_ = true;
         cond_.notify_all();
+        monitorCond_.notify_all();
 
-        tmp.swap(workers_);
+        const size_t count = slotCount_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < count; ++i) {
+            tmp.push_back(std::move(slots_[i].thread));
+        }
+        tmp.push_back(std::move(monitor_));
     }
 
     for (auto &t : tmp) {
@@ -66,42 +284,258 @@ void ThreadPool::joinAll()
     }
 }
 
-void ThreadPool::_workerRoutine()
+// Local queue when called from one of our workers, otherwise the inbox this thread maps to
+void ThreadPool::_push(Task &&task)
 {
-    while (true) {
-        std::function<void()> task;
+    Task *p = new Task(std::move(task));
+    if (t_pool == this) {
+        slots_[t_index].queue.load(std::memory_order_relaxed)->push(p);
+    } else {
+        // an inbox of a retired worker is still scanned by the others
+        Slot &slot = slots_[t_inject % slotCount_.load(std::memory_order_acquire)];
+        std::lock_guard<std::mutex> guard(slot.injectMutex);
+        slot.injected.push_back(p);
+        slot.injectedCount.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    // A searching worker will find the task, or wake a successor if it takes another one
+    const int idle = idle_.load(std::memory_order_seq_cst);
+    if (idle > 0) {
+        if (searching_.load(std::memory_order_seq_cst) == 0) {
+            _wakeOne();
+        }
+    } else if (monitorArmed_.load(std::memory_order_seq_cst) && monitorArmed_.exchange(false)) {
+        // every worker is busy, let the monitor time how long this work waits
+        std::lock_guard<std::mutex> guard(mutex_);
+        monitorCond_.notify_one();
+    }
+}
+
+// Own queue first (LIFO), then own inbox, then steal from the others (FIFO), then their inboxes
+ThreadPool::Task *ThreadPool::_take(size_t index)
+{
+    if (Task *task = slots_[index].queue.load(std::memory_order_relaxed)->pop()) {
+        return task;
+    }
+    if (Task *task = _takeInjected(slots_[index], index)) {
+        return task;
+    }
+
+    const size_t n = slotCount_.load(std::memory_order_acquire);
+    for (size_t i = 1; i < n; ++i) {
+        WorkStealingQueue *victim = slots_[(index + i) % n].queue.load(std::memory_order_acquire);
+        // one attempt per victim; a lost race means someone else made progress,
+        // and the caller re-checks _hasWork() before parking
+        if (!victim) {
+            continue;
+        }
+        if (Task *task = victim->steal()) {
+            return task;
+        }
+    }
+    for (size_t i = 1; i < n; ++i) {
+        if (Task *task = _takeInjected(slots_[(index + i) % n], index)) {
+            return task;
+        }
+    }
+    return nullptr;
+}
 
-        {
-            std::unique_lock<std::mutex> guard(mutex_);
+// Returns the oldest task of an inbox and moves up to kInjectBatch - 1 more into the
+// caller's own queue, newest first so pop() keeps submission order
+ThreadPool::Task *ThreadPool::_takeInjected(Slot &from, size_t index)
+{
+    if (from.injectedCount.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
 
-            cond_.wait(guard, [this]() {
-                return shutdown_ || !tasks_.empty();
-            });
+    std::lock_guard<std::mutex> guard(from.injectMutex);
+    if (from.injected.empty()) {
+        return nullptr;
+    }
+    const size_t count = std::min(from.injected.size(), kInjectBatch);
+    WorkStealingQueue *queue = slots_[index].queue.load(std::memory_order_relaxed);
+    for (size_t i = count - 1; i > 0; --i) {
+        queue->push(from.injected[i]);
+    }
+    Task *task = from.injected.front();
+    from.injected.erase(from.injected.begin(), from.injected.begin() + static_cast<std::ptrdiff_t>(count));
+    from.injectedCount.fetch_sub(count, std::memory_order_seq_cst);
+    return task;
+}
 
-            assert(shutdown_ || !tasks_.empty());
-            if (shutdown_ && tasks_.empty()) {
-                return;
+bool ThreadPool::_hasWork() const
+{
+    const size_t n = slotCount_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+        if (slots_[i].injectedCount.load(std::memory_order_seq_cst) > 0) {
+            return true;
+        }
+        const WorkStealingQueue *queue = slots_[i].queue.load(std::memory_order_acquire);
+        if (queue && !queue->empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Work is queued but no worker is parked to pick it up
+bool ThreadPool::_isStarved() const
+{
+    return idle_.load(std::memory_order_seq_cst) == 0 && _hasWork();
+}
+
+uint64_t ThreadPool::_executed() const
+{
+    uint64_t count = 0;
+    const size_t n = slotCount_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+        count += slots_[i].executed.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+void ThreadPool::_wakeOne()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    cond_.notify_one();
+}
+
+void ThreadPool::_enterBlocking()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    ++blocked_;
+    if (current_ - blocked_ < minThreads_ && _isStarved()) {
+        _spawn();
+    }
+}
+
+void ThreadPool::_leaveBlocking()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    --blocked_;
+}
+
+// Grows the pool; sleeps until a submission finds every worker busy
+void ThreadPool::_monitorRoutine()
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    while (!shutdown_) {
+        if (!_isStarved()) {
+            monitorArmed_.store(true, std::memory_order_seq_cst);
+            // re-check after arming, a concurrent _push either sees the flag or its task is seen here
+            if (!_isStarved()) {
+                monitorCond_.wait(guard, [this]() {
+                    return shutdown_ || !monitorArmed_.load(std::memory_order_seq_cst);
+                });
             }
+            monitorArmed_.store(false, std::memory_order_seq_cst);
+            continue;
+        }
 
-            assert(!tasks_.empty());
-            task = std::move(tasks_.front());
-            tasks_.pop_front();
+        // blocked workers do not count as runnable
+        if (current_ - blocked_ < minThreads_ && _spawn()) {
+            continue;
         }
 
-        task();
+        const uint64_t executed = _executed();
+        monitorCond_.wait_for(guard, growThreshold_);
+        // no task was started for a whole threshold while work kept waiting
+        if (!shutdown_ && _isStarved() && _executed() == executed) {
+            _spawn();
+        }
+    }
+}
+
+void ThreadPool::_workerRoutine(size_t index)
+{
+    t_pool = this;
+    t_index = index;
+    bool searching = false;
+    Slot &slot = slots_[index];
+
+    while (true) {
+        if (Task *task = _take(index)) {
+            if (searching) {
+                searching = false;
+                // the last searcher hands over, so remaining work is not left to busy workers only
+                if (searching_.fetch_sub(1, std::memory_order_seq_cst) == 1
+                    && idle_.load(std::memory_order_seq_cst) > 0 && _hasWork()) {
+                    _wakeOne();
+                }
+            }
+            slot.executed.fetch_add(1, std::memory_order_relaxed);
+            (*task)();
+            delete task;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(mutex_);
+        if (searching) {
+            searching = false;
+            searching_.fetch_sub(1, std::memory_order_seq_cst);
+        }
+        // re-check after announcing idle, a concurrent _push either sees idle_ or its task is seen here
+        idle_.fetch_add(1, std::memory_order_seq_cst);
+        auto deadline = std::chrono::steady_clock::now() + idleTimeout_;
+        bool retire = false;
+        while (!shutdown_ && !_hasWork()) {
+            if (current_ > maxThreads_) {
+                retire = true;
+                break;
+            }
+            if (cond_.wait_until(guard, deadline) == std::cv_status::timeout && !_hasWork()) {
+                if (current_ > minThreads_) {
+                    retire = true;
+                    break;
+                }
+                deadline = std::chrono::steady_clock::now() + idleTimeout_;
+            }
+        }
+        idle_.fetch_sub(1, std::memory_order_seq_cst);
+
+        // a _push that saw this worker idle may have notified nobody, stay for its task
+        if (retire && !_hasWork()) {
+            // own queue is empty: only this worker pushes to it and pop just failed
+            slot.active = false;
+            current_.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+        if (shutdown_ && !_hasWork()) {
+            return;
+        }
+        searching = true;
+        searching_.fetch_add(1, std::memory_order_seq_cst);
     }
 }
 
 size_t ThreadPool::workerThreads() const
+{
+    return static_cast<size_t>(current_.load(std::memory_order_relaxed));
+}
+
+size_t ThreadPool::peakWorkerThreads() const
+{
+    return static_cast<size_t>(peak_.load(std::memory_order_relaxed));
+}
+
+size_t ThreadPool::minWorkerThreads() const
 {
     std::unique_lock<std::mutex> guard(mutex_);
-    return workers_.size();
+    return static_cast<size_t>(minThreads_);
 }
 
 size_t ThreadPool::tasks() const
 {
-    std::unique_lock<std::mutex> guard(mutex_);
-    return tasks_.size();
+    size_t count = 0;
+    const size_t n = slotCount_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+        count += slots_[i].injectedCount.load(std::memory_order_relaxed);
+        if (const WorkStealingQueue *queue = slots_[i].queue.load(std::memory_order_acquire)) {
+            count += queue->size();
+        }
+    }
+    return count;
 }
 
 void ThreadPool::scheduleLater(std::chrono::milliseconds duration, std::function<void()> f)
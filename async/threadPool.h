@@ -3,11 +3,14 @@
 
 #include "future.h"
 #include "scheduler.h"
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 ///@file ThreadPool.h
 ///@brief A powerful ThreadPool implementation with Future interface.
@@ -23,10 +26,82 @@
 ///  type of your_heavy_work.
 namespace Async {
 
+///@brief Lock-free single-owner deque (Chase-Lev, "Correct and Efficient
+/// Work-Stealing for Weak Memory Models", Le et al. 2013).
+/// The owner pushes and pops at the bottom (LIFO), thieves steal from the top (FIFO).
+class WorkStealingQueue {
+public:
+    using Task = std::function<void()>;
+
+    WorkStealingQueue();
+    ~WorkStealingQueue();
+
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    void operator=(const WorkStealingQueue&) = delete;
+
+    // owner only
+    void push(Task* task);
+    Task* pop();
+    // any thread, nullptr if empty or lost the race
+    Task* steal();
+    bool empty() const;
+    size_t size() const;
+
+private:
+    struct Array {
+        explicit Array(int64_t cap);
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<Task*>[]> buffer;
+        Task* get(int64_t i) const { return buffer[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, Task* task) { buffer[i & mask].store(task, std::memory_order_relaxed); }
+    };
+
+    Array* _grow(Array* array, int64_t bottom, int64_t top);
+
+    alignas(64) std::atomic<int64_t> top_ { 0 };
+    alignas(64) std::atomic<int64_t> bottom_ { 0 };
+    std::atomic<Array*> array_;
+    // retired arrays may still be read by thieves, free them with the queue
+    std::vector<std::unique_ptr<Array>> arrays_;
+};
+
 ///@brief A powerful ThreadPool implementation with Future interface.
+///
+/// Work-stealing: each worker owns a WorkStealingQueue. Work submitted from a
+/// worker (e.g. Future::then continuations) goes to its own queue and is popped
+/// LIFO for cache locality. Work submitted from other threads goes to the inbox
+/// of the worker slot its thread maps to, so submitters rarely share a lock; a
+/// worker moves a batch from an inbox into its own queue under one lock.
+/// Idle workers steal FIFO from the others before parking.
+/// At most one parked worker is woken per submission, and only when no worker
+/// is already searching for work, so bursts do not wake every thread at once.
+///
+/// Elastic: the pool keeps between minThreads and maxThreads workers. A monitor
+/// thread adds a worker when queued work has not been picked up for a whole
+/// growThreshold while no worker is idle, and at once when workers inside a
+/// BlockingRegion leave fewer than minThreads runnable. Workers above
+/// minThreads exit after idleTimeout without work.
 class ThreadPool final : public Scheduler {
 public:
-    ThreadPool(int numThreads = 8);
+    ///@brief Marks the calling pool thread as blocked (file I/O, waiting on
+    /// another thread) for the scope's lifetime, so the pool may start a
+    /// compensating worker instead of letting queued work stall.
+    /// Does nothing outside a pool thread.
+    class BlockingRegion {
+    public:
+        BlockingRegion();
+        ~BlockingRegion();
+
+        BlockingRegion(const BlockingRegion&) = delete;
+        void operator=(const BlockingRegion&) = delete;
+
+    private:
+        ThreadPool* pool_;
+    };
+
+    ///@param numThreads minThreads, 0 for hardware_concurrency
+    ThreadPool(int numThreads = 0);
     ~ThreadPool();
 
     ThreadPool(const ThreadPool&) = delete;
@@ -63,15 +138,30 @@ public:
     ///@brief Stop thread pool and wait all threads terminate
     void joinAll();
 
-    ///@brief Set number of threads
-    ///
-    /// Num of threads is fixed after start thread pool
-    /// Default value is 1
+    ///@brief Set a fixed number of threads, same as setThreadRange(n, n)
+    /// 0 for hardware_concurrency, like the constructor
     void setNumOfThreads(int);
 
-    // ---- below are for unittest ----
+    ///@brief Set the range of worker threads, may be called at any time
+    ///
+    /// Default min is hardware_concurrency, max is 4 times of it.
+    /// Raising min starts workers at once; workers above a lowered max
+    /// exit when they become idle.
+    void setThreadRange(int minThreads, int maxThreads);
+
+    ///@brief How long queued work may wait without progress before a worker is added, default 500ms
+    void setGrowThreshold(std::chrono::milliseconds threshold);
+
+    ///@brief How long a worker above minThreads stays idle before it exits, default 30s
+    void setIdleTimeout(std::chrono::milliseconds timeout);
+
     // num of workers
     size_t workerThreads() const;
+    // most workers alive at the same time
+    size_t peakWorkerThreads() const;
+    // lower bound of the elastic range
+    size_t minWorkerThreads() const;
+    // ---- below are for unittest ----
     // num of waiting tasks
     size_t tasks() const;
 
@@ -80,18 +170,58 @@ public:
     virtual void schedule(std::function<void()> f);
 
 private:
-    void _workerRoutine();
-    void _start();
-
-    int numThreads_ { 1 };
-    std::deque<std::thread> workers_;
+    using Task = WorkStealingQueue::Task;
+
+    // a worker position; the queue outlives the thread so slots can be reused
+    struct Slot {
+        std::atomic<WorkStealingQueue*> queue { nullptr };
+        std::unique_ptr<WorkStealingQueue> owner;
+        std::thread thread;
+        bool active = false;
+        alignas(64) std::atomic<uint64_t> executed { 0 }; // written by the owning worker only
+        alignas(64) std::mutex injectMutex;
+        std::deque<Task*> injected; // submitted from non-worker threads
+        std::atomic<size_t> injectedCount { 0 };
+    };
 
-    mutable std::mutex mutex_;
+    void _workerRoutine(size_t index);
+    void _monitorRoutine();
+    void _start();
+    bool _ensureStarted(); // false if shut down
+    bool _spawn(); // mutex_ held
+    void _push(Task&& task);
+    Task* _take(size_t index);
+    Task* _takeInjected(Slot& from, size_t index);
+    bool _hasWork() const;
+    bool _isStarved() const;
+    uint64_t _executed() const;
+    void _wakeOne();
+    void _enterBlocking();
+    void _leaveBlocking();
+
+    std::unique_ptr<Slot[]> slots_; // kMaxThreads slots
+    std::atomic<size_t> slotCount_ { 0 }; // slots ever used, scanned by thieves
+    std::thread monitor_;
+
+    mutable std::mutex mutex_; // guards start/shutdown, slots, sizing and parking
     std::condition_variable cond_;
-    bool shutdown_ { false };
-    std::deque<std::function<void()>> tasks_;
-
-    static const int kMaxThreads = 512;
+    std::condition_variable monitorCond_;
+    std::atomic<bool> started_ { false };
+    std::atomic<bool> shutdown_ { false };
+    std::atomic<int> idle_ { 0 }; // parked workers
+    std::atomic<int> searching_ { 0 }; // woken workers that have not found work yet
+    std::atomic<bool> monitorArmed_ { false }; // monitor waits for a submission while no worker is idle
+
+    int minThreads_;
+    int maxThreads_;
+    int blocked_ { 0 }; // workers inside a BlockingRegion
+    std::chrono::milliseconds growThreshold_ { 500 };
+    std::chrono::milliseconds idleTimeout_ { 30000 };
+    std::atomic<int> current_ { 0 };
+    std::atomic<int> peak_ { 0 };
+
+    static constexpr int kMaxThreads = 512;
+    static constexpr size_t kInjectBatch = 32; // most tasks moved from an inbox per lock
     static std::thread::id s_mainThread;
 };
 
@@ -101,14 +231,9 @@ auto ThreadPool::execute(F&& f, Args&&... args) -> Future<typename std::result_o
 {
     using resultType = typename std::result_of<F(Args...)>::type;
 
-    std::unique_lock<std::mutex> guard(mutex_);
-    if (shutdown_)
+    if (!_ensureStarted())
         throw std::runtime_error("execute on closed thread pool");
 
-    if (workers_.empty()) {
-        _start();
-    }
-
     Promise<resultType> promise;
     auto future = promise.getFuture();
 
@@ -121,8 +246,7 @@ auto ThreadPool::execute(F&& f, Args&&... args) -> Future<typename std::result_o
         }
     };
 
-    tasks_.emplace_back(std::move(task));
-    cond_.notify_one();
+    _push(std::move(task));
 
     return future;
 }
@@ -134,14 +258,9 @@ auto ThreadPool::execute(F&& f, Args&&... args) -> Future<void>
     using resultType = typename std::result_of<F(Args...)>::type;
     static_assert(std::is_void<resultType>::value, "must be void");
 
-    std::unique_lock<std::mutex> guard(mutex_);
-    if (shutdown_)
+    if (!_ensureStarted())
         return makeReadyFuture();
 
-    if (workers_.empty()) {
-        _start();
-    }
-
     Promise<resultType> promise;
     auto future = promise.getFuture();
 
@@ -155,8 +274,7 @@ auto ThreadPool::execute(F&& f, Args&&... args) -> Future<void>
         }
     };
 
-    tasks_.emplace_back(std::move(task));
-    cond_.notify_one();
+    _push(std::move(task));
 
     return future;
 }
@@ -0,0 +1,348 @@
+﻿#include "bandwidthmanager.h"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace Net;
+static const qint64 s_unlimited = std::numeric_limits<qint64>::max();
+static const qint64 s_minQuantum = 1024; // 令牌攒够一个quantum才唤醒，避免过于频繁的小块读写
+static const qint64 s_maxQuantum = 64 * 1024;
+
+BandwidthManager& BandwidthManager::instance()
+{
+    static BandwidthManager myInstance;
+    return myInstance;
+}
+
+BandwidthManager::BandwidthManager()
+{
+    m_timer.setSingleShot(true);
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &BandwidthManager::dispatch);
+    m_elapsedTimer.start();
+}
+
+BandwidthManager::~BandwidthManager()
+{
+}
+
+void BandwidthManager::setGlobalLimit(Direction direction, qint64 bytesPerSecond)
+{
+    m_globalBuckets[static_cast<int>(direction)].rate = qMax<qint64>(bytesPerSecond, 0);
+    dispatch();
+}
+
+void BandwidthManager::setHostLimit(Direction direction, const QString& host, qint64 bytesPerSecond)
+{
+    auto& buckets = m_hostBuckets[static_cast<int>(direction)];
+    if (bytesPerSecond > 0) {
+        buckets[host].rate = bytesPerSecond;
+    } else {
+        buckets.remove(host);
+    }
+    dispatch();
+}
+
+qint64 BandwidthManager::globalLimit(Direction direction) const
+{
+    return m_globalBuckets[static_cast<int>(direction)].rate;
+}
+
+qint64 BandwidthManager::hostLimit(Direction direction, const QString& host) const
+{
+    return m_hostBuckets[static_cast<int>(direction)].value(host).rate;
+}
+
+bool BandwidthManager::hasLimit(Direction direction, const QString& host) const
+{
+    return globalLimit(direction) > 0 || hostLimit(direction, host) > 0;
+}
+
+int BandwidthManager::addConsumer(const Consumer& consumer)
+{
+    const int id = m_nextId++;
+    auto& info = m_consumers[id];
+    info.consumer = consumer;
+    info.bucket.rate = qMax<qint64>(consumer.limit, 0);
+    return id;
+}
+
+void BandwidthManager::removeConsumer(int id)
+{
+    m_consumers.erase(id);
+}
+
+void BandwidthManager::setConsumerLimit(int id, qint64 bytesPerSecond)
+{
+    auto it = m_consumers.find(id);
+    if (it == m_consumers.end()) {
+        return;
+    }
+    it->second.consumer.limit = bytesPerSecond;
+    it->second.bucket.rate = qMax<qint64>(bytesPerSecond, 0);
+    dispatch();
+}
+
+void BandwidthManager::setConsumerWeight(int id, int weight)
+{
+    auto it = m_consumers.find(id);
+    if (it != m_consumers.end()) {
+        it->second.consumer.weight = weight;
+    }
+}
+
+bool BandwidthManager::isLimited(int id) const
+{
+    auto it = m_consumers.find(id);
+    if (it == m_consumers.end()) {
+        return false;
+    }
+    const auto& consumer = it->second.consumer;
+    return it->second.bucket.isLimited() || hasLimit(consumer.direction, consumer.host);
+}
+
+qint64 BandwidthManager::limit(int id) const
+{
+    auto it = m_consumers.find(id);
+    if (it == m_consumers.end()) {
+        return 0;
+    }
+
+    const auto& consumer = it->second.consumer;
+    qint64 result = 0;
+    for (const qint64 rate : { it->second.bucket.rate, globalLimit(consumer.direction), hostLimit(consumer.direction, consumer.host) }) {
+        if (rate > 0 && (result == 0 || rate < result)) {
+            result = rate;
+        }
+    }
+    return result;
+}
+
+void BandwidthManager::notifyPending(int id)
+{
+    if (m_consumers.count(id) != 0) {
+        dispatch();
+    }
+}
+
+// 传输当前令牌允许的数据，并在最早有令牌可用的时刻再次唤醒；没有待传输的数据时不唤醒
+void BandwidthManager::dispatch()
+{
+    if (m_dispatching) { // transfer中触发的调度留到本次结束后
+        m_redispatch = true;
+        return;
+    }
+
+    m_dispatching = true;
+    const qint64 elapsedNs = m_elapsedTimer.nsecsElapsed();
+    m_elapsedTimer.restart();
+    qint64 waitMs = -1;
+    for (const auto direction : { Direction::Download, Direction::Upload }) {
+        const qint64 directionWaitMs = schedule(direction, elapsedNs);
+        if (directionWaitMs >= 0 && (waitMs < 0 || directionWaitMs < waitMs)) {
+            waitMs = directionWaitMs;
+        }
+    }
+    m_dispatching = false;
+    if (m_redispatch) {
+        m_redispatch = false;
+        waitMs = 0;
+    }
+
+    if (waitMs >= 0) {
+        m_timer.start(static_cast<int>(qMin<qint64>(waitMs, std::numeric_limits<int>::max())));
+    } else {
+        m_timer.stop();
+    }
+}
+
+// 按权重逐轮分配(水位填充)：每轮各consumer按权重分得全局与host剩余令牌的份额，
+// 受自身令牌或待传输字节数限制而用不完的部分留给下一轮的其余consumer。
+// 返回距离下一次有consumer可以传输一个quantum的毫秒数，-1表示无需唤醒
+qint64 BandwidthManager::schedule(Direction direction, qint64 elapsedNs)
+{
+    const int index = static_cast<int>(direction);
+    auto& global = m_globalBuckets[index];
+    auto& hostBuckets = m_hostBuckets[index];
+    global.refill(elapsedNs);
+    for (auto& bucket : hostBuckets) {
+        bucket.refill(elapsedNs);
+    }
+
+    struct Grant {
+        int id = 0;
+        QString host;
+        qint64 weight = 1;
+        qint64 limit = 0;
+        qint64 bytes = 0;
+        bool blocked = false; // 有令牌但consumer没有读写完，等consumer再次notifyPending
+    };
+    std::vector<Grant> grants;
+    QHash<QString, qint64> hostRemaining;
+    for (auto& pair : m_consumers) {
+        auto& info = pair.second;
+        if (info.consumer.direction != direction) {
+            continue;
+        }
+        info.bucket.refill(elapsedNs);
+        const qint64 pending = info.consumer.pending ? info.consumer.pending() : 0;
+        if (pending <= 0) {
+            continue;
+        }
+
+        Grant grant;
+        grant.id = pair.first;
+        grant.host = info.consumer.host;
+        grant.weight = qMax(info.consumer.weight, 1);
+        grant.limit = qMin(pending, info.bucket.available());
+        grants.push_back(grant);
+        if (!hostRemaining.contains(grant.host)) {
+            hostRemaining[grant.host] = hostBuckets.value(grant.host).available();
+        }
+    }
+
+    qint64 globalRemaining = global.available();
+    bool progress = true;
+    while (progress && globalRemaining > 0) {
+        progress = false;
+        qint64 totalWeight = 0;
+        QHash<QString, qint64> hostWeights;
+        for (const auto& grant : grants) {
+            if (grant.bytes < grant.limit && hostRemaining.value(grant.host) > 0) {
+                totalWeight += grant.weight;
+                hostWeights[grant.host] += grant.weight;
+            }
+        }
+        if (totalWeight == 0) {
+            break;
+        }
+
+        const qint64 globalBudget = globalRemaining;
+        const auto hostBudgets = hostRemaining;
+        for (auto& grant : grants) {
+            const qint64 hostLeft = hostRemaining.value(grant.host);
+            if (grant.bytes >= grant.limit || hostLeft <= 0 || globalRemaining <= 0) {
+                continue;
+            }
+
+            qint64 share = grant.limit - grant.bytes;
+            if (global.isLimited()) {
+                share = qMin(share, qMax<qint64>(globalBudget * grant.weight / totalWeight, 1));
+            }
+            const qint64 hostBudget = hostBudgets.value(grant.host);
+            if (hostBudget != s_unlimited) {
+                share = qMin(share, qMax<qint64>(hostBudget * grant.weight / hostWeights.value(grant.host), 1));
+            }
+            share = qMin(share, qMin(hostLeft, globalRemaining));
+            if (share <= 0) {
+                continue;
+            }
+
+            grant.bytes += share;
+            if (hostLeft != s_unlimited) {
+                hostRemaining[grant.host] = hostLeft - share;
+            }
+            if (globalRemaining != s_unlimited) {
+                globalRemaining -= share;
+            }
+            progress = true;
+        }
+    }
+
+    // transfer中可能移除consumer，每次都重新查找
+    for (auto& grant : grants) {
+        auto it = m_consumers.find(grant.id);
+        if (grant.bytes <= 0 || it == m_consumers.end()) {
+            continue;
+        }
+        const auto transfer = it->second.consumer.transfer;
+        const qint64 bytes = transfer ? transfer(grant.bytes) : 0;
+        grant.blocked = bytes < grant.bytes;
+        if (bytes <= 0) {
+            continue;
+        }
+
+        it = m_consumers.find(grant.id);
+        if (it != m_consumers.end()) {
+            it->second.bucket.consume(bytes);
+        }
+        auto hostIt = hostBuckets.find(grant.host);
+        if (hostIt != hostBuckets.end()) {
+            hostIt->consume(bytes);
+        }
+        global.consume(bytes);
+    }
+
+    // 仍有数据待传输的consumer，各级令牌都攒够一个quantum的最早时刻
+    qint64 waitMs = -1;
+    for (const auto& grant : grants) {
+        auto it = m_consumers.find(grant.id);
+        if (grant.blocked || it == m_consumers.end()) {
+            continue;
+        }
+        const auto& info = it->second;
+        const qint64 pending = info.consumer.pending ? info.consumer.pending() : 0;
+        if (pending <= 0) {
+            continue;
+        }
+
+        const Bucket host = hostBuckets.value(grant.host);
+        const Bucket* const buckets[] = { &info.bucket, &host, &global };
+        qint64 needBytes = pending;
+        for (const auto* bucket : buckets) {
+            if (bucket->isLimited()) {
+                needBytes = qMin(needBytes, bucket->quantum());
+            }
+        }
+        qint64 grantWaitMs = 0;
+        for (const auto* bucket : buckets) {
+            grantWaitMs = qMax(grantWaitMs, bucket->waitFor(needBytes));
+        }
+        grantWaitMs = qMax<qint64>(grantWaitMs, 1);
+        if (waitMs < 0 || grantWaitMs < waitMs) {
+            waitMs = grantWaitMs;
+        }
+    }
+    return waitMs;
+}
+
+qint64 BandwidthManager::Bucket::available() const
+{
+    return isLimited() ? static_cast<qint64>(tokens) : s_unlimited;
+}
+
+// 最多积累1/4秒的令牌，空闲一段时间后不会瞬间突发
+double BandwidthManager::Bucket::capacity() const
+{
+    return qMax(rate / 4.0, 1.0);
+}
+
+void BandwidthManager::Bucket::refill(qint64 elapsedNs)
+{
+    if (!isLimited()) {
+        tokens = 0;
+        return;
+    }
+    tokens = qMin(tokens + rate * (elapsedNs / 1e9), capacity());
+}
+
+// 约10毫秒的数据量
+qint64 BandwidthManager::Bucket::quantum() const
+{
+    return qMin(qBound(s_minQuantum, rate / 100, s_maxQuantum), static_cast<qint64>(capacity()));
+}
+
+qint64 BandwidthManager::Bucket::waitFor(qint64 bytes) const
+{
+    if (!isLimited() || tokens >= bytes) {
+        return 0;
+    }
+    return static_cast<qint64>(std::ceil((bytes - tokens) * 1000.0 / rate));
+}
+
+void BandwidthManager::Bucket::consume(qint64 bytes)
+{
+    if (isLimited()) {
+        tokens -= bytes;
+    }
+}
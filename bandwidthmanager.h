@@ -0,0 +1,93 @@
+﻿#ifndef NETWORK_BANDWIDTH_MANAGER_H
+#define NETWORK_BANDWIDTH_MANAGER_H
+
+#include "network_global.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+#include <functional>
+#include <map>
+
+namespace Net {
+/*** 带宽管理：全局、按host、按任务三级令牌桶，所有下载/上传任务共享 ***/
+// 任务有数据待传输时notifyPending，manager按各级速率补充令牌，再按权重在有数据待传输的任务间公平分配，
+// 任务拿到的字节数不超过自身、所属host与全局的令牌；令牌不足时用单次精确定时器在最早可传输的时刻再唤醒，空闲时没有定时器。
+// 限速可在运行时调整，对进行中的任务立即生效，例如直播课进行时调低后台下载的带宽。
+// 没有任何一级限速时任务直接读写。回调在manager所在线程(首次调用instance()的线程)执行，任务需与其同线程。
+class NETWORK_EXPORT BandwidthManager : public QObject {
+    Q_OBJECT
+public:
+    enum class Direction {
+        Download = 0,
+        Upload
+    };
+    struct Consumer {
+        Direction direction = Direction::Download;
+        QString host;
+        qint64 limit = 0; // 每秒字节数，<=0不限
+        int weight = 1; // 与同级任务争用带宽时的权重
+        std::function<qint64()> pending; // 待传输的字节数
+        std::function<qint64(qint64 maxBytes)> transfer; // 传输最多maxBytes，返回实际传输的字节数
+    };
+
+    static BandwidthManager& instance();
+
+    // 每秒字节数，<=0不限
+    void setGlobalLimit(Direction direction, qint64 bytesPerSecond);
+    void setHostLimit(Direction direction, const QString& host, qint64 bytesPerSecond);
+    qint64 globalLimit(Direction direction) const;
+    qint64 hostLimit(Direction direction, const QString& host) const;
+    bool hasLimit(Direction direction, const QString& host) const; // 全局或host有限速
+
+    int addConsumer(const Consumer& consumer); // 返回consumer id，从1开始
+    void removeConsumer(int id);
+    void setConsumerLimit(int id, qint64 bytesPerSecond);
+    void setConsumerWeight(int id, int weight);
+    bool isLimited(int id) const; // 任一级有限速时，consumer只能在transfer中按分配的字节数传输
+    qint64 limit(int id) const; // 各级限速中最小的，0表示不限
+    void notifyPending(int id); // 有新数据待传输
+
+protected:
+    BandwidthManager();
+    ~BandwidthManager();
+
+    BandwidthManager(BandwidthManager const&) = delete;
+    BandwidthManager(BandwidthManager&&) = delete;
+    BandwidthManager& operator=(BandwidthManager const&) = delete;
+    BandwidthManager& operator=(BandwidthManager&&) = delete;
+
+private slots:
+    void dispatch();
+
+private:
+    struct Bucket {
+        qint64 rate = 0;
+        double tokens = 0;
+        bool isLimited() const { return rate > 0; }
+        qint64 available() const;
+        double capacity() const;
+        void refill(qint64 elapsedNs);
+        qint64 quantum() const;
+        qint64 waitFor(qint64 bytes) const; // 令牌攒够bytes还需的毫秒数
+        void consume(qint64 bytes);
+    };
+    struct ConsumerInfo {
+        Consumer consumer;
+        Bucket bucket;
+    };
+
+    qint64 schedule(Direction direction, qint64 elapsedNs);
+
+private:
+    std::map<int, ConsumerInfo> m_consumers;
+    Bucket m_globalBuckets[2];
+    QHash<QString, Bucket> m_hostBuckets[2];
+    int m_nextId = 1;
+    bool m_dispatching = false;
+    bool m_redispatch = false;
+    QTimer m_timer;
+    QElapsedTimer m_elapsedTimer;
+};
+}
+#endif // NETWORK_BANDWIDTH_MANAGER_H
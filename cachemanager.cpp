@@ -1,9 +1,9 @@
 ﻿#include "cachemanager.h"
+#include "executor.h"
 #include <QDebug>
 #include <QDir>
 #include <QLockFile>
 #include <QStandardPaths>
-#include <QtConcurrent>
 #include <chrono>
 #include <fstream>
 #include <thread>
@@ -150,7 +150,7 @@ void CacheManager::setClearTag(quint64)
 CacheManager::CacheManager()
     : QObject(nullptr)
 {
-    QtConcurrent::run(clearCache);
+    Executor::instance().execute(Executor::Lane::Io, &CacheManager::clearCache);
 }
 
 CacheManager::~CacheManager() { }
@@ -0,0 +1,205 @@
+﻿#include "checksum.h"
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define NETWORK_CRC32C_SSE42 __attribute__((target("sse4.2")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define NETWORK_CRC32C_SSE42
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+using namespace Net;
+
+namespace {
+// Castagnoli多项式(反射)
+const quint32 s_crc32cPoly = 0x82F63B78;
+
+struct Crc32cTable {
+    quint32 values[256];
+    Crc32cTable()
+    {
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 crc = i;
+            for (int j = 0; j < 8; ++j) {
+                crc = (crc >> 1) ^ ((crc & 1) ? s_crc32cPoly : 0);
+            }
+            values[i] = crc;
+        }
+    }
+};
+
+quint32 crc32cSoftware(quint32 crc, const uchar* data, qint64 length)
+{
+    static const Crc32cTable s_table;
+    while (length-- > 0) {
+        crc = s_table.values[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(NETWORK_CRC32C_SSE42)
+NETWORK_CRC32C_SSE42 quint32 crc32cHardware(quint32 crc, const uchar* data, qint64 length)
+{
+    quint64 crc64 = crc;
+    while (length >= 8) {
+        quint64 value;
+        memcpy(&value, data, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        length -= 8;
+    }
+    crc = static_cast<quint32>(crc64);
+    while (length-- > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+
+bool hasHardwareCrc32c()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    static const bool s_supported = (info[2] & (1 << 20)) != 0;
+#else
+    static const bool s_supported = __builtin_cpu_supports("sse4.2");
+#endif
+    return s_supported;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+quint32 crc32cHardware(quint32 crc, const uchar* data, qint64 length)
+{
+    while (length >= 8) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        crc = __crc32cd(crc, value);
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+
+bool hasHardwareCrc32c()
+{
+    return true;
+}
+#else
+quint32 crc32cHardware(quint32 crc, const uchar* data, qint64 length)
+{
+    return crc32cSoftware(crc, data, length);
+}
+
+bool hasHardwareCrc32c()
+{
+    return false;
+}
+#endif
+
+QCryptographicHash::Algorithm toHashAlgorithm(Checksum::Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Checksum::Algorithm::Md5:
+        return QCryptographicHash::Md5;
+    case Checksum::Algorithm::Sha1:
+        return QCryptographicHash::Sha1;
+    default:
+        return QCryptographicHash::Sha256;
+    }
+}
+}
+
+Checksum::Checksum(Algorithm algorithm)
+    : m_algorithm(algorithm)
+{
+    if (m_algorithm != Algorithm::Crc32c) {
+        m_hash = std::make_unique<QCryptographicHash>(toHashAlgorithm(m_algorithm));
+    }
+}
+
+Checksum::~Checksum()
+{
+}
+
+void Checksum::reset()
+{
+    if (m_hash) {
+        m_hash->reset();
+    }
+    m_crc = 0;
+}
+
+void Checksum::addData(const char* data, qint64 length)
+{
+    if (length <= 0) {
+        return;
+    }
+    if (m_hash) {
+        m_hash->addData(data, static_cast<int>(length));
+    } else {
+        m_crc = crc32c(m_crc, data, length);
+    }
+}
+
+void Checksum::addData(const QByteArray& data)
+{
+    addData(data.constData(), data.size());
+}
+
+QByteArray Checksum::result() const
+{
+    if (m_hash) {
+        return m_hash->result();
+    }
+
+    QByteArray bytes(4, 0);
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<char>((m_crc >> (24 - i * 8)) & 0xFF);
+    }
+    return bytes;
+}
+
+int Checksum::digestLength(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Algorithm::Md5:
+        return 16;
+    case Algorithm::Sha1:
+        return 20;
+    case Algorithm::Sha256:
+        return 32;
+    case Algorithm::Crc32c:
+        return 4;
+    }
+    return 0;
+}
+
+QByteArray Checksum::fromString(Algorithm algorithm, const QByteArray& text)
+{
+    const QByteArray& value = text.trimmed();
+    const int length = digestLength(algorithm);
+    if (value.size() == length * 2) {
+        const auto& digest = QByteArray::fromHex(value);
+        if (digest.size() == length) {
+            return digest;
+        }
+    }
+
+    const auto& digest = QByteArray::fromBase64(value);
+    return digest.size() == length ? digest : QByteArray();
+}
+
+// 与zlib的crc32相同的约定：传入上一次的结果，首次为0
+quint32 Checksum::crc32c(quint32 crc, const char* data, qint64 length)
+{
+    const auto* bytes = reinterpret_cast<const uchar*>(data);
+    crc = ~crc;
+    crc = hasHardwareCrc32c() ? crc32cHardware(crc, bytes, length) : crc32cSoftware(crc, bytes, length);
+    return ~crc;
+}
@@ -0,0 +1,39 @@
+﻿#ifndef NETWORK_CHECKSUM_H
+#define NETWORK_CHECKSUM_H
+#include "network_global.h"
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <memory>
+
+namespace Net {
+/*** 增量校验：MD5/SHA由QCryptographicHash计算，CRC32C在支持的CPU上使用SSE4.2/ARMv8 CRC指令 ***/
+class NETWORK_EXPORT Checksum {
+public:
+    enum class Algorithm {
+        Md5 = 0,
+        Sha1,
+        Sha256,
+        Crc32c
+    };
+
+    explicit Checksum(Algorithm algorithm);
+    ~Checksum();
+
+    Algorithm algorithm() const { return m_algorithm; }
+    void reset();
+    void addData(const char* data, qint64 length);
+    void addData(const QByteArray& data);
+    QByteArray result() const; // 原始摘要，CRC32C为大端4字节
+
+    static int digestLength(Algorithm algorithm);
+    // 解析十六进制或base64形式的摘要，格式或长度不符时返回空
+    static QByteArray fromString(Algorithm algorithm, const QByteArray& text);
+    static quint32 crc32c(quint32 crc, const char* data, qint64 length);
+
+private:
+    Algorithm m_algorithm;
+    std::unique_ptr<QCryptographicHash> m_hash;
+    quint32 m_crc = 0;
+};
+}
+#endif // NETWORK_CHECKSUM_H
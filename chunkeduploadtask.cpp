@@ -0,0 +1,566 @@
+﻿#include "chunkeduploadtask.h"
+#include "cachemanager.h"
+#include "checksum.h"
+#include "executor.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QTimer>
+
+using namespace Net;
+static const int s_retryDelay = 1000; // 单块失败后重新查询偏移的延时，按连续失败次数递增 单位: milliseconds
+
+ChunkedUploadTask::ChunkedUploadTask(const QString& url, const QJsonObject& metadata, const QString& filePath)
+    : PostTask(url, metadata)
+    , m_filePath(filePath)
+    , m_progress(this, [this](const ProgressThrottle::Progress& progress) {
+        emit sigUploadProgress(progress.bytes, progress.bytesTotal);
+        emit sigUploadRate(progress.bytesPerSecond, progress.remainingMs);
+    })
+{
+    m_timeout = 0;
+    const QByteArray& key = QCryptographicHash::hash((url + '\n' + filePath).toUtf8(), QCryptographicHash::Sha1).toHex();
+    m_statePath = CacheManager::instance().getCacheDirectory(true) + "/upload/" + QString::fromLatin1(key) + ".json";
+}
+
+ChunkedUploadTask& ChunkedUploadTask::setChunkSize(qint64 bytes)
+{
+    m_chunkSize = qMax<qint64>(1, bytes);
+    return *this;
+}
+
+ChunkedUploadTask& ChunkedUploadTask::setChunkRetryCount(int count)
+{
+    m_chunkRetryCount = qMax(0, count);
+    return *this;
+}
+
+ChunkedUploadTask& ChunkedUploadTask::setChecksumEnable(bool enable)
+{
+    m_checksumEnable = enable;
+    return *this;
+}
+
+ChunkedUploadTask& ChunkedUploadTask::setParallelCount(int count)
+{
+    m_parallelCount = qMax(1, count);
+    return *this;
+}
+
+ChunkedUploadTask& ChunkedUploadTask::setStatePath(const QString& path)
+{
+    m_statePath = path;
+    return *this;
+}
+
+ChunkedUploadTask& ChunkedUploadTask::setProgressInterval(int ms)
+{
+    m_progress.setInterval(ms);
+    return *this;
+}
+
+void ChunkedUploadTask::abort()
+{
+    m_aborted = true;
+    // abort会同步触发finished，期间各部分的reply可能被释放，先拷贝一份
+    QList<QPointer<QNetworkReply>> replies;
+    for (const auto& part : m_parts) {
+        replies.append(part->reply);
+    }
+    replies.append(m_networkReply);
+
+    bool inFlight = false;
+    for (const auto& reply : replies) {
+        if (reply && !reply->isFinished()) {
+            inFlight = true;
+            reply->abort();
+        }
+    }
+    if (!inFlight && !m_parts.empty()) { // 都在线程池中读取或等待重传，没有reply，直接通知取消
+        notifyCanceled();
+    }
+}
+
+/*** 分块上传请求：有记录的上传地址时先查询偏移，否则创建上传 ***/
+QNetworkReply* ChunkedUploadTask::execute()
+{
+    ++m_attempt;
+    m_aborted = false;
+    m_uploadUrl.clear();
+    m_parts.clear();
+
+    const QFileInfo info(m_filePath);
+    if (!info.isFile() || !info.isReadable()) {
+        failWithError(QStringLiteral("file not readable: %1").arg(m_filePath));
+        return nullptr;
+    }
+    m_fileSize = info.size();
+    m_fileModified = info.lastModified().toMSecsSinceEpoch();
+    m_progress.reset(0);
+
+    if (!loadState()) {
+        splitParts();
+    }
+    if (isParallel()) {
+        qInfo() << QStringLiteral("ChunkedUploadTask url: %1, upload with %2 parts, fileSize: %3").arg(m_url).arg(m_parts.size()).arg(m_fileSize);
+    }
+    for (size_t i = 0; i < m_parts.size(); ++i) { // 创建失败时会同步清空m_parts
+        startPart(m_parts[i].get());
+    }
+    return nullptr;
+}
+
+QString ChunkedUploadTask::getContentType()
+{
+    return QString();
+}
+
+// 上传完成后记录的上传地址不再需要
+void ChunkedUploadTask::notifyResult(const ResultPtr& result)
+{
+    if (result->isSuccess()) {
+        removeState();
+        m_progress.finish(m_fileSize, m_fileSize);
+    } else {
+        m_progress.finish();
+    }
+    PostTask::notifyResult(result);
+}
+
+QNetworkRequest ChunkedUploadTask::createRequest(const QUrl& url)
+{
+    QNetworkRequest request(m_request);
+    request.setUrl(url);
+    request.setRawHeader("Tus-Resumable", "1.0.0");
+    return request;
+}
+
+// Upload-Metadata: filename d29ybGRfZG9taW5hdGlvbl9wbGFuLnBkZg==,key dmFsdWU=
+QByteArray ChunkedUploadTask::metadata()
+{
+    QList<QByteArray> items;
+    items.append("filename " + QFileInfo(m_filePath).fileName().toUtf8().toBase64());
+    for (auto it = m_params.constBegin(); it != m_params.constEnd(); ++it) {
+        items.append(it.key().toUtf8() + ' ' + it.value().toString().toUtf8().toBase64());
+    }
+    return items.join(',');
+}
+
+// 每部分至少一个块，最后一部分包含除不尽的余数
+void ChunkedUploadTask::splitParts()
+{
+    const qint64 count = qBound<qint64>(1, m_fileSize / m_chunkSize, m_parallelCount);
+    const qint64 length = m_fileSize / count;
+    for (qint64 i = 0; i < count; ++i) {
+        auto part = std::make_unique<Part>();
+        part->begin = i * length;
+        part->length = i + 1 == count ? m_fileSize - part->begin : length;
+        m_parts.push_back(std::move(part));
+    }
+}
+
+void ChunkedUploadTask::startPart(Part* part)
+{
+    if (part->uploadUrl.isEmpty()) {
+        createPart(part);
+    } else {
+        queryPart(part);
+    }
+}
+
+// 并发上传时各部分为partial上传，元数据在合并时发送
+void ChunkedUploadTask::createPart(Part* part)
+{
+    QNetworkRequest request = createRequest(m_request.url());
+    request.setRawHeader("Upload-Length", QByteArray::number(part->length));
+    if (isParallel()) {
+        request.setRawHeader("Upload-Concat", "partial");
+    } else {
+        request.setRawHeader("Upload-Metadata", metadata());
+    }
+    part->reply = getNetworkAccessManager()->post(request, QByteArray());
+    connect(part->reply, &QNetworkReply::finished, this, [=]() { onPartCreated(part); });
+    connect(part->reply, &QNetworkReply::sslErrors, this, &ChunkedUploadTask::onCopeSslErrors);
+}
+
+void ChunkedUploadTask::onPartCreated(Part* part)
+{
+    auto reply = part->reply;
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() != QNetworkReply::NoError || httpCode < 200 || httpCode >= 300) {
+        failParts(reply); // 错误重试、重定向走通用流程
+        return;
+    }
+    const QByteArray& location = reply->rawHeader("Location");
+    if (location.isEmpty()) {
+        failWithError(QStringLiteral("no Location in creation response"));
+        return;
+    }
+
+    part->uploadUrl = reply->url().resolved(QUrl(QString::fromUtf8(location))).toString();
+    part->offset = 0;
+    saveState();
+    qInfo() << QStringLiteral("ChunkedUploadTask url: %1, upload created: %2").arg(m_url).arg(part->uploadUrl);
+    if (part->length == 0) {
+        completePart(part);
+        return;
+    }
+    releasePartReply(part);
+    readChunk(part);
+}
+
+void ChunkedUploadTask::queryPart(Part* part)
+{
+    part->reply = getNetworkAccessManager()->head(createRequest(QUrl(part->uploadUrl)));
+    connect(part->reply, &QNetworkReply::finished, this, [=]() { onPartQueried(part); });
+    connect(part->reply, &QNetworkReply::sslErrors, this, &ChunkedUploadTask::onCopeSslErrors);
+}
+
+void ChunkedUploadTask::onPartQueried(Part* part)
+{
+    auto reply = part->reply;
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!m_aborted && (httpCode == 403 || httpCode == 404 || httpCode == 410)) { // 上传已过期或被服务端删除，重新创建
+        qInfo() << QStringLiteral("ChunkedUploadTask url: %1, upload %2 expired, httpCode: %3, create a new one").arg(m_url).arg(part->uploadUrl).arg(httpCode);
+        part->uploadUrl.clear();
+        saveState();
+        releasePartReply(part);
+        createPart(part);
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError) {
+        if (!retryPart(part)) {
+            failParts(reply);
+        }
+        return;
+    }
+
+    bool ok = false;
+    const qint64 offset = reply->rawHeader("Upload-Offset").toLongLong(&ok);
+    if (!ok || offset < 0 || offset > part->length) {
+        failWithError(QStringLiteral("invalid Upload-Offset: %1").arg(QString(reply->rawHeader("Upload-Offset"))));
+        return;
+    }
+
+    part->offset = offset;
+    part->sending = 0;
+    updateProgress();
+    qInfo() << QStringLiteral("ChunkedUploadTask url: %1, resume %2 from %3 bytes").arg(m_url).arg(part->uploadUrl).arg(offset);
+    if (part->offset >= part->length) { // 上次已全部上传，只是没有收到最后的响应
+        completePart(part);
+        return;
+    }
+    releasePartReply(part);
+    readChunk(part);
+}
+
+// 在线程池中读取并计算摘要，避免大块读盘阻塞网络线程
+void ChunkedUploadTask::readChunk(Part* part)
+{
+    const QString filePath = m_filePath;
+    const qint64 offset = part->begin + part->offset;
+    const qint64 size = qMin(m_chunkSize, part->length - part->offset);
+    const bool checksumEnable = m_checksumEnable;
+    auto future = Executor::instance().execute(Executor::Lane::Io, [=]() {
+        Async::ThreadPool::BlockingRegion blocking;
+        QByteArray bytes;
+        QFile file(filePath);
+        if (file.open(QIODevice::ReadOnly) && file.seek(offset)) {
+            bytes = file.read(size);
+        }
+        QByteArray checksum;
+        if (checksumEnable && bytes.size() == size) {
+            Checksum sha1(Checksum::Algorithm::Sha1);
+            sha1.addData(bytes);
+            checksum = sha1.result();
+        }
+        return qMakePair(bytes, checksum);
+    });
+    const int attempt = m_attempt;
+    future.then(this, [this, part, attempt, offset, size](QPair<QByteArray, QByteArray> chunk) {
+        if (attempt != m_attempt) { // 读取期间已取消或整体失败
+            return;
+        }
+        if (chunk.first.size() != size) {
+            failWithError(QStringLiteral("read file failed at %1 bytes").arg(offset));
+            return;
+        }
+        sendChunk(part, chunk.first, chunk.second);
+    });
+}
+
+void ChunkedUploadTask::sendChunk(Part* part, const QByteArray& bytes, const QByteArray& checksum)
+{
+    QNetworkRequest request = createRequest(QUrl(part->uploadUrl));
+    request.setHeader(QNetworkRequest::ContentTypeHeader, QStringLiteral("application/offset+octet-stream"));
+    request.setRawHeader("Upload-Offset", QByteArray::number(part->offset));
+    if (!checksum.isEmpty()) {
+        request.setRawHeader("Upload-Checksum", "sha1 " + checksum.toBase64());
+    }
+
+    const qint64 size = bytes.size();
+    part->sending = 0;
+    part->reply = getNetworkAccessManager()->sendCustomRequest(request, "PATCH", bytes);
+    connect(part->reply, &QNetworkReply::uploadProgress, this, [=](qint64 bytesSent, qint64 bytesTotal) {
+        Q_UNUSED(bytesTotal);
+        part->sending = qMin(bytesSent, size);
+        updateProgress();
+    });
+    connect(part->reply, &QNetworkReply::finished, this, [=]() {
+        if (part->reply->error() == QNetworkReply::NoError && part->reply->rawHeader("Upload-Offset").isEmpty()) {
+            part->offset += size; // 服务端应返回新的偏移，缺少时按整块已确认处理
+        }
+        onChunkFinished(part);
+    });
+    connect(part->reply, &QNetworkReply::sslErrors, this, &ChunkedUploadTask::onCopeSslErrors);
+}
+
+void ChunkedUploadTask::onChunkFinished(Part* part)
+{
+    auto reply = part->reply;
+    part->sending = 0;
+    if (reply->error() != QNetworkReply::NoError) {
+        if (!retryPart(part)) {
+            failParts(reply);
+        }
+        return;
+    }
+
+    bool ok = false;
+    const qint64 offset = reply->rawHeader("Upload-Offset").toLongLong(&ok);
+    if (ok) {
+        part->offset = qBound<qint64>(0, offset, part->length);
+    }
+    part->retries = 0;
+    updateProgress();
+    if (part->offset >= part->length) {
+        completePart(part);
+        return;
+    }
+    releasePartReply(part);
+    readChunk(part);
+}
+
+// 单块失败时延时重新查询偏移再继续。返回false表示不可重试或已超过重传次数
+bool ChunkedUploadTask::retryPart(Part* part)
+{
+    // 0为网络错误，409偏移冲突，423上传被锁定，460校验不一致
+    auto reply = part->reply;
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool retryable = httpCode == 0 || httpCode >= 500 || httpCode == 409 || httpCode == 423 || httpCode == 460;
+    if (m_aborted || !retryable || part->retries >= m_chunkRetryCount) {
+        return false;
+    }
+
+    part->retries++;
+    qInfo() << QStringLiteral("ChunkedUploadTask url: %1, %2 failed at %3 bytes, httpCode: %4, error: %5, retry %6/%7").arg(m_url).arg(part->uploadUrl).arg(part->offset).arg(httpCode).arg(reply->errorString()).arg(part->retries).arg(m_chunkRetryCount);
+    releasePartReply(part);
+    const int attempt = m_attempt;
+    QTimer::singleShot(s_retryDelay * part->retries, this, [this, part, attempt]() {
+        if (attempt == m_attempt) {
+            queryPart(part);
+        }
+    });
+    return true;
+}
+
+// 不分段时最后一块的响应即为结果，并发上传时全部完成后合并
+void ChunkedUploadTask::completePart(Part* part)
+{
+    if (!isParallel()) {
+        m_uploadUrl = part->uploadUrl;
+        auto reply = part->reply;
+        part->reply = nullptr;
+        disconnect(reply, nullptr, this, nullptr);
+        finishWithReply(reply);
+        return;
+    }
+
+    releasePartReply(part);
+    for (const auto& item : m_parts) {
+        if (item->offset < item->length || item->reply) {
+            return;
+        }
+    }
+    commit();
+}
+
+// Upload-Concat: final;/files/a /files/b
+void ChunkedUploadTask::commit()
+{
+    QStringList urls;
+    for (const auto& part : m_parts) {
+        urls.append(QUrl(part->uploadUrl).path());
+    }
+    qInfo() << QStringLiteral("ChunkedUploadTask url: %1, all parts uploaded, concatenate %2 parts").arg(m_url).arg(urls.size());
+
+    QNetworkRequest request = createRequest(m_request.url());
+    request.setRawHeader("Upload-Concat", "final;" + urls.join(QStringLiteral(" ")).toUtf8());
+    request.setRawHeader("Upload-Metadata", metadata());
+    m_networkReply = getNetworkAccessManager()->post(request, QByteArray());
+    connect(m_networkReply, &QNetworkReply::finished, this, &ChunkedUploadTask::onCommitFinished);
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &ChunkedUploadTask::onCopeSslErrors);
+}
+
+// 合并失败时交给通用流程重试，重试时各部分查询到已完成，直接再次合并
+void ChunkedUploadTask::onCommitFinished()
+{
+    auto reply = m_networkReply;
+    const QByteArray& location = reply->rawHeader("Location");
+    if (reply->error() == QNetworkReply::NoError && !location.isEmpty()) {
+        m_uploadUrl = reply->url().resolved(QUrl(QString::fromUtf8(location))).toString();
+    }
+    disconnect(reply, nullptr, this, nullptr);
+    finishWithReply(reply);
+}
+
+void ChunkedUploadTask::updateProgress()
+{
+    qint64 bytes = 0;
+    for (const auto& part : m_parts) {
+        bytes += part->offset + part->sending;
+    }
+    m_progress.update(bytes, m_fileSize);
+}
+
+void ChunkedUploadTask::releasePartReply(Part* part)
+{
+    auto reply = part->reply;
+    if (reply == nullptr) {
+        return;
+    }
+
+    part->reply = nullptr;
+    disconnect(reply, nullptr, this, nullptr);
+    if (!reply->isFinished()) {
+        reply->abort();
+    }
+    reply->deleteLater();
+}
+
+// 一部分失败时断开其他部分，交给通用流程生成结果与重试，已上传的内容在重试时通过查询偏移继续
+void ChunkedUploadTask::failParts(QNetworkReply* reply)
+{
+    for (const auto& part : m_parts) {
+        if (part->reply != reply) {
+            releasePartReply(part.get());
+        }
+        part->reply = nullptr;
+    }
+    disconnect(reply, nullptr, this, nullptr);
+    finishWithReply(reply);
+}
+
+void ChunkedUploadTask::finishWithReply(QNetworkReply* reply)
+{
+    ++m_attempt;
+    m_parts.clear();
+    m_networkReply = reply;
+    onRequestFinished();
+}
+
+void ChunkedUploadTask::failWithError(const QString& reason)
+{
+    for (const auto& part : m_parts) {
+        releasePartReply(part.get());
+    }
+    qInfo() << QStringLiteral("ChunkedUploadTask url: %1, failed: %2").arg(m_url).arg(reason);
+    auto result = createResult();
+    result->m_httpCode = -1;
+    result->m_qtNetworkError = QNetworkReply::ProtocolFailure;
+    result->m_qtErrorString = reason;
+    result->m_statusCode = Result::RequestStatus::UnknowError;
+    notifyUploadResult(result);
+}
+
+void ChunkedUploadTask::notifyCanceled()
+{
+    auto result = createResult();
+    result->m_httpCode = -1;
+    result->m_qtNetworkError = QNetworkReply::OperationCanceledError;
+    result->m_qtErrorString = QStringLiteral("Operation canceled");
+    result->m_statusCode = Result::RequestStatus::NetworkError;
+    notifyUploadResult(result);
+}
+
+void ChunkedUploadTask::notifyUploadResult(const ResultPtr& result)
+{
+    ++m_attempt;
+    m_parts.clear();
+    result->m_taskId = m_taskId;
+    qInfo() << QStringLiteral("Task finished, async request elapsedTime: %1ms, url: %2").arg(m_elapsedTimer.elapsed()).arg(m_url);
+    m_elapsedTimer.restart();
+    printResultLog(result);
+    notifyResult(result);
+}
+
+// 文件或接口变化时之前的上传地址作废，沿用上次的分段
+bool ChunkedUploadTask::loadState()
+{
+    QFile file(m_statePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const auto& obj = QJsonDocument::fromJson(file.readAll()).object();
+    if (obj.value("url").toString() != m_url || obj.value("filePath").toString() != m_filePath
+        || static_cast<qint64>(obj.value("fileSize").toDouble()) != m_fileSize
+        || static_cast<qint64>(obj.value("lastModified").toDouble()) != m_fileModified) {
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Part>> parts;
+    qint64 end = 0;
+    for (const auto& value : obj.value("parts").toArray()) {
+        const auto& item = value.toObject();
+        auto part = std::make_unique<Part>();
+        part->begin = static_cast<qint64>(item.value("begin").toDouble());
+        part->length = static_cast<qint64>(item.value("length").toDouble());
+        part->uploadUrl = item.value("uploadUrl").toString();
+        if (part->begin != end || part->length < 0) {
+            return false;
+        }
+        end += part->length;
+        parts.push_back(std::move(part));
+    }
+    if (parts.empty() || end != m_fileSize) {
+        return false;
+    }
+
+    m_parts = std::move(parts);
+    return true;
+}
+
+void ChunkedUploadTask::saveState()
+{
+    QJsonArray parts;
+    for (const auto& part : m_parts) {
+        parts.append(QJsonObject {
+            { "begin", static_cast<double>(part->begin) },
+            { "length", static_cast<double>(part->length) },
+            { "uploadUrl", part->uploadUrl } });
+    }
+    QJsonObject obj {
+        { "url", m_url },
+        { "filePath", m_filePath },
+        { "fileSize", static_cast<double>(m_fileSize) },
+        { "lastModified", static_cast<double>(m_fileModified) },
+        { "parts", parts }
+    };
+    QDir().mkpath(QFileInfo(m_statePath).absolutePath());
+    QSaveFile file(m_statePath);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
+
+void ChunkedUploadTask::removeState()
+{
+    QFile::remove(m_statePath);
+}
@@ -0,0 +1,98 @@
+﻿#ifndef NETWORK_CHUNKED_UPLOAD_TASK_H
+#define NETWORK_CHUNKED_UPLOAD_TASK_H
+#include "posttask.h"
+#include "progressthrottle.h"
+#include <memory>
+#include <vector>
+
+namespace Net {
+/*** 分块断点续传上传，协议为tus 1.0(core、creation、checksum与concatenation扩展) ***/
+// 1. 首次上传时 POST url 创建上传(Upload-Length、Upload-Metadata)，服务端在Location中返回上传地址，记录到状态文件。
+// 2. 重试或程序重启后再次上传同一文件时，先 HEAD 上传地址查询服务端已确认的偏移(Upload-Offset)，只上传剩余部分；上传地址已失效时重新创建。
+// 3. 按块在线程池中读取文件并计算SHA-1，PATCH 上传(Upload-Offset、Upload-Checksum)，每个连接内存中最多一个块。
+// 4. 单块失败(网络错误、5xx、偏移冲突、校验不一致)时延时重新查询偏移后继续，连续失败超过setChunkRetryCount次才整体失败，整体失败后仍按setRerequestCount重试。
+// 5. setParallelCount大于1时把文件分为等长的若干部分，各自创建partial上传并行上传，全部完成后 POST Upload-Concat: final 合并。
+// 上传完成后删除状态文件，结果为最后一次响应
+class NETWORK_EXPORT ChunkedUploadTask : public PostTask {
+    Q_OBJECT
+public:
+    // metadata作为Upload-Metadata发送，另外附带filename
+    ChunkedUploadTask(const QString& url, const QJsonObject& metadata, const QString& filePath);
+    ChunkedUploadTask& setChunkSize(qint64 bytes); // 默认8M
+    ChunkedUploadTask& setChunkRetryCount(int count); // 单块连续失败的重传次数，默认3
+    ChunkedUploadTask& setChecksumEnable(bool enable); // 每块附带Upload-Checksum(sha1)，默认true
+    // 并发上传的连接数，默认1。大于1时服务端需支持concatenation扩展，每部分至少一个块，文件较小时连接数相应减少。
+    // 续传时沿用上次的分段，不受本设置影响
+    ChunkedUploadTask& setParallelCount(int count);
+    // 记录上传地址的状态文件，默认在缓存目录下按url与文件路径命名
+    ChunkedUploadTask& setStatePath(const QString& path);
+    // 进度信号的最短间隔，默认100ms，<=0时每次回调都发出
+    ChunkedUploadTask& setProgressInterval(int ms);
+    QString uploadUrl() const { return m_uploadUrl; } // 服务端分配的上传地址，并发上传时为合并后的地址
+    void abort() override;
+
+signals:
+    void sigUploadProgress(qint64 bytesSent, qint64 bytesTotal); // 各部分已确认与正在发送的字节数之和
+    void sigUploadRate(qint64 bytesPerSecond, qint64 remainingMs);
+
+protected:
+    QNetworkReply* execute() override;
+    QString getContentType() override;
+    void notifyResult(const ResultPtr& result) override;
+
+private:
+    // 文件中的一段，对应一个上传地址，不分段时为整个文件
+    struct Part {
+        qint64 begin = 0;
+        qint64 length = 0;
+        qint64 offset = 0; // 服务端已确认的偏移，相对begin
+        qint64 sending = 0; // 正在上传的块已发送的字节数
+        QString uploadUrl;
+        QNetworkReply* reply = nullptr;
+        int retries = 0; // 当前连续失败的次数
+    };
+
+    QNetworkRequest createRequest(const QUrl& url);
+    QByteArray metadata();
+    bool isParallel() const { return m_parts.size() > 1; }
+    void splitParts();
+    void startPart(Part* part);
+    void createPart(Part* part);
+    void onPartCreated(Part* part);
+    void queryPart(Part* part);
+    void onPartQueried(Part* part);
+    void readChunk(Part* part);
+    void sendChunk(Part* part, const QByteArray& bytes, const QByteArray& checksum);
+    void onChunkFinished(Part* part);
+    bool retryPart(Part* part);
+    void completePart(Part* part);
+    void commit();
+    void onCommitFinished();
+    void updateProgress();
+    void releasePartReply(Part* part);
+    void failParts(QNetworkReply* reply);
+    void finishWithReply(QNetworkReply* reply);
+    void failWithError(const QString& reason);
+    void notifyCanceled();
+    void notifyUploadResult(const ResultPtr& result);
+    bool loadState();
+    void saveState();
+    void removeState();
+
+private:
+    QString m_filePath;
+    qint64 m_fileSize = 0;
+    qint64 m_fileModified = 0; // 状态文件中记录，文件变化后之前上传的内容作废
+    qint64 m_chunkSize = 8 * 1024 * 1024;
+    int m_chunkRetryCount = 3;
+    bool m_checksumEnable = true;
+    int m_parallelCount = 1;
+    QString m_statePath;
+    QString m_uploadUrl;
+    std::vector<std::unique_ptr<Part>> m_parts;
+    int m_attempt = 0; // 每次开始或结束时递增，之前发起的读取、延时重传回来后不再处理
+    bool m_aborted = false;
+    ProgressThrottle m_progress;
+};
+}
+#endif // NETWORK_CHUNKED_UPLOAD_TASK_H
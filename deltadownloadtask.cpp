@@ -0,0 +1,815 @@
+﻿#include "deltadownloadtask.h"
+#include "executor.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace Net;
+static const int s_maxRangesPerRequest = 32; // 每个请求最多带的区间数，避免Range头过长被服务端拒绝
+static const qint64 s_maxBlockSize = 16 * 1024 * 1024;
+static const qint64 s_readBufferSize = 2 * 1024 * 1024; // 写文件跟不上时reply最多缓存2M，之后由TCP反压
+static const qint64 s_readBlockSize = 1024 * 1024;
+static const qint64 s_maxPartHeaderSize = 8 * 1024; // multipart分块头的上限，超过视为格式错误
+
+// zsync清单：头部为"Key: value"行，空行之后是每块的rsum(大端a、b的后rsumBytes字节)与MD4前checksumBytes字节
+struct DeltaDownloadTask::Manifest {
+    qint64 blockSize = 0;
+    qint64 length = 0;
+    int seqMatches = 1; // 为2时要求连续两块都匹配，用以弥补截短的校验
+    int rsumBytes = 4;
+    int checksumBytes = 16;
+    QByteArray sha1;
+    std::vector<quint32> rsums;
+    std::vector<QByteArray> checksums;
+
+    int blockCount() const { return static_cast<int>(rsums.size()); }
+    quint32 rsumMask() const { return rsumBytes >= 4 ? 0xFFFFFFFF : (1u << (rsumBytes * 8)) - 1; }
+};
+
+namespace {
+// Content-Range: bytes 100-199/1000
+bool parseContentRange(const QByteArray& value, qint64* begin, qint64* end, qint64* total)
+{
+    const int space = value.indexOf(' ');
+    const int dash = value.indexOf('-', space + 1);
+    const int slash = value.indexOf('/', dash + 1);
+    if (space < 0 || dash < 0 || slash < 0) {
+        return false;
+    }
+    bool ok1 = false;
+    bool ok2 = false;
+    *begin = value.mid(space + 1, dash - space - 1).trimmed().toLongLong(&ok1);
+    *end = value.mid(dash + 1, slash - dash - 1).trimmed().toLongLong(&ok2);
+    *total = value.mid(slash + 1).trimmed().toLongLong(); // 未知时为*，记为0
+    return ok1 && ok2 && *begin <= *end;
+}
+
+// 块的弱校验：a为字节和，b为按到块尾距离加权的和，均取低16位
+struct RollingSum {
+    quint16 a = 0;
+    quint16 b = 0;
+
+    quint32 value() const { return (static_cast<quint32>(a) << 16) | b; }
+};
+}
+
+DeltaDownloadTask::DeltaDownloadTask(const QString& url, const QString& savePath)
+    : GetTask(url)
+    , m_savePath(savePath)
+    , m_manifestUrl(url + ".zsync")
+    , m_seedPath(savePath)
+    , m_progress(this, [this](const ProgressThrottle::Progress& progress) { notifyProgress(progress); })
+{
+    m_timeout = 0;
+    m_signEnable = false;
+}
+
+DeltaDownloadTask::~DeltaDownloadTask()
+{
+    if (m_writer) {
+        m_writer->setReadyCallback(nullptr);
+    }
+}
+
+DeltaDownloadTask& DeltaDownloadTask::setManifestUrl(const QString& url)
+{
+    m_manifestUrl = url;
+    return *this;
+}
+
+DeltaDownloadTask& DeltaDownloadTask::setSeedPath(const QString& path)
+{
+    m_seedPath = path;
+    return *this;
+}
+
+DeltaDownloadTask& DeltaDownloadTask::setCalcSpeed(bool calcSpeed)
+{
+    m_calcSpeed = calcSpeed;
+    return *this;
+}
+
+DeltaDownloadTask& DeltaDownloadTask::setProgressInterval(int ms)
+{
+    m_progress.setInterval(ms);
+    return *this;
+}
+
+void DeltaDownloadTask::abort()
+{
+    m_aborted = true;
+    if (m_fallback) {
+        m_fallback->abort();
+        return;
+    }
+
+    GetTask::abort(); // 匹配或写入收尾中没有reply，在其完成时通知取消
+}
+
+/*** 增量下载请求：先下载清单 ***/
+// 上一次的part文件关闭并删除后再开始，块匹配会重新写入该文件
+QNetworkReply* DeltaDownloadTask::execute()
+{
+    m_result.reset();
+    createResult();
+    releaseFile();
+    m_aborted = false;
+    m_fallback.reset();
+    m_manifest.reset();
+    m_reusedBytes = 0;
+    m_fetchedBytes = 0;
+    m_progress.reset(0);
+    whenFileReleased([this]() {
+        requestManifest();
+    });
+    return nullptr;
+}
+
+void DeltaDownloadTask::requestManifest()
+{
+    if (m_aborted) { // 等待关闭期间已取消
+        notifyCanceled();
+        return;
+    }
+
+    QNetworkRequest request(m_request);
+    request.setUrl(QUrl(m_manifestUrl));
+    m_networkReply = getNetworkAccessManager()->get(request);
+    connect(m_networkReply, &QNetworkReply::finished, this, &DeltaDownloadTask::onManifestFinished);
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &DeltaDownloadTask::onCopeSslErrors);
+}
+
+ResultPtr DeltaDownloadTask::createResult()
+{
+    if (m_result == nullptr) {
+        m_result = std::make_shared<DownloadResult>();
+    }
+    return m_result;
+}
+
+// 网络错误、取消时交给通用流程重试或通知，清理本次的part文件
+void DeltaDownloadTask::getBytesFromReply(const ResultPtr& result, QNetworkReply* reply)
+{
+    Q_UNUSED(result);
+    Q_UNUSED(reply);
+    releaseFile();
+}
+
+void DeltaDownloadTask::onManifestFinished()
+{
+    auto reply = m_networkReply;
+    if (m_aborted) {
+        onRequestFinished();
+        return;
+    }
+
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() != QNetworkReply::NoError || httpCode != 200) {
+        reply->deleteLater();
+        m_networkReply = nullptr;
+        startFallback(QStringLiteral("manifest unavailable, httpCode: %1").arg(httpCode));
+        return;
+    }
+
+    const QByteArray bytes = reply->readAll();
+    reply->deleteLater();
+    m_networkReply = nullptr;
+    m_manifest = parseManifest(bytes);
+    if (m_manifest == nullptr) {
+        startFallback(QStringLiteral("invalid manifest"));
+        return;
+    }
+
+    // 旧文件已是最新版本、无需Range请求时以清单请求的结果作为结果
+    m_result->m_httpCode = httpCode;
+    m_result->m_qtNetworkError = QNetworkReply::NoError;
+    m_result->m_statusCode = Result::RequestStatus::Success;
+
+    const auto manifest = m_manifest;
+    const QString seedPath = m_seedPath;
+    const QString partPath = getPartPath();
+    auto future = Executor::instance().execute(Executor::Lane::Compute, [=]() {
+        return matchSeed(manifest, seedPath, partPath);
+    });
+    future.then(this, [this](std::shared_ptr<std::vector<char>> found) {
+        onSeedMatched(found);
+    });
+}
+
+std::shared_ptr<const DeltaDownloadTask::Manifest> DeltaDownloadTask::parseManifest(const QByteArray& bytes)
+{
+    const int headerEnd = bytes.indexOf("\n\n");
+    if (headerEnd < 0) {
+        return nullptr;
+    }
+
+    auto manifest = std::make_shared<Manifest>();
+    bool hasUrl = false;
+    bool hasCompressedUrl = false;
+    for (const auto& line : bytes.left(headerEnd).split('\n')) {
+        const int colon = line.indexOf(':');
+        if (colon <= 0) {
+            continue;
+        }
+        const QByteArray key = line.left(colon).trimmed();
+        const QByteArray value = line.mid(colon + 1).trimmed();
+        if (key == "Blocksize") {
+            manifest->blockSize = value.toLongLong();
+        } else if (key == "Length") {
+            manifest->length = value.toLongLong();
+        } else if (key == "Hash-Lengths") {
+            const auto& lengths = value.split(',');
+            if (lengths.size() != 3) {
+                return nullptr;
+            }
+            manifest->seqMatches = lengths[0].toInt();
+            manifest->rsumBytes = lengths[1].toInt();
+            manifest->checksumBytes = lengths[2].toInt();
+        } else if (key == "SHA-1") {
+            manifest->sha1 = QByteArray::fromHex(value);
+        } else if (key == "URL") {
+            hasUrl = true;
+        } else if (key == "Z-URL") {
+            hasCompressedUrl = true;
+        }
+    }
+
+    // 只提供了gzip压缩后的数据时无法按块取回
+    if (hasCompressedUrl && !hasUrl) {
+        return nullptr;
+    }
+    if (manifest->blockSize <= 0 || manifest->blockSize > s_maxBlockSize || manifest->length <= 0 || manifest->sha1.size() != 20
+        || manifest->seqMatches < 1 || manifest->seqMatches > 2 || manifest->rsumBytes < 1 || manifest->rsumBytes > 4
+        || manifest->checksumBytes < 1 || manifest->checksumBytes > 16) {
+        return nullptr;
+    }
+
+    const qint64 blockCount = (manifest->length + manifest->blockSize - 1) / manifest->blockSize;
+    const int recordSize = manifest->rsumBytes + manifest->checksumBytes;
+    const qint64 dataBegin = headerEnd + 2;
+    if (blockCount > std::numeric_limits<int>::max() || bytes.size() - dataBegin < blockCount * recordSize) {
+        return nullptr;
+    }
+
+    manifest->rsums.reserve(blockCount);
+    manifest->checksums.reserve(blockCount);
+    const auto* data = reinterpret_cast<const uchar*>(bytes.constData() + dataBegin);
+    for (qint64 i = 0; i < blockCount; ++i, data += recordSize) {
+        quint32 rsum = 0;
+        for (int j = 0; j < manifest->rsumBytes; ++j) {
+            rsum = (rsum << 8) | data[j];
+        }
+        manifest->rsums.push_back(rsum);
+        manifest->checksums.emplace_back(reinterpret_cast<const char*>(data + manifest->rsumBytes), manifest->checksumBytes);
+    }
+    return manifest;
+}
+
+// 在线程池中执行：在旧文件中逐字节滑动窗口，弱校验命中后再比较MD4，找到的块写入part文件。
+// 块尾超出旧文件的部分按0补齐，与zsyncmake对最后一块的处理一致。part文件无法创建时返回nullptr
+std::shared_ptr<std::vector<char>> DeltaDownloadTask::matchSeed(const std::shared_ptr<const Manifest>& manifest, const QString& seedPath, const QString& partPath)
+{
+    QDir().mkpath(QFileInfo(partPath).absolutePath());
+    QFile part(partPath);
+    if (!part.open(QIODevice::ReadWrite | QIODevice::Truncate) || !part.resize(manifest->length)) {
+        return nullptr;
+    }
+
+    const int blockCount = manifest->blockCount();
+    auto found = std::make_shared<std::vector<char>>(blockCount, 0);
+    QFile seed(seedPath);
+    if (!seed.open(QIODevice::ReadOnly) || seed.size() <= 0) {
+        return found;
+    }
+    const qint64 seedSize = seed.size();
+    uchar* data = seed.map(0, seedSize);
+    if (data == nullptr) {
+        return found;
+    }
+
+    // 弱校验按值排序后二分查找；位图先过滤掉绝大多数不可能命中的位置，逐字节滑动时只做一次位测试
+    const qint64 blockSize = manifest->blockSize;
+    const quint32 mask = manifest->rsumMask();
+    std::vector<std::pair<quint32, int>> blocks;
+    blocks.reserve(blockCount);
+    for (int i = 0; i < blockCount; ++i) {
+        blocks.emplace_back(manifest->rsums[i], i);
+    }
+    std::sort(blocks.begin(), blocks.end());
+
+    int bitHashBits = 10;
+    while (bitHashBits < 26 && (qint64(1) << bitHashBits) < qint64(blockCount) * 16) {
+        ++bitHashBits;
+    }
+    const auto bitHashIndex = [bitHashBits](quint32 value) {
+        return (value * 0x9E3779B1u) >> (32 - bitHashBits);
+    };
+    std::vector<quint8> bitHash((1 << bitHashBits) / 8, 0);
+    for (const auto& block : blocks) {
+        const quint32 index = bitHashIndex(block.first);
+        bitHash[index >> 3] |= 1 << (index & 7);
+    }
+
+    const auto byteAt = [=](qint64 pos) -> quint32 {
+        return pos < seedSize ? data[pos] : 0;
+    };
+    const auto sumAt = [=](qint64 pos) {
+        RollingSum sum;
+        for (qint64 i = 0; i < blockSize; ++i) {
+            const quint32 c = byteAt(pos + i);
+            sum.a = static_cast<quint16>(sum.a + c);
+            sum.b = static_cast<quint16>(sum.b + (blockSize - i) * c);
+        }
+        return sum;
+    };
+    const auto windowAt = [=](qint64 pos) {
+        QByteArray window(static_cast<int>(blockSize), 0);
+        if (pos < seedSize) {
+            memcpy(window.data(), data + pos, static_cast<size_t>(qMin(blockSize, seedSize - pos)));
+        }
+        return window;
+    };
+    const auto strongSum = [&](const QByteArray& window) {
+        return QCryptographicHash::hash(window, QCryptographicHash::Md4).left(manifest->checksumBytes);
+    };
+
+    // 位置pos处的窗口与弱校验为weak的块逐个比较强校验，命中的块写入part文件
+    bool writeError = false;
+    const auto matchAt = [&](qint64 pos, quint32 weak) {
+        auto range = std::equal_range(blocks.begin(), blocks.end(), std::make_pair(weak, 0), [](const auto& left, const auto& right) {
+            return left.first < right.first;
+        });
+        if (range.first == range.second) {
+            return false;
+        }
+
+        const QByteArray window = windowAt(pos);
+        const QByteArray strong = strongSum(window);
+        QByteArray nextStrong;
+        bool matched = false;
+        for (auto it = range.first; it != range.second; ++it) {
+            const int index = it->second;
+            if (manifest->checksums[index] != strong) {
+                continue;
+            }
+            if (manifest->seqMatches > 1 && index + 1 < blockCount) {
+                if ((sumAt(pos + blockSize).value() & mask) != manifest->rsums[index + 1]) {
+                    continue;
+                }
+                if (nextStrong.isEmpty()) {
+                    nextStrong = strongSum(windowAt(pos + blockSize));
+                }
+                if (manifest->checksums[index + 1] != nextStrong) {
+                    continue;
+                }
+            }
+
+            matched = true;
+            if ((*found)[index]) {
+                continue;
+            }
+            const qint64 offset = index * blockSize;
+            const qint64 length = qMin(blockSize, manifest->length - offset);
+            if (!part.seek(offset) || part.write(window.constData(), length) != length) {
+                writeError = true;
+                return false;
+            }
+            (*found)[index] = 1;
+        }
+        return matched;
+    };
+
+    qint64 pos = 0;
+    RollingSum sum = sumAt(pos);
+    while (pos < seedSize && !writeError) {
+        const quint32 weak = sum.value() & mask;
+        const quint32 index = bitHashIndex(weak);
+        if ((bitHash[index >> 3] & (1 << (index & 7))) && matchAt(pos, weak)) {
+            pos += blockSize; // 命中后跳过整块，重新计算下一个窗口
+            sum = sumAt(pos);
+            continue;
+        }
+
+        // 窗口后移一个字节：a减去移出的字节加上移入的字节，b减去移出字节的blockSize倍再加上新的a
+        const quint32 out = data[pos];
+        const quint32 in = byteAt(pos + blockSize);
+        sum.a = static_cast<quint16>(sum.a + in - out);
+        sum.b = static_cast<quint16>(sum.b + sum.a - blockSize * out);
+        ++pos;
+    }
+
+    seed.unmap(data);
+    if (writeError) {
+        return nullptr;
+    }
+    return found;
+}
+
+void DeltaDownloadTask::onSeedMatched(const std::shared_ptr<std::vector<char>>& found)
+{
+    if (m_aborted) {
+        QFile::remove(getPartPath());
+        notifyCanceled();
+        return;
+    }
+    if (found == nullptr) {
+        QFile::remove(getPartPath());
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveWriteError;
+        notifyDeltaResult();
+        return;
+    }
+
+    // 缺少的相邻块合并为一个区间
+    const qint64 blockSize = m_manifest->blockSize;
+    const qint64 length = m_manifest->length;
+    m_ranges.clear();
+    m_rangeIndex = 0;
+    m_reusedBytes = 0;
+    m_fetchedBytes = 0;
+    for (int i = 0; i < m_manifest->blockCount(); ++i) {
+        const qint64 begin = i * blockSize;
+        const qint64 end = qMin(begin + blockSize, length) - 1;
+        if ((*found)[i]) {
+            m_reusedBytes += end + 1 - begin;
+        } else if (!m_ranges.empty() && m_ranges.back().second + 1 == begin) {
+            m_ranges.back().second = end;
+        } else {
+            m_ranges.emplace_back(begin, end);
+        }
+    }
+    if (m_reusedBytes == 0) {
+        startFallback(QStringLiteral("no reusable block in %1").arg(m_seedPath));
+        return;
+    }
+    qInfo() << QStringLiteral("DeltaDownloadTask url: %1, reuse %2 of %3 bytes from %4, %5 ranges to download").arg(m_url).arg(m_reusedBytes).arg(length).arg(m_seedPath).arg(static_cast<qint64>(m_ranges.size()));
+
+    auto file = std::make_unique<QFile>(getPartPath());
+    if (!file->open(QIODevice::ReadWrite)) { // 结束时从文件补算SHA-1，需要可读
+        QFile::remove(getPartPath());
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SavePathOpenError;
+        notifyDeltaResult();
+        return;
+    }
+    m_writer = std::make_shared<FileWriter>(std::move(file));
+    QPointer<DeltaDownloadTask> self(this);
+    m_writer->setReadyCallback([self]() { // 在写线程中调用，转回任务所在线程继续读取
+        if (self) {
+            QMetaObject::invokeMethod(
+                self.data(), [self]() {
+                    if (self) {
+                        self->onRangeReading();
+                    }
+                },
+                Qt::QueuedConnection);
+        }
+    });
+    m_checksum = std::make_shared<Checksum>(Checksum::Algorithm::Sha1);
+    m_writer->setChecksum(m_checksum);
+
+    m_progress.reset(m_reusedBytes);
+    m_progress.update(m_reusedBytes, length);
+    if (m_ranges.empty()) {
+        closeFile();
+        return;
+    }
+    startRangeRequest();
+}
+
+void DeltaDownloadTask::startRangeRequest()
+{
+    const size_t end = qMin(m_rangeIndex + s_maxRangesPerRequest, m_ranges.size());
+    QByteArray ranges;
+    m_requestBytes = 0;
+    for (size_t i = m_rangeIndex; i < end; ++i) {
+        if (!ranges.isEmpty()) {
+            ranges += ',';
+        }
+        ranges += QByteArray::number(m_ranges[i].first) + '-' + QByteArray::number(m_ranges[i].second);
+        m_requestBytes += m_ranges[i].second + 1 - m_ranges[i].first;
+    }
+    m_rangeIndex = end;
+
+    m_receivedBytes = 0;
+    m_boundary.clear();
+    m_inPartHeader = false;
+    m_partBegin = -1;
+    m_partEnd = -1;
+    m_partOffset = 0;
+    m_partRemaining = 0;
+    m_fullContent = false;
+    m_protocolError = false;
+
+    QNetworkRequest request(m_request);
+    request.setRawHeader("Range", "bytes=" + ranges);
+    request.setRawHeader("Accept-Encoding", "identity"); // 压缩后的数据无法按偏移写入
+    m_networkReply = getNetworkAccessManager()->get(request);
+    m_networkReply->setReadBufferSize(s_readBufferSize);
+    connect(m_networkReply, &QNetworkReply::metaDataChanged, this, &DeltaDownloadTask::onRangeMetaDataChanged);
+    connect(m_networkReply, &QNetworkReply::readyRead, this, &DeltaDownloadTask::onRangeReading);
+    connect(m_networkReply, &QNetworkReply::finished, this, &DeltaDownloadTask::onRangeFinished);
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &DeltaDownloadTask::onCopeSslErrors);
+}
+
+// 206时为单个区间(Content-Range)或multipart/byteranges，200时服务端忽略了Range，整个文件从头写入
+void DeltaDownloadTask::onRangeMetaDataChanged()
+{
+    auto reply = m_networkReply;
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (httpCode == 200) {
+        m_fullContent = true;
+        m_partOffset = 0;
+        m_partRemaining = m_manifest->length;
+        return;
+    }
+    if (httpCode != 206) {
+        return;
+    }
+
+    const QByteArray contentType = reply->header(QNetworkRequest::ContentTypeHeader).toByteArray();
+    if (contentType.trimmed().toLower().startsWith("multipart/byteranges")) {
+        const int index = contentType.toLower().indexOf("boundary=");
+        m_boundary = index < 0 ? QByteArray() : contentType.mid(index + 9).split(';').first().trimmed();
+        if (m_boundary.size() >= 2 && m_boundary.startsWith('"') && m_boundary.endsWith('"')) {
+            m_boundary = m_boundary.mid(1, m_boundary.size() - 2);
+        }
+        if (m_boundary.isEmpty()) {
+            m_protocolError = true;
+            reply->abort();
+        }
+        return;
+    }
+
+    qint64 begin = 0;
+    qint64 end = 0;
+    qint64 total = 0;
+    if (!parseContentRange(reply->rawHeader("Content-Range"), &begin, &end, &total) || end >= m_manifest->length || (total > 0 && total != m_manifest->length)) {
+        qInfo() << QStringLiteral("DeltaDownloadTask url: %1, unexpected Content-Range: %2").arg(m_url).arg(QString(reply->rawHeader("Content-Range")));
+        m_protocolError = true;
+        reply->abort();
+        return;
+    }
+    m_partOffset = begin;
+    m_partRemaining = end + 1 - begin;
+}
+
+void DeltaDownloadTask::onRangeReading()
+{
+    auto reply = m_networkReply;
+    if (reply == nullptr || m_writer == nullptr) {
+        return;
+    }
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (httpCode != 200 && httpCode != 206) {
+        return;
+    }
+    if (!readRanges(reply, false)) {
+        m_protocolError = true;
+        reply->abort();
+    }
+}
+
+// 把reply中的数据按分块的偏移写入，写入积压时(force为false)暂停读取；格式错误时返回false
+bool DeltaDownloadTask::readRanges(QNetworkReply* reply, bool force)
+{
+    while (reply->bytesAvailable() > 0) {
+        if (!force && m_writer->isFull()) {
+            return true;
+        }
+        if (m_partRemaining > 0) {
+            const auto& bytes = reply->read(qMin(m_partRemaining, s_readBlockSize));
+            m_writer->write(m_partOffset, bytes);
+            m_partOffset += bytes.size();
+            m_partRemaining -= bytes.size();
+            m_receivedBytes += bytes.size();
+            m_fetchedBytes += bytes.size();
+            m_progress.update(qMin(m_reusedBytes + m_fetchedBytes, m_manifest->length), m_manifest->length);
+            continue;
+        }
+        if (m_boundary.isEmpty()) { // 单个区间之外多余的数据丢弃
+            reply->readAll();
+            return true;
+        }
+        if (!reply->canReadLine()) {
+            return reply->bytesAvailable() < s_maxPartHeaderSize;
+        }
+        if (!readPartHeader(reply->readLine())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 逐行解析multipart/byteranges中分隔符与分块头，空行之后为Content-Range指定区间的数据
+bool DeltaDownloadTask::readPartHeader(const QByteArray& line)
+{
+    const QByteArray& value = line.trimmed();
+    if (!m_inPartHeader) {
+        if (value == "--" + m_boundary) {
+            m_inPartHeader = true;
+            m_partBegin = -1;
+            m_partEnd = -1;
+        }
+        return true; // 前言、分块后的换行及结束分隔符忽略
+    }
+    if (value.isEmpty()) {
+        if (m_partBegin < 0) {
+            return false;
+        }
+        m_inPartHeader = false;
+        m_partOffset = m_partBegin;
+        m_partRemaining = m_partEnd + 1 - m_partBegin;
+        return true;
+    }
+
+    const int colon = value.indexOf(':');
+    if (colon > 0 && value.left(colon).trimmed().toLower() == "content-range") {
+        qint64 total = 0;
+        if (!parseContentRange(value.mid(colon + 1).trimmed(), &m_partBegin, &m_partEnd, &total) || m_partEnd >= m_manifest->length
+            || (total > 0 && total != m_manifest->length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DeltaDownloadTask::onRangeFinished()
+{
+    auto reply = m_networkReply;
+    if (m_aborted) {
+        onRequestFinished();
+        return;
+    }
+
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (!m_protocolError && reply->error() == QNetworkReply::NoError && (httpCode == 200 || httpCode == 206)) {
+        m_protocolError = !readRanges(reply, true) || (httpCode == 206 && m_receivedBytes < m_requestBytes);
+    }
+
+    // 服务端不支持多区间、内容与清单不符等无法靠重试解决，直接完整下载；网络错误、5xx、重定向走通用流程
+    const bool serverRejected = httpCode >= 400 && httpCode < 500;
+    const bool unexpectedSuccess = httpCode >= 200 && httpCode < 300 && httpCode != 200 && httpCode != 206;
+    if (m_protocolError || serverRejected || unexpectedSuccess) {
+        reply->deleteLater();
+        m_networkReply = nullptr;
+        startFallback(QStringLiteral("range request failed, httpCode: %1").arg(httpCode));
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError || (httpCode != 200 && httpCode != 206)) {
+        onRequestFinished();
+        return;
+    }
+
+    m_result->m_httpCode = httpCode;
+    m_result->m_qtNetworkError = QNetworkReply::NoError;
+    m_result->m_statusCode = Result::RequestStatus::Success;
+    reply->deleteLater();
+    m_networkReply = nullptr;
+    if (m_fullContent || m_rangeIndex >= m_ranges.size()) {
+        closeFile();
+        return;
+    }
+    startRangeRequest();
+}
+
+// 在写线程中校验整个文件的SHA-1，一致时把part文件原子替换为savePath
+void DeltaDownloadTask::closeFile()
+{
+    const auto checksum = m_checksum;
+    const QByteArray expected = m_manifest->sha1;
+    const QString partPath = getPartPath();
+    const QString savePath = m_savePath;
+    m_writer->setReadyCallback(nullptr);
+    auto future = m_writer->close(FileWriter::FlushPolicy::Flush, [=]() {
+        if (checksum->result() != expected) {
+            return false;
+        }
+        return FileWriter::replace(partPath, savePath);
+    });
+    future.then(this, [this](bool success) {
+        onFileClosed(success);
+    });
+}
+
+void DeltaDownloadTask::onFileClosed(bool success)
+{
+    const auto writer = std::move(m_writer);
+    if (success) {
+        qInfo() << QStringLiteral("DeltaDownloadTask url: %1, reused %2 bytes, downloaded %3 bytes").arg(m_url).arg(m_reusedBytes).arg(m_fetchedBytes);
+        m_progress.finish(m_manifest->length, m_manifest->length);
+        notifyDeltaResult();
+        return;
+    }
+
+    if (writer->hasError()) {
+        QFile::remove(getPartPath());
+        m_result->m_saveStatus = writer->error() == FileWriter::Error::NoSpaceError ? DownloadResult::SaveStatus::SaveNoSpaceError : DownloadResult::SaveStatus::SaveWriteError;
+        notifyDeltaResult();
+    } else if (m_aborted) {
+        QFile::remove(getPartPath());
+        notifyCanceled();
+    } else if (m_checksum->result() != m_manifest->sha1) {
+        startFallback(QStringLiteral("checksum mismatch"));
+    } else { // 替换失败，savePath可能被占用
+        QFile::remove(getPartPath());
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveError;
+        notifyDeltaResult();
+    }
+}
+
+// 关闭写入器并删除part文件，在写线程中完成，不等待，之后的步骤通过whenFileReleased排在其后
+void DeltaDownloadTask::releaseFile()
+{
+    const QString partPath = getPartPath();
+    if (m_writer == nullptr) {
+        if (m_releasingFiles == 0) {
+            QFile::remove(partPath);
+        }
+        return;
+    }
+
+    const auto writer = std::move(m_writer);
+    writer->setReadyCallback(nullptr);
+    writer->setChecksum(nullptr);
+    writer->close(FileWriter::FlushPolicy::None, [partPath]() {
+        QFile::remove(partPath);
+        return true;
+    });
+    m_releasingFiles++;
+    QPointer<DeltaDownloadTask> self(this);
+    writer->setClosedCallback([self]() {
+        if (self) {
+            QMetaObject::invokeMethod(
+                self.data(), [self]() {
+                    if (self && --self->m_releasingFiles == 0 && self->m_afterRelease) {
+                        const auto next = std::move(self->m_afterRelease);
+                        self->m_afterRelease = nullptr;
+                        next();
+                    }
+                },
+                Qt::QueuedConnection);
+        }
+    });
+}
+
+// 没有正在关闭的写入器时立即执行
+void DeltaDownloadTask::whenFileReleased(std::function<void()> next)
+{
+    if (m_releasingFiles == 0) {
+        next();
+        return;
+    }
+    m_afterRelease = std::move(next);
+}
+
+// 回退为完整下载：以断点续传方式下载到 savePath.part，完成后原子重命名，结果与进度转发给调用者
+void DeltaDownloadTask::startFallback(const QString& reason)
+{
+    qInfo() << QStringLiteral("DeltaDownloadTask url: %1, %2, fallback to full download").arg(m_url).arg(reason);
+    releaseFile();
+
+    m_fallback = std::make_shared<DownloadTask>(m_url, m_savePath);
+    m_fallback->setCalcSpeed(m_calcSpeed).setProgressInterval(m_progress.interval()).setResumeEnable(true).setRerequestCount(m_rerequestCount);
+    connect(m_fallback.get(), &DownloadTask::sigDownloadProcess, this, &DeltaDownloadTask::sigDownloadProcess);
+    connect(m_fallback.get(), &DownloadTask::sigDownloadSpeed, this, &DeltaDownloadTask::sigDownloadSpeed);
+    connect(m_fallback.get(), &DownloadTask::sigDownloadRate, this, &DeltaDownloadTask::sigDownloadRate);
+    m_fallback->run(this, [this](ResultPtr result) {
+        result->m_taskId = m_taskId;
+        notifyResult(result);
+    });
+}
+
+void DeltaDownloadTask::notifyProgress(const ProgressThrottle::Progress& progress)
+{
+    if (m_calcSpeed) {
+        emit sigDownloadSpeed(progress.deltaBytes, progress.deltaMs);
+        emit sigDownloadRate(progress.bytesPerSecond, progress.remainingMs);
+    }
+
+    emit sigDownloadProcess(progress.bytes, progress.bytesTotal);
+}
+
+void DeltaDownloadTask::notifyCanceled()
+{
+    m_result->m_httpCode = -1;
+    m_result->m_qtNetworkError = QNetworkReply::OperationCanceledError;
+    m_result->m_qtErrorString = QStringLiteral("Operation canceled");
+    m_result->m_statusCode = Result::RequestStatus::NetworkError;
+    notifyDeltaResult();
+}
+
+void DeltaDownloadTask::notifyDeltaResult()
+{
+    m_result->m_taskId = m_taskId;
+    qInfo() << QStringLiteral("Task finished, async request elapsedTime: %1ms, url: %2").arg(m_elapsedTimer.elapsed()).arg(m_url);
+    m_elapsedTimer.restart();
+    printResultLog(m_result);
+    notifyResult(m_result);
+}
+
+QString DeltaDownloadTask::getPartPath()
+{
+    return m_savePath + ".delta.part";
+}
@@ -0,0 +1,96 @@
+﻿#ifndef NETWORK_DELTA_DOWNLOAD_TASK_H
+#define NETWORK_DELTA_DOWNLOAD_TASK_H
+#include "downloadtask.h"
+#include <memory>
+#include <vector>
+
+namespace Net {
+/*** 增量下载：按zsync清单复用本地旧版本中未变化的块，只用Range请求下载变化的部分 ***/
+// 1. 先下载清单(默认 url.zsync，zsyncmake生成)，其中有块大小、文件长度、整个文件的SHA-1及每块的弱校验(rsum)与强校验(MD4)。
+// 2. 在线程池中映射旧文件，按滚动校验逐字节滑动查找与清单中的块相同的内容，找到的块写入 savePath.delta.part。
+// 3. 缺少的块合并为区间，每个请求最多带32个区间(multipart/byteranges)，顺序下载并按偏移写入。
+// 4. 整个文件的SHA-1一致后原子替换savePath，替换前旧文件保持可用。
+// 清单不可用、旧文件中没有可复用的块、服务端不支持Range或校验不一致时，回退为完整下载(断点续传方式)。
+class NETWORK_EXPORT DeltaDownloadTask : public GetTask {
+    Q_OBJECT
+public:
+    DeltaDownloadTask(const QString& url, const QString& savePath);
+    ~DeltaDownloadTask();
+    DeltaDownloadTask& setManifestUrl(const QString& url); // 默认 url.zsync
+    DeltaDownloadTask& setSeedPath(const QString& path); // 本地旧版本，默认savePath
+    DeltaDownloadTask& setCalcSpeed(bool calcSpeed);
+    DeltaDownloadTask& setProgressInterval(int ms);
+    void abort() override;
+
+public:
+signals:
+    void sigDownloadProcess(qint64 bytesReceived, qint64 bytesTotal); // 复用的块计入已接收
+    void sigDownloadSpeed(qint64 bytesReceived, qint64 ms);
+    void sigDownloadRate(qint64 bytesPerSecond, qint64 remainingMs);
+
+protected:
+    QNetworkReply* execute() override;
+    ResultPtr createResult() override;
+    void getBytesFromReply(const ResultPtr& result, QNetworkReply* reply) override;
+
+protected slots:
+    void onManifestFinished();
+    void onRangeMetaDataChanged();
+    void onRangeReading();
+    void onRangeFinished();
+
+private:
+    struct Manifest;
+
+    static std::shared_ptr<const Manifest> parseManifest(const QByteArray& bytes);
+    static std::shared_ptr<std::vector<char>> matchSeed(const std::shared_ptr<const Manifest>& manifest, const QString& seedPath, const QString& partPath);
+    void onSeedMatched(const std::shared_ptr<std::vector<char>>& found);
+    void startRangeRequest();
+    bool readRanges(QNetworkReply* reply, bool force);
+    bool readPartHeader(const QByteArray& line);
+    void closeFile();
+    void onFileClosed(bool success);
+    void releaseFile();
+    void whenFileReleased(std::function<void()> next);
+    void requestManifest();
+    void startFallback(const QString& reason);
+    void notifyProgress(const ProgressThrottle::Progress& progress);
+    void notifyCanceled();
+    void notifyDeltaResult();
+    QString getPartPath();
+
+private:
+    std::shared_ptr<DownloadResult> m_result;
+    QString m_savePath;
+    QString m_manifestUrl;
+    QString m_seedPath;
+    bool m_calcSpeed = false;
+    bool m_aborted = false;
+    std::shared_ptr<const Manifest> m_manifest;
+    std::shared_ptr<FileWriter> m_writer;
+    int m_releasingFiles = 0; // 正在关闭的写入器
+    std::function<void()> m_afterRelease;
+    std::shared_ptr<Checksum> m_checksum;
+    std::shared_ptr<DownloadTask> m_fallback;
+
+    std::vector<std::pair<qint64, qint64>> m_ranges; // 需要下载的区间 [begin, end]
+    size_t m_rangeIndex = 0; // 下一个请求的第一个区间
+    qint64 m_reusedBytes = 0; // 从旧文件复用的字节数
+    qint64 m_fetchedBytes = 0;
+
+    // 当前Range请求的解析状态
+    qint64 m_requestBytes = 0; // 本次请求的区间总长
+    qint64 m_receivedBytes = 0; // 本次请求已写入的字节数
+    QByteArray m_boundary; // multipart/byteranges的分隔符，单个区间时为空
+    bool m_inPartHeader = false;
+    qint64 m_partBegin = -1; // 正在解析的分块头中的Content-Range
+    qint64 m_partEnd = -1;
+    qint64 m_partOffset = 0; // 当前分块下一个待写入的位置
+    qint64 m_partRemaining = 0;
+    bool m_fullContent = false; // 服务端忽略Range返回了完整内容
+    bool m_protocolError = false;
+
+    ProgressThrottle m_progress;
+};
+}
+#endif // NETWORK_DELTA_DOWNLOAD_TASK_H
@@ -0,0 +1,379 @@
+﻿#include "downloadmanager.h"
+#include "util.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+using namespace Net;
+static const int s_speedInterval = 1000; // 每秒统计一次速度
+
+DownloadManager& DownloadManager::instance()
+{
+    static DownloadManager myInstance;
+    return myInstance;
+}
+
+DownloadManager::DownloadManager()
+{
+    connect(&m_speedTimer, &QTimer::timeout, this, &DownloadManager::onSpeedTimeout);
+}
+
+DownloadManager::~DownloadManager()
+{
+}
+
+void DownloadManager::setJournalPath(const QString& path)
+{
+    m_journalPath = path;
+    loadJournal();
+    schedule();
+}
+
+// 减小时不打断进行中的下载，只是不再启动新的
+void DownloadManager::setMaxParallel(int count)
+{
+    m_maxParallel = qMax(1, count);
+    schedule();
+}
+
+void DownloadManager::setTaskConfigurator(std::function<void(DownloadTask&)> configurator)
+{
+    m_configurator = std::move(configurator);
+}
+
+qint64 DownloadManager::addDownload(const QString& url, const QString& savePath, int priority)
+{
+    if (findItemBySavePath(savePath) != nullptr) {
+        qInfo() << QStringLiteral("DownloadManager savePath is already queued: %1").arg(savePath);
+        return 0;
+    }
+
+    Item item;
+    item.id = m_nextId++;
+    item.url = url;
+    item.savePath = savePath;
+    item.priority = priority;
+    m_items.append(item);
+    emit sigStateChanged(item.id, item.state);
+
+    saveJournal();
+    schedule();
+    return item.id;
+}
+
+void DownloadManager::pause(qint64 id)
+{
+    auto item = findItem(id);
+    if (item == nullptr || (item->state != State::Waiting && item->state != State::Running)) {
+        return;
+    }
+
+    setState(*item, State::Paused);
+    stopTask(id);
+    saveJournal();
+    schedule();
+}
+
+void DownloadManager::resume(qint64 id)
+{
+    auto item = findItem(id);
+    if (item == nullptr || (item->state != State::Paused && item->state != State::Failed)) {
+        return;
+    }
+
+    item->errorMsg.clear();
+    setState(*item, State::Waiting);
+    saveJournal();
+    schedule();
+}
+
+// 先移出队列再停止，任务结束回调找不到该项就不会标记为失败
+void DownloadManager::remove(qint64 id)
+{
+    for (int i = 0; i < m_items.size(); ++i) {
+        if (m_items[i].id == id) {
+            m_items.removeAt(i);
+            break;
+        }
+    }
+    stopTask(id);
+
+    saveJournal();
+    notifyProgress();
+    schedule();
+}
+
+void DownloadManager::setPriority(qint64 id, int priority)
+{
+    auto item = findItem(id);
+    if (item == nullptr) {
+        return;
+    }
+
+    item->priority = priority;
+    saveJournal();
+    schedule();
+}
+
+void DownloadManager::pauseAll()
+{
+    for (const auto& item : items()) {
+        pause(item.id);
+    }
+}
+
+void DownloadManager::resumeAll()
+{
+    for (const auto& item : items()) {
+        resume(item.id);
+    }
+}
+
+QList<DownloadManager::Item> DownloadManager::items() const
+{
+    return m_items;
+}
+
+DownloadManager::Item DownloadManager::item(qint64 id) const
+{
+    for (const auto& item : m_items) {
+        if (item.id == id) {
+            return item;
+        }
+    }
+    return Item();
+}
+
+DownloadManager::Item* DownloadManager::findItem(qint64 id)
+{
+    for (auto& item : m_items) {
+        if (item.id == id) {
+            return &item;
+        }
+    }
+    return nullptr;
+}
+
+// 已完成的项不再写文件，同一路径可以重新下载
+DownloadManager::Item* DownloadManager::findItemBySavePath(const QString& savePath)
+{
+    const QString& path = QFileInfo(savePath).absoluteFilePath();
+    for (auto& item : m_items) {
+        if (item.state != State::Finished && QFileInfo(item.savePath).absoluteFilePath() == path) {
+            return &item;
+        }
+    }
+    return nullptr;
+}
+
+void DownloadManager::setState(Item& item, State state)
+{
+    item.state = state;
+    emit sigStateChanged(item.id, state);
+}
+
+// 按优先级启动等待中的项，直到达到同时下载数。暂停后任务尚未结束的项要等任务结束才能再启动
+void DownloadManager::schedule()
+{
+    if (m_scheduling) { // 任务同步结束时会回调到这里，留到本次结束后
+        m_reschedule = true;
+        return;
+    }
+
+    m_scheduling = true;
+    int running = 0;
+    for (const auto& item : m_items) {
+        if (item.state == State::Running) {
+            ++running;
+        }
+    }
+
+    while (running < m_maxParallel) {
+        Item* next = nullptr;
+        for (auto& item : m_items) {
+            if (item.state == State::Waiting && !m_tasks.contains(item.id) && (next == nullptr || item.priority > next->priority)) {
+                next = &item;
+            }
+        }
+        if (next == nullptr) {
+            break;
+        }
+        startItem(*next);
+        ++running;
+    }
+    m_scheduling = false;
+    if (m_reschedule) {
+        m_reschedule = false;
+        schedule();
+        return;
+    }
+
+    if (running > 0 && !m_speedTimer.isActive()) {
+        m_speedBytes = 0;
+        m_speedElapsed.start();
+        m_speedTimer.start(s_speedInterval);
+    } else if (running == 0 && m_speedTimer.isActive()) {
+        m_speedTimer.stop();
+        emit sigSpeed(0);
+    }
+}
+
+void DownloadManager::startItem(Item& item)
+{
+    const qint64 id = item.id;
+    auto task = Util::instance().getDownloadTask(item.url, item.savePath);
+    task->setResumeEnable(true);
+    if (m_configurator) {
+        m_configurator(*task);
+    }
+
+    connect(task.get(), &DownloadTask::sigDownloadProcess, this, [this, id](qint64 bytesReceived, qint64 bytesTotal) {
+        auto item = findItem(id);
+        if (item == nullptr || item->state != State::Running) {
+            return;
+        }
+
+        const qint64 lastReceived = m_lastReceived.value(id, -1);
+        if (lastReceived >= 0) {
+            m_speedBytes += qMax<qint64>(bytesReceived - lastReceived, 0);
+        }
+        m_lastReceived[id] = bytesReceived;
+        item->bytesReceived = bytesReceived;
+        if (bytesTotal > 0) {
+            item->bytesTotal = bytesTotal;
+        }
+        emit sigItemProgress(id, item->bytesReceived, item->bytesTotal);
+        notifyProgress();
+    });
+
+    m_tasks.insert(id, task);
+    m_lastReceived.insert(id, -1);
+    setState(item, State::Running);
+    saveJournal();
+
+    auto rawTask = task.get();
+    task->run(this, [this, id, rawTask](ResultPtr result) {
+        onTaskFinished(id, rawTask, result);
+    });
+}
+
+void DownloadManager::onTaskFinished(qint64 id, DownloadTask* task, const ResultPtr& result)
+{
+    const auto holder = m_tasks.value(id); // 回调仍在任务中执行，结束前不能释放
+    if (holder.get() == task) {
+        m_tasks.remove(id);
+        m_lastReceived.remove(id);
+    }
+
+    auto item = findItem(id);
+    if (item != nullptr && item->state == State::Running) { // 暂停或移除引起的结束不改变状态
+        if (result->isSuccess()) {
+            item->bytesReceived = qMax(item->bytesReceived, item->bytesTotal);
+            setState(*item, State::Finished);
+        } else {
+            item->errorMsg = result->errorMsg();
+            setState(*item, State::Failed);
+        }
+        emit sigItemFinished(id, result);
+        saveJournal();
+    }
+
+    notifyProgress();
+    schedule();
+}
+
+void DownloadManager::stopTask(qint64 id)
+{
+    auto task = m_tasks.value(id);
+    if (task) {
+        task->setRerequestCount(0); // abort后不要重试
+        task->abort();
+    }
+}
+
+void DownloadManager::notifyProgress()
+{
+    qint64 bytesReceived = 0;
+    qint64 bytesTotal = 0;
+    for (const auto& item : m_items) {
+        bytesReceived += item.bytesReceived;
+        bytesTotal += qMax(item.bytesTotal, item.bytesReceived);
+    }
+    emit sigProgress(bytesReceived, bytesTotal);
+}
+
+void DownloadManager::onSpeedTimeout()
+{
+    const qint64 elapsed = qMax<qint64>(m_speedElapsed.restart(), 1);
+    emit sigSpeed(m_speedBytes * 1000 / elapsed);
+    m_speedBytes = 0;
+}
+
+// 日志只记录未完成的项：{"items":[{"id":1,"url":"","savePath":"","priority":0,"state":0,"bytesReceived":0,"bytesTotal":0}]}
+void DownloadManager::loadJournal()
+{
+    QFile file(m_journalPath);
+    if (m_journalPath.isEmpty() || !file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    const auto& obj = QJsonDocument::fromJson(file.readAll()).object();
+    for (const auto& value : obj.value("items").toArray()) {
+        const auto& itemObj = value.toObject();
+        Item item;
+        item.id = static_cast<qint64>(itemObj.value("id").toDouble());
+        item.url = itemObj.value("url").toString();
+        item.savePath = itemObj.value("savePath").toString();
+        item.priority = itemObj.value("priority").toInt();
+        item.state = static_cast<State>(itemObj.value("state").toInt());
+        item.bytesReceived = static_cast<qint64>(itemObj.value("bytesReceived").toDouble());
+        item.bytesTotal = static_cast<qint64>(itemObj.value("bytesTotal").toDouble());
+        if (item.url.isEmpty() || item.savePath.isEmpty() || findItemBySavePath(item.savePath) != nullptr) { // 重复设置日志路径时已加载的项
+            continue;
+        }
+        if (item.state == State::Running) { // 上次退出时正在下载，重新排队后从断点继续
+            item.state = State::Waiting;
+        }
+        if (item.id <= 0 || findItem(item.id) != nullptr) {
+            item.id = m_nextId;
+        }
+        m_nextId = qMax(m_nextId, item.id + 1);
+        m_items.append(item);
+        emit sigStateChanged(item.id, item.state);
+    }
+    notifyProgress();
+}
+
+void DownloadManager::saveJournal()
+{
+    if (m_journalPath.isEmpty()) {
+        return;
+    }
+
+    QJsonArray array;
+    for (const auto& item : m_items) {
+        if (item.state == State::Finished) {
+            continue;
+        }
+        QJsonObject itemObj;
+        itemObj.insert("id", item.id);
+        itemObj.insert("url", item.url);
+        itemObj.insert("savePath", item.savePath);
+        itemObj.insert("priority", item.priority);
+        itemObj.insert("state", static_cast<int>(item.state));
+        itemObj.insert("bytesReceived", item.bytesReceived);
+        itemObj.insert("bytesTotal", item.bytesTotal);
+        array.append(itemObj);
+    }
+    QJsonObject obj;
+    obj.insert("items", array);
+
+    QDir().mkpath(QFileInfo(m_journalPath).absolutePath());
+    QSaveFile file(m_journalPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact)) < 0 || !file.commit()) {
+        qInfo() << QStringLiteral("DownloadManager save journal failed: %1").arg(m_journalPath);
+    }
+}
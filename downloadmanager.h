@@ -0,0 +1,105 @@
+﻿#ifndef NETWORK_DOWNLOAD_MANAGER_H
+#define NETWORK_DOWNLOAD_MANAGER_H
+
+#include "downloadtask.h"
+#include "network_global.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+#include <functional>
+#include <memory>
+
+namespace Net {
+/*** 下载队列：按优先级排队、限制同时下载数、单项暂停/继续，队列记录在日志文件中，重启后可恢复 ***/
+// 每项都以断点续传方式下载，暂停即abort并保留 savePath.part，继续时从断点下载。
+// 需在主线程使用，与DownloadTask、BandwidthManager同线程。
+class NETWORK_EXPORT DownloadManager : public QObject {
+    Q_OBJECT
+public:
+    enum class State {
+        Waiting = 0,
+        Running,
+        Paused,
+        Finished,
+        Failed
+    };
+    Q_ENUM(State)
+    struct Item {
+        qint64 id = 0;
+        QString url;
+        QString savePath;
+        int priority = 0; // 越大越先下载，相同时先加入的先下载
+        State state = State::Waiting;
+        qint64 bytesReceived = 0;
+        qint64 bytesTotal = 0;
+        QString errorMsg;
+    };
+
+    static DownloadManager& instance();
+
+    // 设置后立即加载上次未完成的项，之前处于下载中的项重新排队。savePath已在队列中的项不再重复加载
+    void setJournalPath(const QString& path);
+    void setMaxParallel(int count); // 同时下载数，默认3
+    // 启动每个任务前调用，可设置分段、限速权重、校验等
+    void setTaskConfigurator(std::function<void(DownloadTask&)> configurator);
+
+    // 返回项的id。savePath与队列中未完成的项相同时拒绝加入，返回0，避免两个任务写同一文件
+    qint64 addDownload(const QString& url, const QString& savePath, int priority = 0);
+    void pause(qint64 id);
+    void resume(qint64 id); // 暂停或失败的项重新排队
+    void remove(qint64 id); // 停止并移出队列，已下载的文件保留
+    void setPriority(qint64 id, int priority);
+    void pauseAll();
+    void resumeAll();
+
+    QList<Item> items() const;
+    Item item(qint64 id) const;
+
+signals:
+    void sigStateChanged(qint64 id, Net::DownloadManager::State state);
+    void sigItemProgress(qint64 id, qint64 bytesReceived, qint64 bytesTotal);
+    void sigItemFinished(qint64 id, Net::ResultPtr result);
+    void sigProgress(qint64 bytesReceived, qint64 bytesTotal); // 队列中所有项的合计
+    void sigSpeed(qint64 bytesPerSecond); // 下载中时每秒一次
+
+protected:
+    DownloadManager();
+    ~DownloadManager();
+
+    DownloadManager(DownloadManager const&) = delete;
+    DownloadManager(DownloadManager&&) = delete;
+    DownloadManager& operator=(DownloadManager const&) = delete;
+    DownloadManager& operator=(DownloadManager&&) = delete;
+
+private slots:
+    void onSpeedTimeout();
+
+private:
+    Item* findItem(qint64 id);
+    Item* findItemBySavePath(const QString& savePath);
+    void setState(Item& item, State state);
+    void schedule();
+    void startItem(Item& item);
+    void onTaskFinished(qint64 id, DownloadTask* task, const ResultPtr& result);
+    void stopTask(qint64 id);
+    void notifyProgress();
+    void loadJournal();
+    void saveJournal();
+
+private:
+    QList<Item> m_items;
+    QHash<qint64, std::shared_ptr<DownloadTask>> m_tasks; // 暂停后任务结束回调到达前仍保留，避免同一文件被两个任务同时写
+    std::function<void(DownloadTask&)> m_configurator;
+    QString m_journalPath;
+    int m_maxParallel = 3;
+    qint64 m_nextId = 1;
+    bool m_scheduling = false;
+    bool m_reschedule = false;
+    QTimer m_speedTimer;
+    QElapsedTimer m_speedElapsed;
+    qint64 m_speedBytes = 0;
+    QHash<qint64, qint64> m_lastReceived; // 本次运行中上一次的进度，用于计算速度
+};
+}
+#endif // NETWORK_DOWNLOAD_MANAGER_H
@@ -0,0 +1,41 @@
+﻿#include "downloadsink.h"
+
+using namespace Net;
+
+DownloadSink::~DownloadSink()
+{
+}
+
+void DownloadSink::start(qint64 bytesTotal)
+{
+    Q_UNUSED(bytesTotal);
+}
+
+bool DownloadSink::isFull()
+{
+    return false;
+}
+
+bool DownloadSink::finish(bool success)
+{
+    Q_UNUSED(success);
+    return true;
+}
+
+void DownloadSink::notifyReady()
+{
+    std::function<void()> callback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        callback = m_readyCallback;
+    }
+    if (callback) {
+        callback();
+    }
+}
+
+void DownloadSink::setReadyCallback(std::function<void()> callback)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_readyCallback = callback;
+}
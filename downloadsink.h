@@ -0,0 +1,36 @@
+﻿#ifndef NETWORK_DOWNLOAD_SINK_H
+#define NETWORK_DOWNLOAD_SINK_H
+
+#include "network_global.h"
+#include <QIODevice>
+#include <functional>
+#include <mutex>
+
+namespace Net {
+/*** 下载数据的流式消费者：数据到达即交给sink，不落盘也不在内存中累积，例如边下载边解码、计算摘要或转发 ***/
+// 除notifyReady外的接口都在任务所在线程调用。write时sink直接从reply读到自己的缓冲区，没有中间拷贝，可以少读，剩余数据留在reply中。
+// isFull()为true时任务暂停读取，reply读缓冲写满后由TCP反压到服务端，内存占用以读缓冲为上限；
+// sink腾出空间后调用notifyReady，任务继续读取。只有2xx响应的内容交给sink
+class NETWORK_EXPORT DownloadSink {
+public:
+    virtual ~DownloadSink();
+    // 每次收到2xx响应头时调用，重试、换镜像时会再次调用，sink应丢弃之前收到的数据。bytesTotal未知时为-1
+    virtual void start(qint64 bytesTotal);
+    // 从device读取最多maxSize，返回读取的字节数；返回-1表示出错，任务以SaveWriteError结束
+    virtual qint64 write(QIODevice* device, qint64 maxSize) = 0;
+    // 请求结束时会忽略isFull写入剩余的数据
+    virtual bool isFull();
+    // 请求结束时调用，success为false表示请求失败、取消或将要重定向。返回false时任务以SaveWriteError结束
+    virtual bool finish(bool success);
+    void notifyReady(); // 可在任意线程调用
+
+private:
+    friend class DownloadTask;
+    void setReadyCallback(std::function<void()> callback);
+
+private:
+    std::mutex m_mutex;
+    std::function<void()> m_readyCallback;
+};
+}
+#endif // NETWORK_DOWNLOAD_SINK_H
@@ -1,9 +1,21 @@
 ﻿#include "downloadtask.h"
+#include "bandwidthmanager.h"
+#include "mirrorregistry.h"
 #include <QDir>
 #include <QFileInfo>
-#include <QThreadPool>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStorageInfo>
+#include <algorithm>
 
 using namespace Net;
+static const qint64 s_minSegmentSize = 1024 * 1024; // 每段最小1M，剩余不足2倍时不再切分
+static const int s_maxSegmentRestart = 3; // 分段连接提前断开(无错误)时的续传次数
+static const qint64 s_resumeSaveInterval = 1000; // 续传信息落盘间隔 单位: milliseconds
+static const qint64 s_readBufferSize = 2 * 1024 * 1024; // 写文件跟不上时reply最多缓存2M，之后由TCP反压
+static const qint64 s_minReadBufferSize = 16 * 1024;
+static const qint64 s_maxReserveSize = 1024 * 1024 * 1024; // 下载到内存时按Content-Length预留的上限1G，超过时按分块累积
+
 bool DownloadResult::isSuccess()
 {
     return networkSuccess() && m_saveStatus == SaveStatus::Success;
@@ -12,6 +24,15 @@ bool DownloadResult::isSuccess()
 QString DownloadResult::errorMsg(const QString& customErrorMsg)
 {
     Q_UNUSED(customErrorMsg);
+    if (m_saveStatus == SaveStatus::SaveNoSpaceError) {
+        return "no space left on device";
+    }
+    if (m_saveStatus == SaveStatus::SaveChecksumError) {
+        return "checksum mismatch";
+    }
+    if (m_saveStatus == SaveStatus::SaveExtractError) {
+        return "extract failed";
+    }
     if (m_saveStatus != SaveStatus::Success) {
         return "download failed";
     }
@@ -21,17 +42,37 @@ QString DownloadResult::errorMsg(const QString& customErrorMsg)
 
 DownloadTask::DownloadTask(const QString& url)
     : GetTask(url)
+    , m_progress(this, [this](const ProgressThrottle::Progress& progress) { notifyProgress(progress); })
 {
     m_timeout = 0;
     m_signEnable = false;
+    m_stallTimer.setSingleShot(true);
+    connect(&m_stallTimer, &QTimer::timeout, this, &DownloadTask::onStalled);
 }
 
 DownloadTask::DownloadTask(const QString& url, const QString& savePath)
     : GetTask(url)
     , m_savePath(savePath)
+    , m_progress(this, [this](const ProgressThrottle::Progress& progress) { notifyProgress(progress); })
 {
     m_timeout = 0;
     m_signEnable = false;
+    m_stallTimer.setSingleShot(true);
+    connect(&m_stallTimer, &QTimer::timeout, this, &DownloadTask::onStalled);
+}
+
+DownloadTask::~DownloadTask()
+{
+    removeBandwidthConsumer();
+    if (m_writer) {
+        m_writer->setReadyCallback(nullptr);
+    }
+    if (m_extractor) {
+        m_extractor->setReadyCallback(nullptr);
+    }
+    if (m_sink) {
+        m_sink->setReadyCallback(nullptr);
+    }
 }
 
 DownloadTask& DownloadTask::setCalcSpeed(bool calcSpeed)
@@ -40,12 +81,113 @@ DownloadTask& DownloadTask::setCalcSpeed(bool calcSpeed)
     return *this;
 }
 
+DownloadTask& DownloadTask::setProgressInterval(int ms)
+{
+    m_progress.setInterval(ms);
+    return *this;
+}
+
 DownloadTask& DownloadTask::setDownloadLimit(qint64 bytesPerSecond)
 {
     m_maxBandwidth = bytesPerSecond;
+    if (m_bandwidthId != 0) {
+        BandwidthManager::instance().setConsumerLimit(m_bandwidthId, bytesPerSecond);
+    }
+    return *this;
+}
+
+DownloadTask& DownloadTask::setBandwidthWeight(int weight)
+{
+    m_bandwidthWeight = qMax(1, weight);
+    if (m_bandwidthId != 0) {
+        BandwidthManager::instance().setConsumerWeight(m_bandwidthId, m_bandwidthWeight);
+    }
+    return *this;
+}
+
+DownloadTask& DownloadTask::setSegmentCount(int segmentCount)
+{
+    m_segmentCount = qMax(1, segmentCount);
+    return *this;
+}
+
+DownloadTask& DownloadTask::setResumeEnable(bool enable)
+{
+    m_resumeEnable = enable;
+    return *this;
+}
+
+DownloadTask& DownloadTask::setFlushPolicy(FileWriter::FlushPolicy policy)
+{
+    m_flushPolicy = policy;
     return *this;
 }
 
+DownloadTask& DownloadTask::setMemoryMapEnable(bool enable)
+{
+    m_memoryMapEnable = enable;
+    return *this;
+}
+
+DownloadTask& DownloadTask::setChecksum(Checksum::Algorithm algorithm, const QByteArray& expected)
+{
+    m_checksumEnable = true;
+    m_checksumAlgorithm = algorithm;
+    m_expectedChecksum = expected.isEmpty() ? QByteArray() : Checksum::fromString(algorithm, expected);
+    if (!expected.isEmpty() && m_expectedChecksum.isEmpty()) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, invalid checksum: %2").arg(m_url).arg(QString(expected));
+    }
+    return *this;
+}
+
+DownloadTask& DownloadTask::setExtractDir(const QString& dir, ArchiveExtractor::Format format)
+{
+    m_extractDir = dir;
+    m_extractFormat = format;
+    return *this;
+}
+
+DownloadTask& DownloadTask::setSink(std::shared_ptr<DownloadSink> sink)
+{
+    if (m_sink) {
+        m_sink->setReadyCallback(nullptr);
+    }
+    m_sink = sink;
+    return *this;
+}
+
+DownloadTask& DownloadTask::addMirror(const QString& url, int weight)
+{
+    if (m_mirrors.isEmpty()) {
+        m_mirrors.append(qMakePair(m_url, 1));
+    }
+    m_mirrors.append(qMakePair(url, qMax(1, weight)));
+    return *this;
+}
+
+DownloadTask& DownloadTask::setStallTimeout(int ms)
+{
+    m_stallTimeout = ms;
+    return *this;
+}
+
+void DownloadTask::abort()
+{
+    m_aborted = true; // 主动取消不计为镜像失败
+    // abort会同步触发finished，期间m_segments可能被清空，先拷贝一份
+    QList<QPointer<QNetworkReply>> replies;
+    for (const auto& segment : m_segments) {
+        replies.append(segment->reply);
+    }
+    for (const auto& reply : replies) {
+        if (reply && !reply->isFinished()) {
+            reply->abort();
+        }
+    }
+
+    GetTask::abort();
+}
+
 // DownloadTask &DownloadTask::setThreadPoolEnable(bool enable)
 //{
 //     m_threadPoolEnable = enable;
@@ -54,35 +196,140 @@ DownloadTask& DownloadTask::setDownloadLimit(qint64 bytesPerSecond)
 
 /*** download请求 ***/
 QNetworkReply* DownloadTask::execute()
+{
+    m_aborted = false;
+    releaseAndStart();
+    return nullptr;
+}
+
+// 重试时上一次的写入器、解压器关闭后才能重新打开同一文件或目录，关闭完成后再开始，不阻塞任务线程
+void DownloadTask::releaseAndStart()
+{
+    QPointer<DownloadTask> self(this);
+    const auto next = [self]() {
+        if (self) {
+            QMetaObject::invokeMethod(
+                self.data(), [self]() {
+                    if (self) {
+                        self->releaseAndStart();
+                    }
+                },
+                Qt::QueuedConnection);
+        }
+    };
+
+    if (m_writer) {
+        const auto writer = std::move(m_writer);
+        writer->setReadyCallback(nullptr);
+        writer->setChecksum(nullptr);
+        writer->close(FileWriter::FlushPolicy::None);
+        writer->setClosedCallback(next);
+        return;
+    }
+    if (m_extractor) { // 从头解压覆盖已写出的条目
+        const auto extractor = std::move(m_extractor);
+        extractor->setReadyCallback(nullptr);
+        extractor->close();
+        extractor->setClosedCallback(next);
+        return;
+    }
+    startDownload();
+}
+
+void DownloadTask::startDownload()
 {
     m_result.reset();
     createResult();
-    if (!m_savePath.isEmpty()) {
+    m_resumeOffset = 0;
+    m_closeFuture = Async::Future<bool>();
+    if (m_aborted) { // 等待上一次的写入器关闭期间已取消
+        m_result->m_qtNetworkError = QNetworkReply::OperationCanceledError;
+        m_result->m_qtErrorString = QStringLiteral("Operation canceled");
+        m_result->m_statusCode = Result::RequestStatus::NetworkError;
+        m_result->m_taskId = m_taskId;
+        printResultLog(m_result);
+        notifyResult(m_result);
+        return;
+    }
+    if (m_sink) {
+        openSink();
+    } else if (!m_extractDir.isEmpty()) {
+        if (false == openExtractor()) {
+            notifyResult(m_result);
+            return;
+        }
+    } else if (!m_savePath.isEmpty()) {
         if (false == openFile()) {
             notifyResult(m_result);
+            return;
         }
     }
 
-    auto networkReply = getNetworkAccessManager()->get(m_request);
+    m_progress.reset(0);
+    m_checksumValue = m_expectedChecksum;
+    m_chunks.clear();
+    m_chunksSize = 0;
+    selectMirror();
+    if (isSegmentEnable()) { // 先探测是否支持Range，再决定是否分段
+        startProbe();
+        return;
+    }
 
-    m_prevTime = QDateTime::currentMSecsSinceEpoch();
-    if (m_maxBandwidth > 0) { // 限速
-        m_receviedBytesSize = 0;
-        m_prevReceiveBytes = 0; // 重置限速计算初始变量
-        connect(networkReply, &QNetworkReply::metaDataChanged, this, [=] {
-            m_fileSize = networkReply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
-        });
+    startSingleRequest();
+}
 
-        networkReply->setReadBufferSize(m_maxBandwidth * 2);
-        if (m_calcProcessTimer == nullptr) {
-            m_calcProcessTimer = new QTimer(this);
-        }
-        connect(m_calcProcessTimer, &QTimer::timeout, this, &DownloadTask::onDownloadLimitProcess);
-        m_calcProcessTimer->start(100); // 定时器每100毫秒触发一次
+void DownloadTask::startProbe()
+{
+    m_mirrorStartTime = QDateTime::currentMSecsSinceEpoch();
+    m_networkReply = getNetworkAccessManager()->head(m_request);
+    connect(m_networkReply, &QNetworkReply::finished, this, &DownloadTask::onProbeFinished);
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &DownloadTask::onCopeSslErrors);
+}
+
+// 设置了镜像时，结束后先判断是否需要换镜像
+void DownloadTask::startSingleRequest()
+{
+    m_networkReply = startRequest();
+    if (m_mirrors.isEmpty()) {
+        connect(m_networkReply, &QNetworkReply::finished, this, &DownloadTask::onRequestFinished);
     } else {
-        connect(networkReply, &QNetworkReply::readyRead, this, &DownloadTask::onReading);
-        connect(networkReply, &QNetworkReply::downloadProgress, this, &DownloadTask::onDownloadProgress);
+        connect(m_networkReply, &QNetworkReply::finished, this, &DownloadTask::onMirrorFinished);
+    }
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &DownloadTask::onCopeSslErrors);
+}
+
+QNetworkReply* DownloadTask::startRequest()
+{
+    QNetworkRequest request(m_request);
+    if (m_resumeOffset > 0) { // 资源未变化时从断点继续，变化时服务端返回完整内容
+        request.setRawHeader("Range", QStringLiteral("bytes=%1-").arg(m_resumeOffset).toLatin1());
+        const QByteArray& validator = m_etag.isEmpty() ? m_lastModified : m_etag;
+        if (!validator.isEmpty() && m_validatorMirror == m_mirror) { // 换镜像时只发Range，由Content-Range中的总大小核对
+            request.setRawHeader("If-Range", validator);
+        }
+        request.setRawHeader("Accept-Encoding", "identity");
     }
+    auto networkReply = getNetworkAccessManager()->get(request);
+    connect(networkReply, &QNetworkReply::metaDataChanged, this, &DownloadTask::onMetaDataChanged);
+
+    m_progress.reset(m_resumeOffset);
+    m_mirrorStartTime = QDateTime::currentMSecsSinceEpoch();
+    m_mirrorFirstByteTime = 0;
+    m_mirrorBytes = 0;
+    m_mirrorAbortReason.clear();
+    if (!m_mirrors.isEmpty() && m_stallTimeout > 0) {
+        m_stallTimer.start(m_stallTimeout);
+    }
+    addBandwidthConsumer(networkReply);
+    updateReadBufferSize(networkReply);
+    connect(networkReply, &QNetworkReply::readyRead, this, &DownloadTask::onReading);
+    connect(networkReply, &QNetworkReply::downloadProgress, this, [=](qint64 bytesReceived, qint64 bytesTotal) {
+        m_mirrorBytes = bytesReceived;
+        if (m_stallTimer.isActive()) {
+            m_stallTimer.start();
+        }
+        onDownloadProgress(m_resumeOffset + bytesReceived, bytesTotal < 0 ? bytesTotal : m_resumeOffset + bytesTotal);
+    });
 
     return networkReply;
 }
@@ -97,39 +344,59 @@ ResultPtr DownloadTask::createResult()
 
 void DownloadTask::getBytesFromReply(const ResultPtr& result, QNetworkReply* reply)
 {
-    Q_UNUSED(result);
-    if (isSaveToFile()) {
-        readAndSaveToFile(m_networkReply, m_file.get());
-        m_file->close();
-        m_file.reset();
+    removeBandwidthConsumer();
+    if (isSinking()) {
+        readAndSink(reply, true);
+        finishSink(result);
+    } else if (!m_segments.empty()) { // 分段失败，开启续传时记录已下载区间，否则重试时重新下载
+        closeFile(result);
+        m_segments.clear();
+    } else if (isSaveToFile()) {
+        readAndSaveToFile(m_networkReply, true);
+        closeFile(result);
+    } else if (isExtracting()) {
+        readAndExtract(m_networkReply, true);
+        closeExtractor(result);
     } else {
-        m_result->m_byteArr.push_back(reply->readAll());
+        readToMemory(reply, reply->bytesAvailable());
+        flattenChunks();
     }
 }
 
 bool DownloadTask::openFile()
 {
-    if (m_file) {
-        m_file->close();
-        m_file.reset();
-    }
-
-    QFileInfo info(m_savePath);
-    if (info.exists()) {
-        QFile::remove(m_savePath);
+    const QString& filePath = getFilePath();
+    const bool resume = m_resumeEnable && loadResumeInfo();
+    QFileInfo info(filePath);
+    if (!resume && info.exists()) {
+        QFile::remove(filePath);
     }
     QString dirPath = info.dir().absolutePath();
     if (!QFileInfo::exists(dirPath)) {
         QDir().mkpath(dirPath);
     }
 
-    m_file = std::make_unique<QFile>(m_savePath);
-    if (m_file->open(QIODevice::WriteOnly)) {
-        if (!m_file->isWritable()) {
+    auto file = std::make_unique<QFile>(filePath);
+    if (file->open((resume || m_memoryMapEnable || m_checksumEnable) ? QIODevice::ReadWrite : QIODevice::WriteOnly)) { // 映射、补算摘要需要可读
+        if (!file->isWritable()) {
             m_result->m_saveStatus = DownloadResult::SaveStatus::SaveWriteError;
             return false;
         }
 
+        m_writer = std::make_shared<FileWriter>(std::move(file));
+        m_writer->setReadyCallback(createReadyCallback());
+        m_checksum.reset();
+        if (m_checksumEnable) {
+            m_checksum = std::make_shared<Checksum>(m_checksumAlgorithm);
+            m_writer->setChecksum(m_checksum);
+        }
+        if (resume) {
+            m_writer->seek(m_resumeOffset);
+            if (m_checksum) {
+                m_writer->hash(m_resumeOffset);
+            }
+            qInfo() << QStringLiteral("DownloadTask url: %1, resume from %2 bytes").arg(m_url).arg(m_resumeOffset);
+        }
         m_result->m_saveStatus = DownloadResult::SaveStatus::Success;
         return true;
     }
@@ -138,97 +405,1234 @@ bool DownloadTask::openFile()
     return false;
 }
 
-// 限速读取与进度
-void DownloadTask::onDownloadLimitProcess()
+void DownloadTask::notifyResult(const ResultPtr& result)
 {
-    if (m_networkReply == nullptr) {
+    if (m_closeFuture.valid()) { // 数据全部写入并按FlushPolicy落盘后再通知结果
+        auto future = std::move(m_closeFuture);
+        future.then(this, [=](bool success) {
+            if (!success && m_result->m_saveStatus == DownloadResult::SaveStatus::Success && m_extractor) {
+                if (m_extractor->hasError()) {
+                    setExtractorError();
+                } else if (m_checksum) {
+                    qInfo() << QStringLiteral("DownloadTask url: %1, archive checksum mismatch, expected: %2, actual: %3").arg(m_url).arg(QString(m_checksumValue.toHex())).arg(QString(m_checksum->result().toHex()));
+                    m_result->m_saveStatus = DownloadResult::SaveStatus::SaveChecksumError;
+                } else {
+                    m_result->m_saveStatus = DownloadResult::SaveStatus::SaveError;
+                }
+            } else if (!success && m_result->m_saveStatus == DownloadResult::SaveStatus::Success) {
+                if (m_writer && m_writer->error() == FileWriter::Error::NoSpaceError) {
+                    m_result->m_saveStatus = DownloadResult::SaveStatus::SaveNoSpaceError;
+                } else if (m_writer && !m_writer->hasError() && m_checksum && !m_checksumValue.isEmpty() && m_checksum->result() != m_checksumValue) {
+                    qInfo() << QStringLiteral("DownloadTask url: %1, checksum mismatch, expected: %2, actual: %3").arg(m_url).arg(QString(m_checksumValue.toHex())).arg(QString(m_checksum->result().toHex()));
+                    m_result->m_saveStatus = DownloadResult::SaveStatus::SaveChecksumError;
+                } else {
+                    m_result->m_saveStatus = DownloadResult::SaveStatus::SaveError;
+                }
+            }
+            notifyResult(result);
+        });
         return;
     }
-    qint64 curTime = QDateTime::currentMSecsSinceEpoch();
-    qint64 elapsedTime = curTime - m_prevTime;
-    qint64 expectedBytes = m_maxBandwidth * elapsedTime / 1000;
-    qint64 bytesToRead = qMin(m_networkReply->bytesAvailable(), expectedBytes);
-    const auto& data = m_networkReply->read(bytesToRead);
-    if (isSaveToFile()) {
-        m_file->write(data);
+
+    // 丢弃节流中尚未发出的进度，直接发出最终的精确值
+    if (m_sink) {
+        m_progress.finish(m_sinkBytes, m_sinkBytes);
+    } else if (m_savePath.isEmpty() && m_extractDir.isEmpty()) {
+        m_progress.finish(result->m_byteArr.size(), result->m_byteArr.size());
     } else {
-        m_result->m_byteArr.push_back(data);
+        m_progress.finish(m_fileSize, m_fileSize);
     }
-    m_receviedBytesSize += bytesToRead;
-    emit sigDownloadProcess(m_receviedBytesSize, m_fileSize);
+
+    GetTask::notifyResult(result);
+}
+
+void DownloadTask::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    m_progress.update(bytesReceived, bytesTotal);
+}
+
+void DownloadTask::notifyProgress(const ProgressThrottle::Progress& progress)
+{
     if (m_calcSpeed) {
-        emit sigDownloadSpeed(m_receviedBytesSize - m_prevReceiveBytes, elapsedTime);
+        emit sigDownloadSpeed(progress.deltaBytes, progress.deltaMs);
+        emit sigDownloadRate(progress.bytesPerSecond, progress.remainingMs);
     }
-    m_prevTime = curTime;
-    m_prevReceiveBytes = m_receviedBytesSize;
+
+    emit sigDownloadProcess(progress.bytes, progress.bytesTotal);
 }
 
-void DownloadTask::notifyResult(const ResultPtr& result)
+void DownloadTask::onReading()
 {
-    if (m_calcProcessTimer) { // abort也会进finished
-        m_calcProcessTimer->stop();
+    updateReadBufferSize(m_networkReply);
+    if (BandwidthManager::instance().isLimited(m_bandwidthId)) { // 限速时由BandwidthManager在令牌可用时按分配的字节数读取
+        BandwidthManager::instance().notifyPending(m_bandwidthId);
+        return;
+    }
+    if (isSinking()) {
+        readAndSink(m_networkReply, false);
+    } else if (isSaveToFile()) {
+        readAndSaveToFile(m_networkReply, false);
+        saveResumeInfo();
+    } else if (isExtracting()) {
+        readAndExtract(m_networkReply, false);
+    } else {
+        readToMemory(m_networkReply, m_networkReply->bytesAvailable());
     }
+}
 
-    if (m_calcSpeed) {
-        if (m_savePath.isEmpty()) {
-            emit sigDownloadSpeed(result->m_byteArr.size() - m_prevReceiveBytes, QDateTime::currentMSecsSinceEpoch() - m_prevTime);
-        } else {
-            emit sigDownloadSpeed(m_fileSize - m_prevReceiveBytes, QDateTime::currentMSecsSinceEpoch() - m_prevTime);
+// 写入队列降到低水位，继续读取积压在reply中的数据
+void DownloadTask::onWriterReady()
+{
+    if (isSinking() || isExtracting()) {
+        if (m_networkReply) {
+            onReading();
+        }
+        return;
+    }
+    if (!isSaveToFile()) {
+        return;
+    }
+
+    if (!m_segments.empty()) {
+        for (size_t i = 0; i < m_segments.size(); ++i) { // 读取过程中分段可能完成或整体失败
+            onSegmentReading(m_segments[i].get());
         }
+    } else if (m_networkReply) {
+        onReading();
     }
+}
 
-    if (m_savePath.isEmpty()) {
-        emit sigDownloadProcess(result->m_byteArr.size(), result->m_byteArr.size());
-    } else {
-        emit sigDownloadProcess(m_fileSize, m_fileSize);
+// 写线程、解压线程或sink在积压降下来后调用，转回任务所在线程继续读取
+std::function<void()> DownloadTask::createReadyCallback()
+{
+    QPointer<DownloadTask> self(this);
+    return [self]() {
+        if (self) {
+            QMetaObject::invokeMethod(
+                self.data(), [self]() {
+                    if (self) {
+                        self->onWriterReady();
+                    }
+                },
+                Qt::QueuedConnection);
+        }
+    };
+}
+
+bool DownloadTask::isSaveToFile()
+{
+    return !m_savePath.isEmpty() && m_writer && !m_writer->isClosing();
+}
+
+// force为false时写入队列满则暂停读取，数据留在reply中
+void DownloadTask::readAndSaveToFile(QNetworkReply* reply, bool force)
+{
+    if (reply == nullptr || !isSaveToFile()) {
+        return;
+    }
+    if (!isWritableReply(reply)) {
+        reply->readAll();
+        return;
+    }
+    if (m_writer->hasError()) {
+        setWriterError();
+        reply->abort();
+        return;
     }
 
-    GetTask::notifyResult(result);
+    while (!reply->atEnd() && (force || !m_writer->isFull())) {
+        static int maxReadSizeOnce = 1024 * 1024 * 10; // 10M
+        if (m_writer->write(reply, qMin<qint64>(reply->bytesAvailable(), maxReadSizeOnce)) <= 0) {
+            break;
+        }
+    }
 }
 
-// 不限速进度
-void DownloadTask::onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+bool DownloadTask::isExtracting()
 {
-    if (m_calcSpeed) {
-        auto curTime = QDateTime::currentMSecsSinceEpoch();
-        emit sigDownloadSpeed(bytesReceived - m_prevReceiveBytes, curTime - m_prevTime);
-        m_prevTime = curTime;
-        m_prevReceiveBytes = bytesReceived;
+    return !m_extractDir.isEmpty() && m_extractor && !m_extractor->isClosing();
+}
+
+bool DownloadTask::isSinking()
+{
+    return m_sink != nullptr;
+}
+
+// 与readAndSaveToFile相同，解压队列满时暂停读取
+void DownloadTask::readAndExtract(QNetworkReply* reply, bool force)
+{
+    if (reply == nullptr || !isExtracting()) {
+        return;
+    }
+    if (!isContentReply(reply)) {
+        reply->readAll();
+        return;
+    }
+    if (m_extractor->hasError()) {
+        setExtractorError();
+        reply->abort();
+        return;
     }
 
-    emit sigDownloadProcess(bytesReceived, bytesTotal);
+    while (!reply->atEnd() && (force || !m_extractor->isFull())) {
+        static int maxReadSizeOnce = 1024 * 1024 * 10; // 10M
+        if (m_extractor->write(reply, qMin<qint64>(reply->bytesAvailable(), maxReadSizeOnce)) <= 0) {
+            break;
+        }
+    }
 }
 
-// 不限速读取
-void DownloadTask::onReading()
+// 下载到内存：容量足够时直接读入m_byteArr，否则存为分块，结束时再合并，避免反复扩容拷贝
+qint64 DownloadTask::readToMemory(QNetworkReply* reply, qint64 maxBytes)
 {
-    if (isSaveToFile()) {
-        readAndSaveToFile(m_networkReply, m_file.get());
+    maxBytes = qMin(maxBytes, reply->bytesAvailable());
+    if (maxBytes <= 0) {
+        return 0;
+    }
+
+    auto& bytes = m_result->m_byteArr;
+    if (m_chunks.empty() && bytes.capacity() - bytes.size() >= maxBytes) {
+        const auto size = bytes.size();
+        bytes.resize(size + maxBytes);
+        const qint64 readBytes = qMax<qint64>(reply->read(bytes.data() + size, maxBytes), 0);
+        bytes.resize(size + readBytes);
+        return readBytes;
+    }
+
+    m_chunks.push_back(reply->read(maxBytes));
+    m_chunksSize += m_chunks.back().size();
+    return m_chunks.back().size();
+}
+
+// 已知未压缩的内容大小时一次预留好容量
+void DownloadTask::reserveMemory(QNetworkReply* reply)
+{
+    const auto& encoding = reply->rawHeader("Content-Encoding").trimmed().toLower();
+    if (m_fileSize <= 0 || m_fileSize > s_maxReserveSize || (!encoding.isEmpty() && encoding != "identity")) {
+        return;
+    }
+    if (m_result->m_byteArr.isEmpty() && m_chunks.empty()) {
+        m_result->m_byteArr.reserve(m_fileSize);
+    }
+}
+
+// 逐块拷贝并释放，合并过程中的峰值内存约为内容大小加一个分块
+void DownloadTask::flattenChunks()
+{
+    if (m_chunks.empty()) {
+        return;
+    }
+
+    auto& bytes = m_result->m_byteArr;
+    if (bytes.isEmpty() && m_chunks.size() == 1) {
+        bytes = std::move(m_chunks.front());
     } else {
-        m_result->m_byteArr.push_back(m_networkReply->readAll());
+        bytes.reserve(bytes.size() + m_chunksSize);
+        for (auto& chunk : m_chunks) {
+            bytes.append(chunk);
+            chunk = QByteArray();
+        }
     }
+    m_chunks.clear();
+    m_chunksSize = 0;
 }
 
-bool DownloadTask::isSaveToFile()
+// 按BandwidthManager分配的字节数读取
+qint64 DownloadTask::readLimited(QNetworkReply* reply, qint64 maxBytes)
+{
+    if (isSinking()) {
+        if (!isContentReply(reply)) {
+            return reply->read(maxBytes).size();
+        }
+        return m_sink->isFull() ? 0 : writeSink(reply, maxBytes);
+    }
+    if (isExtracting()) {
+        if (!isContentReply(reply)) {
+            return reply->read(maxBytes).size();
+        }
+        if (m_extractor->hasError()) {
+            setExtractorError();
+            reply->abort();
+            return 0;
+        }
+        return m_extractor->isFull() ? 0 : m_extractor->write(reply, maxBytes);
+    }
+    if (!isSaveToFile()) {
+        return readToMemory(reply, maxBytes);
+    }
+    if (!isWritableReply(reply)) {
+        return reply->read(maxBytes).size();
+    }
+    if (m_writer->hasError()) {
+        setWriterError();
+        reply->abort();
+        return 0;
+    }
+    if (m_writer->isFull()) {
+        return 0;
+    }
+
+    const qint64 bytes = m_writer->write(reply, maxBytes);
+    saveResumeInfo();
+    return bytes;
+}
+
+// 所有单连接下载都登记到BandwidthManager，下载中开启全局或host限速也能立即生效
+void DownloadTask::addBandwidthConsumer(QNetworkReply* reply)
+{
+    removeBandwidthConsumer();
+    QPointer<QNetworkReply> replyPtr(reply);
+    BandwidthManager::Consumer consumer;
+    consumer.direction = BandwidthManager::Direction::Download;
+    consumer.host = m_request.url().host();
+    consumer.limit = m_maxBandwidth;
+    consumer.weight = m_bandwidthWeight;
+    consumer.pending = [replyPtr]() {
+        return replyPtr ? replyPtr->bytesAvailable() : 0;
+    };
+    consumer.transfer = [this, replyPtr](qint64 maxBytes) {
+        return replyPtr ? readLimited(replyPtr.data(), maxBytes) : 0;
+    };
+    m_bandwidthId = BandwidthManager::instance().addConsumer(consumer);
+}
+
+// 读缓冲约为1/4秒的限速量，reply不再从socket读取后内核缓冲填满，TCP窗口随之收紧
+void DownloadTask::updateReadBufferSize(QNetworkReply* reply)
+{
+    const qint64 limit = BandwidthManager::instance().limit(m_bandwidthId);
+    const qint64 size = limit > 0 ? qBound(s_minReadBufferSize, limit / 4, s_readBufferSize) : s_readBufferSize;
+    if (reply->readBufferSize() != size) {
+        reply->setReadBufferSize(size);
+    }
+}
+
+void DownloadTask::removeBandwidthConsumer()
+{
+    if (m_bandwidthId != 0) {
+        BandwidthManager::instance().removeConsumer(m_bandwidthId);
+        m_bandwidthId = 0;
+    }
+}
+
+bool DownloadTask::isSegmentEnable()
 {
-    return !m_savePath.isEmpty() && m_file;
+    return m_segmentCount > 1 && isSaveToFile();
 }
 
-void DownloadTask::readAndSaveToFile(QNetworkReply* reply, QFile* file)
+// 探测结果：支持Range且文件足够大则分段下载，否则回退为单连接下载
+void DownloadTask::onProbeFinished()
 {
-    if (reply == nullptr || file == nullptr) {
+    auto reply = m_networkReply;
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() != QNetworkReply::NoError) {
+        failMirror(reply->errorString());
+        const QString mirror = nextMirror();
+        if (!mirror.isEmpty()) { // 换镜像重新探测
+            disconnect(reply, nullptr, this, nullptr);
+            reply->deleteLater();
+            m_networkReply = nullptr;
+            useMirror(mirror);
+            startProbe();
+            return;
+        }
+    }
+    if (httpCode >= 400 && !m_aborted) { // 只允许GET的地址(如预签名URL)HEAD会返回405、403等，改用单连接GET
+        qInfo() << QStringLiteral("DownloadTask url: %1, probe failed with http code %2, download with single connection").arg(m_url).arg(httpCode);
+        disconnect(reply, nullptr, this, nullptr);
+        reply->deleteLater();
+        m_networkReply = nullptr;
+        startSingleRequest();
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError || (httpCode >= 300 && httpCode < 400)) {
+        onRequestFinished(); // 错误重试、重定向走通用流程
         return;
     }
+    if (!m_mirrors.isEmpty()) {
+        MirrorRegistry::instance().reportLatency(m_mirror, QDateTime::currentMSecsSinceEpoch() - m_mirrorStartTime);
+    }
 
-    while (!reply->atEnd()) {
-        QByteArray bytes;
-        static int maxReadSizeOnce = 1024 * 1024 * 10; // 10M
-        if (reply->bytesAvailable() > maxReadSizeOnce) {
-            bytes = reply->read(maxReadSizeOnce);
-        } else {
-            bytes = reply->readAll();
+    const qint64 fileSize = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    const bool acceptRanges = reply->rawHeader("Accept-Ranges").trimmed().toLower() == "bytes";
+    const QByteArray etag = m_etag;
+    const QByteArray lastModified = m_lastModified;
+    const bool sameMirror = m_validatorMirror == m_mirror;
+    updateValidator(reply);
+    updateExpectedChecksum(reply);
+
+    // 资源已变化，上次下载的内容作废。换了镜像时校验信息不可比，只核对大小
+    const bool unchanged = !sameMirror || (m_etag.isEmpty() ? (!m_lastModified.isEmpty() && m_lastModified == lastModified) : m_etag == etag);
+    if (!m_resumeRanges.empty() && (!unchanged || fileSize != m_fileSize)) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, resource changed, discard the partial file").arg(m_url);
+        m_resumeRanges.clear();
+        m_resumeOffset = 0;
+        m_writer->resize(0);
+    }
+
+    const int segmentCount = static_cast<int>(qMin<qint64>(m_segmentCount, fileSize / s_minSegmentSize));
+    if (acceptRanges && segmentCount >= 2 && !preallocateFile(reply, fileSize)) {
+        onRequestFinished();
+        return;
+    }
+    reply->deleteLater();
+    m_networkReply = nullptr;
+
+    if (!acceptRanges || segmentCount < 2) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, range not supported or file too small, download with single connection").arg(m_url);
+        startSingleRequest();
+        return;
+    }
+
+    startSegments(fileSize, segmentCount);
+}
+
+void DownloadTask::startSegments(qint64 fileSize, int segmentCount)
+{
+    qInfo() << QStringLiteral("DownloadTask url: %1, download with %2 segments, fileSize: %3").arg(m_url).arg(segmentCount).arg(fileSize);
+    m_fileSize = fileSize; // 文件已在onProbeFinished中预分配，各分段按偏移写入
+
+    // 续传时沿用上次剩余的区间，并切分最大的区间直到连接数用满
+    auto ranges = m_resumeRanges;
+    if (ranges.empty()) {
+        ranges.emplace_back(0, fileSize - 1);
+    }
+    while (static_cast<int>(ranges.size()) < segmentCount) {
+        auto largest = std::max_element(ranges.begin(), ranges.end(), [](const auto& a, const auto& b) {
+            return a.second - a.first < b.second - b.first;
+        });
+        const qint64 length = largest->second + 1 - largest->first;
+        if (length < s_minSegmentSize * 2) {
+            break;
         }
+        const qint64 middle = largest->first + length / 2;
+        const qint64 end = largest->second;
+        largest->second = middle - 1;
+        ranges.emplace_back(middle, end);
+    }
+
+    m_segments.clear();
+    m_segmentCursor = 0;
+    addSegmentsBandwidthConsumer();
+    for (const auto& range : ranges) {
+        auto segment = std::make_unique<Segment>();
+        segment->begin = range.first;
+        segment->end = range.second;
+        segment->offset = segment->begin;
+        startSegment(segment.get());
+        m_segments.push_back(std::move(segment));
+    }
+}
+
+void DownloadTask::startSegment(Segment* segment)
+{
+    QNetworkRequest request(m_request);
+    request.setRawHeader("Range", QStringLiteral("bytes=%1-%2").arg(segment->offset).arg(segment->end).toLatin1());
+    request.setRawHeader("Accept-Encoding", "identity"); // 压缩后的数据无法按偏移写入
 
-        file->write(bytes);
+    segment->startOffset = segment->offset;
+    segment->startTime = QDateTime::currentMSecsSinceEpoch();
+    segment->reply = getNetworkAccessManager()->get(request);
+    updateReadBufferSize(segment->reply);
+    connect(segment->reply, &QNetworkReply::readyRead, this, [=]() { onSegmentReading(segment); });
+    connect(segment->reply, &QNetworkReply::finished, this, [=]() { onSegmentFinished(segment); });
+    connect(segment->reply, &QNetworkReply::sslErrors, this, &DownloadTask::onCopeSslErrors);
+}
+
+void DownloadTask::onSegmentReading(Segment* segment)
+{
+    if (segment->reply) {
+        updateReadBufferSize(segment->reply);
+    }
+    if (BandwidthManager::instance().isLimited(m_bandwidthId)) { // 限速时由BandwidthManager在令牌可用时分配给各分段
+        BandwidthManager::instance().notifyPending(m_bandwidthId);
+        return;
+    }
+    if (readSegment(segment, false) && segment->offset > segment->end) { // 区间被切走一部分时，连接上多余的数据不再需要
+        completeSegment(segment);
+    }
+}
+
+void DownloadTask::onSegmentFinished(Segment* segment)
+{
+    auto reply = segment->reply;
+    if (reply == nullptr) {
+        return;
+    }
+
+    if (reply->error() != QNetworkReply::NoError) {
+        if (reply->error() != QNetworkReply::OperationCanceledError) {
+            failMirror(reply->errorString()); // 重试时换镜像，开启续传时从已下载区间继续
+        }
+        failSegments(reply);
+        return;
     }
+
+    if (!readSegment(segment, true)) {
+        return;
+    }
+    if (segment->offset > segment->end) {
+        completeSegment(segment);
+        return;
+    }
+
+    // 连接正常结束但数据不全，从断开位置继续请求
+    if (segment->restartCount++ < s_maxSegmentRestart) {
+        releaseSegmentReply(segment);
+        startSegment(segment);
+        return;
+    }
+    failSegments(reply);
+}
+
+// 返回false表示分段已结束或已整体失败，segment不可再访问。force为false时写入队列满则暂不读取，maxBytes<0时不限读取量
+bool DownloadTask::readSegment(Segment* segment, bool force, qint64 maxBytes)
+{
+    auto reply = segment->reply;
+    if (reply == nullptr) {
+        return false;
+    }
+
+    // 服务端忽略了Range，数据偏移不可信，关闭分段后重新下载
+    if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 206) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, segment response is not partial content, fallback to single connection").arg(m_url);
+        m_segmentCount = 1;
+        removeBandwidthConsumer();
+        for (const auto& item : m_segments) {
+            releaseSegmentReply(item.get());
+        }
+        m_segments.clear();
+        retry();
+        return false;
+    }
+
+    if (m_writer->hasError()) {
+        setWriterError();
+        failSegments(reply);
+        return false;
+    }
+    if (!force && m_writer->isFull()) {
+        return true;
+    }
+
+    qint64 length = qMin(reply->bytesAvailable(), segment->end + 1 - segment->offset);
+    if (maxBytes >= 0) {
+        length = qMin(length, maxBytes);
+    }
+    segment->offset += m_writer->write(segment->offset, reply, length);
+
+    qint64 receivedBytes = m_fileSize;
+    for (const auto& item : m_segments) {
+        receivedBytes -= item->end + 1 - item->offset;
+    }
+    onDownloadProgress(receivedBytes, m_fileSize);
+    saveResumeInfo();
+    return true;
+}
+
+void DownloadTask::completeSegment(Segment* segment)
+{
+    releaseSegmentReply(segment);
+    if (stealSegment()) {
+        return;
+    }
+
+    for (const auto& item : m_segments) {
+        if (item->reply) {
+            return;
+        }
+    }
+    notifySegmentsResult();
+}
+
+// 空闲出一个连接时，从预计最晚完成的分段中切走后半段剩余区间
+bool DownloadTask::stealSegment()
+{
+    Segment* slowest = nullptr;
+    double slowestCost = 0;
+    const qint64 curTime = QDateTime::currentMSecsSinceEpoch();
+    for (const auto& item : m_segments) {
+        const qint64 remaining = item->end + 1 - item->offset;
+        if (item->reply == nullptr || remaining < s_minSegmentSize * 2) {
+            continue;
+        }
+        const double speed = qMax<qint64>(item->offset - item->startOffset, 1) / static_cast<double>(qMax<qint64>(curTime - item->startTime, 1));
+        const double cost = remaining / speed;
+        if (cost > slowestCost) {
+            slowestCost = cost;
+            slowest = item.get();
+        }
+    }
+
+    if (slowest == nullptr) {
+        return false;
+    }
+
+    auto segment = std::make_unique<Segment>();
+    segment->begin = slowest->offset + (slowest->end + 1 - slowest->offset) / 2;
+    segment->end = slowest->end;
+    segment->offset = segment->begin;
+    slowest->end = segment->begin - 1;
+    startSegment(segment.get());
+    m_segments.push_back(std::move(segment));
+    return true;
+}
+
+void DownloadTask::failSegments(QNetworkReply* reply)
+{
+    for (const auto& item : m_segments) {
+        if (item->reply != reply) {
+            releaseSegmentReply(item.get());
+        }
+        item->reply = nullptr;
+    }
+    disconnect(reply, nullptr, this, nullptr);
+
+    // 交给通用流程处理错误与重试，getBytesFromReply中清理分段
+    m_networkReply = reply;
+    onRequestFinished();
+}
+
+void DownloadTask::releaseSegmentReply(Segment* segment)
+{
+    auto reply = segment->reply;
+    if (reply == nullptr) {
+        return;
+    }
+
+    segment->reply = nullptr;
+    disconnect(reply, nullptr, this, nullptr);
+    if (!reply->isFinished()) {
+        reply->abort();
+    }
+    reply->deleteLater();
+}
+
+// 限速时所有分段作为一个consumer，任务限速与权重对整个任务生效；分得的字节数从上次之后的分段开始轮流读取
+void DownloadTask::addSegmentsBandwidthConsumer()
+{
+    removeBandwidthConsumer();
+    BandwidthManager::Consumer consumer;
+    consumer.direction = BandwidthManager::Direction::Download;
+    consumer.host = m_request.url().host();
+    consumer.limit = m_maxBandwidth;
+    consumer.weight = m_bandwidthWeight;
+    consumer.pending = [this]() {
+        qint64 bytes = 0;
+        for (const auto& segment : m_segments) {
+            if (segment->reply) {
+                bytes += segment->reply->bytesAvailable();
+            }
+        }
+        return bytes;
+    };
+    consumer.transfer = [this](qint64 maxBytes) {
+        return readSegmentsLimited(maxBytes);
+    };
+    m_bandwidthId = BandwidthManager::instance().addConsumer(consumer);
+}
+
+// 分段读完或整体失败时m_segments会变化，此时结束本次读取
+qint64 DownloadTask::readSegmentsLimited(qint64 maxBytes)
+{
+    qint64 bytes = 0;
+    const size_t count = m_segments.size();
+    for (size_t i = 0; i < count && bytes < maxBytes; ++i) {
+        Segment* segment = m_segments[(m_segmentCursor + i) % count].get();
+        if (segment->reply == nullptr || segment->reply->bytesAvailable() <= 0) {
+            continue;
+        }
+        if (m_writer->isFull() && !m_writer->hasError()) {
+            break;
+        }
+
+        const qint64 offset = segment->offset;
+        if (!readSegment(segment, false, maxBytes - bytes)) {
+            return bytes;
+        }
+        bytes += segment->offset - offset;
+        if (segment->offset > segment->end) {
+            m_segmentCursor = (m_segmentCursor + i + 1) % count;
+            completeSegment(segment);
+            return bytes;
+        }
+    }
+    m_segmentCursor = count > 0 ? (m_segmentCursor + 1) % count : 0;
+    return bytes;
+}
+
+void DownloadTask::notifySegmentsResult()
+{
+    removeBandwidthConsumer();
+    m_result->m_httpCode = 206;
+    m_result->m_qtNetworkError = QNetworkReply::NoError;
+    m_result->m_statusCode = Result::RequestStatus::Success;
+    m_result->m_taskId = m_taskId;
+    closeFile(m_result);
+    m_segments.clear();
+    qInfo() << QStringLiteral("Task finished, async request elapsedTime: %1ms, url: %2").arg(m_elapsedTimer.elapsed()).arg(m_url);
+    m_elapsedTimer.restart();
+    printResultLog(m_result);
+    notifyResult(m_result);
+}
+
+void DownloadTask::onMetaDataChanged()
+{
+    auto reply = qobject_cast<QNetworkReply*>(sender());
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (m_mirrorFirstByteTime == 0) {
+        m_mirrorFirstByteTime = QDateTime::currentMSecsSinceEpoch();
+        if (!m_mirrors.isEmpty() && httpCode >= 200 && httpCode < 300) {
+            MirrorRegistry::instance().reportLatency(m_mirror, m_mirrorFirstByteTime - m_mirrorStartTime);
+        }
+    }
+    if (httpCode < 200 || httpCode >= 300) {
+        return;
+    }
+
+    const qint64 fileSize = m_fileSize; // 续传或换镜像前已知的文件大小
+    m_fileSize = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    if (isSinking()) {
+        const auto& encoding = reply->rawHeader("Content-Encoding").trimmed().toLower();
+        const qint64 bytesTotal = m_fileSize > 0 && (encoding.isEmpty() || encoding == "identity") ? m_fileSize : -1; // 压缩传输时Content-Length不是解压后的大小
+        m_sinkBytes = 0;
+        m_sink->start(bytesTotal);
+        onDownloadProgress(0, bytesTotal);
+        return;
+    }
+    if (isExtracting()) {
+        updateExpectedChecksum(reply);
+        onDownloadProgress(0, m_fileSize > 0 ? m_fileSize : -1);
+        return;
+    }
+    if (!isSaveToFile()) {
+        if (m_savePath.isEmpty()) {
+            reserveMemory(reply);
+        }
+        return;
+    }
+
+    updateValidator(reply);
+    updateExpectedChecksum(reply);
+    if (m_resumeOffset > 0 && httpCode == 206) {
+        // Content-Range: bytes 100-999/1000
+        const auto& contentRange = reply->rawHeader("Content-Range");
+        const qint64 begin = contentRange.mid(contentRange.indexOf(' ') + 1, contentRange.indexOf('-') - contentRange.indexOf(' ') - 1).toLongLong();
+        const qint64 total = contentRange.mid(contentRange.lastIndexOf('/') + 1).toLongLong();
+        if (begin == m_resumeOffset && (fileSize <= 0 || total == fileSize)) {
+            m_fileSize = total;
+            if (preallocateFile(reply, m_fileSize)) {
+                onDownloadProgress(m_resumeOffset, m_fileSize);
+            }
+            return;
+        }
+        qInfo() << QStringLiteral("DownloadTask url: %1, unexpected Content-Range: %2").arg(m_url).arg(QString(contentRange));
+        removeResumeInfo();
+        m_mirrorAbortReason = QStringLiteral("unexpected Content-Range: %1").arg(QString(contentRange));
+        reply->abort();
+        return;
+    }
+
+    if (m_resumeOffset > 0) { // 资源已变化或服务端不支持Range，返回了完整内容，从头写入
+        qInfo() << QStringLiteral("DownloadTask url: %1, resource changed, download from the beginning").arg(m_url);
+        m_resumeOffset = 0;
+        m_writer->resize(0);
+        m_writer->seek(0);
+    }
+    if (preallocateFile(reply, m_fileSize)) {
+        onDownloadProgress(0, m_fileSize);
+    }
+}
+
+// 已知文件大小时预分配磁盘空间，空间不足则立即失败且不再重试。返回false表示已失败
+bool DownloadTask::preallocateFile(QNetworkReply* reply, qint64 fileSize)
+{
+    if (fileSize <= 0) {
+        return true;
+    }
+    // 压缩传输时Content-Length不是解压后的大小
+    const auto& encoding = reply->rawHeader("Content-Encoding").trimmed().toLower();
+    if (!encoding.isEmpty() && encoding != "identity") {
+        return true;
+    }
+
+    const QFileInfo info(getFilePath());
+    const qint64 needBytes = fileSize - info.size();
+    const QStorageInfo storage(info.absolutePath());
+    if (needBytes > 0 && storage.isValid() && storage.bytesAvailable() < needBytes) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, no space left, need %2 bytes, available %3 bytes").arg(m_url).arg(needBytes).arg(storage.bytesAvailable());
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveNoSpaceError;
+        m_rerequestCount = 0;
+        reply->abort();
+        return false;
+    }
+
+    m_writer->preallocate(fileSize);
+    if (m_memoryMapEnable) {
+        mapFile(fileSize);
+    }
+    return true;
+}
+
+// 映射在写线程中完成后才切换为直接读入映射区，不在任务线程等待，之前的数据照常经写线程写入
+void DownloadTask::mapFile(qint64 fileSize)
+{
+    const auto writer = m_writer;
+    writer->map(fileSize).then(this, [this, writer](bool success) {
+        if (writer != m_writer) { // 已重新打开文件
+            return;
+        }
+        if (!success || !writer->enableMap()) {
+            qInfo() << QStringLiteral("DownloadTask url: %1, map file failed, fallback to positional write").arg(m_url);
+        }
+    });
+}
+
+void DownloadTask::setWriterError()
+{
+    if (m_writer->error() == FileWriter::Error::NoSpaceError) {
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveNoSpaceError;
+        m_rerequestCount = 0; // 空间不足重试无意义
+    } else {
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveWriteError;
+    }
+}
+
+// 关闭写入器，开启续传时成功则在写线程中把.part原子重命名为目标文件，失败则记录已下载区间
+void DownloadTask::closeFile(const ResultPtr& result)
+{
+    std::function<bool()> finisher;
+    if (m_resumeEnable) {
+        const QString filePath = getFilePath();
+        const QString infoPath = getResumeInfoPath();
+        const QString savePath = m_savePath;
+        if (result->isSuccess() && result->m_statusCode == Result::RequestStatus::Success) {
+            finisher = [=]() {
+                QFile::remove(infoPath);
+                return FileWriter::replace(filePath, savePath);
+            };
+        } else if (result->m_httpCode == 416) { // 记录的区间已不可用，下次从头下载
+            finisher = [=]() {
+                QFile::remove(filePath);
+                QFile::remove(infoPath);
+                return true;
+            };
+        } else if (result->m_statusCode != Result::RequestStatus::Redirect) {
+            m_resumeSaveTime = 0;
+            saveResumeInfo();
+        }
+    } else if (!result->isSuccess() && m_segments.empty()) {
+        m_writer->resize(m_writer->pos()); // 去掉预分配而未写入的部分
+    }
+
+    // 校验在重命名之前，不一致时删除文件，下次从头下载
+    const bool success = result->isSuccess() && result->m_statusCode == Result::RequestStatus::Success;
+    if (m_checksum && success && !m_checksumValue.isEmpty()) {
+        const auto checksum = m_checksum;
+        const QByteArray expected = m_checksumValue;
+        const QString filePath = getFilePath();
+        const QString infoPath = m_resumeEnable ? getResumeInfoPath() : QString();
+        const auto next = std::move(finisher);
+        finisher = [=]() {
+            if (checksum->result() != expected) {
+                QFile::remove(filePath);
+                if (!infoPath.isEmpty()) {
+                    QFile::remove(infoPath);
+                }
+                return false;
+            }
+            return next ? next() : true;
+        };
+    } else if (m_checksum) { // 失败或没有可比较的摘要，不必再补算
+        if (success) {
+            qInfo() << QStringLiteral("DownloadTask url: %1, no expected checksum, skip verification").arg(m_url);
+        }
+        m_writer->setChecksum(nullptr);
+    }
+
+    m_closeFuture = m_writer->close(m_flushPolicy, finisher);
+}
+
+bool DownloadTask::openExtractor()
+{
+    if (!QDir().mkpath(m_extractDir)) {
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SavePathOpenError;
+        return false;
+    }
+
+    m_extractor = std::make_shared<ArchiveExtractor>(m_extractDir, m_extractFormat);
+    m_extractor->setReadyCallback(createReadyCallback());
+    m_checksum.reset();
+    if (m_checksumEnable) {
+        m_checksum = std::make_shared<Checksum>(m_checksumAlgorithm);
+        m_extractor->setChecksum(m_checksum);
+    }
+    m_result->m_saveStatus = DownloadResult::SaveStatus::Success;
+    return true;
+}
+
+void DownloadTask::setExtractorError()
+{
+    switch (m_extractor->error()) {
+    case ArchiveExtractor::Error::NoSpaceError:
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveNoSpaceError;
+        m_rerequestCount = 0;
+        break;
+    case ArchiveExtractor::Error::FormatError:
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveExtractError;
+        break;
+    default:
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveWriteError;
+        break;
+    }
+}
+
+// 压缩包数据全部解压写出后再通知结果，有期望的摘要时在解压线程中比较
+void DownloadTask::closeExtractor(const ResultPtr& result)
+{
+    std::function<bool()> finisher;
+    const bool success = result->isSuccess() && result->m_statusCode == Result::RequestStatus::Success;
+    if (m_checksum && success && !m_checksumValue.isEmpty()) {
+        const auto checksum = m_checksum;
+        const QByteArray expected = m_checksumValue;
+        finisher = [=]() {
+            return checksum->result() == expected;
+        };
+    }
+
+    m_closeFuture = m_extractor->close(finisher);
+}
+
+void DownloadTask::openSink()
+{
+    m_sinkBytes = 0;
+    m_sink->setReadyCallback(createReadyCallback());
+    m_result->m_saveStatus = DownloadResult::SaveStatus::Success;
+}
+
+// 与readAndSaveToFile相同，sink满时暂停读取
+void DownloadTask::readAndSink(QNetworkReply* reply, bool force)
+{
+    if (reply == nullptr || !isSinking()) {
+        return;
+    }
+    if (!isContentReply(reply)) {
+        reply->readAll();
+        return;
+    }
+
+    while (!reply->atEnd() && (force || !m_sink->isFull())) {
+        if (writeSink(reply, reply->bytesAvailable()) <= 0) {
+            break;
+        }
+    }
+}
+
+// sink直接从reply读取，出错时断开请求
+qint64 DownloadTask::writeSink(QNetworkReply* reply, qint64 maxBytes)
+{
+    if (m_result->m_saveStatus != DownloadResult::SaveStatus::Success) {
+        return 0;
+    }
+    const qint64 bytes = m_sink->write(reply, maxBytes);
+    if (bytes < 0) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, sink write failed").arg(m_url);
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveWriteError;
+        if (!reply->isFinished()) {
+            reply->abort();
+        }
+        return 0;
+    }
+    m_sinkBytes += bytes;
+    return bytes;
+}
+
+void DownloadTask::finishSink(const ResultPtr& result)
+{
+    const bool success = result->isSuccess() && result->m_statusCode == Result::RequestStatus::Success;
+    if (!m_sink->finish(success) && m_result->m_saveStatus == DownloadResult::SaveStatus::Success) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, sink finish failed").arg(m_url);
+        m_result->m_saveStatus = DownloadResult::SaveStatus::SaveWriteError;
+    }
+}
+
+// 未指定期望的摘要时从响应头读取，Content-MD5只对应本次响应的内容，部分响应时不用
+void DownloadTask::updateExpectedChecksum(QNetworkReply* reply)
+{
+    if (!m_checksumEnable || !m_expectedChecksum.isEmpty()) {
+        return;
+    }
+
+    static const struct {
+        Checksum::Algorithm algorithm;
+        const char* digestName; // RFC 3230 Digest中的算法名
+        const char* headerName;
+    } s_names[] = {
+        { Checksum::Algorithm::Md5, "md5", "x-checksum-md5" },
+        { Checksum::Algorithm::Sha1, "sha", "x-checksum-sha1" },
+        { Checksum::Algorithm::Sha256, "sha-256", "x-checksum-sha256" },
+        { Checksum::Algorithm::Crc32c, "crc32c", "x-checksum-crc32c" },
+    };
+    const auto& name = *std::find_if(std::begin(s_names), std::end(s_names), [=](const auto& item) {
+        return item.algorithm == m_checksumAlgorithm;
+    });
+
+    QByteArray value;
+    // Digest: SHA-256=X48E9qOokqqrvdts8nOJRJN3OWDUoyWxBf7kbu9DBPE=,MD5=...
+    for (const auto& item : reply->rawHeader("Digest").split(',')) {
+        const int pos = item.indexOf('=');
+        if (pos > 0 && item.left(pos).trimmed().toLower() == name.digestName) {
+            value = item.mid(pos + 1);
+        }
+    }
+    if (value.isEmpty()) {
+        value = reply->rawHeader(name.headerName);
+    }
+    if (value.isEmpty()) {
+        value = reply->rawHeader("x-checksum");
+    }
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (value.isEmpty() && m_checksumAlgorithm == Checksum::Algorithm::Md5 && httpCode != 206) {
+        value = reply->rawHeader("Content-MD5");
+    }
+
+    const auto& checksum = Checksum::fromString(m_checksumAlgorithm, value);
+    if (!checksum.isEmpty()) {
+        m_checksumValue = checksum;
+    }
+}
+
+// 续传或设置了镜像时错误页、重定向等非2xx的内容不能写入文件，之后要在其后继续写入
+bool DownloadTask::isWritableReply(QNetworkReply* reply)
+{
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return (!m_resumeEnable && m_mirrors.isEmpty()) || (httpCode >= 200 && httpCode < 300);
+}
+
+// 错误页、重定向等非2xx的内容不解压，也不交给sink
+bool DownloadTask::isContentReply(QNetworkReply* reply)
+{
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return httpCode >= 200 && httpCode < 300;
+}
+
+QString DownloadTask::getFilePath()
+{
+    return m_resumeEnable ? m_savePath + ".part" : m_savePath;
+}
+
+QString DownloadTask::getResumeInfoPath()
+{
+    return m_savePath + ".part.info";
+}
+
+bool DownloadTask::loadResumeInfo()
+{
+    m_resumeOffset = 0;
+    m_resumeRanges.clear();
+    m_etag.clear();
+    m_lastModified.clear();
+    m_validatorMirror.clear();
+
+    QFile infoFile(getResumeInfoPath());
+    if (!QFileInfo::exists(getFilePath()) || !infoFile.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const auto& obj = QJsonDocument::fromJson(infoFile.readAll()).object();
+    if (obj.value("url").toString() != m_url) {
+        return false;
+    }
+
+    // 写入记录前已flush，记录的区间起点之前的数据都应已在文件中
+    const qint64 partSize = QFileInfo(getFilePath()).size();
+    std::vector<std::pair<qint64, qint64>> ranges;
+    for (const auto& value : obj.value("ranges").toArray()) {
+        const auto& range = value.toArray();
+        const qint64 begin = static_cast<qint64>(range.at(0).toDouble());
+        const qint64 end = static_cast<qint64>(range.at(1).toDouble());
+        if (begin < 0 || begin > partSize || (end >= 0 && end < begin)) {
+            return false;
+        }
+        ranges.emplace_back(begin, end);
+    }
+
+    const QByteArray etag = obj.value("etag").toString().toLatin1();
+    const QByteArray lastModified = obj.value("lastModified").toString().toLatin1();
+    if (ranges.empty() || (etag.isEmpty() && lastModified.isEmpty())) { // 无校验信息无法保证内容一致
+        return false;
+    }
+
+    m_etag = etag;
+    m_lastModified = lastModified;
+    m_validatorMirror = obj.value("mirror").toString();
+    m_fileSize = static_cast<qint64>(obj.value("fileSize").toDouble());
+    m_resumeRanges = ranges;
+    m_resumeOffset = std::min_element(ranges.begin(), ranges.end())->first;
+    return true;
+}
+
+void DownloadTask::saveResumeInfo()
+{
+    if (!m_resumeEnable || !isSaveToFile() || (m_etag.isEmpty() && m_lastModified.isEmpty())) {
+        return;
+    }
+    const qint64 curTime = QDateTime::currentMSecsSinceEpoch();
+    if (curTime - m_resumeSaveTime < s_resumeSaveInterval) {
+        return;
+    }
+    m_resumeSaveTime = curTime;
+
+    QJsonArray ranges;
+    if (!m_segments.empty()) {
+        for (const auto& segment : m_segments) {
+            if (segment->offset <= segment->end) {
+                ranges.append(QJsonArray { static_cast<double>(segment->offset), static_cast<double>(segment->end) });
+            }
+        }
+    } else {
+        ranges.append(QJsonArray { static_cast<double>(m_writer->pos()), static_cast<double>(m_fileSize > 0 ? m_fileSize - 1 : -1) });
+    }
+
+    QJsonObject obj {
+        { "url", m_url },
+        { "etag", QString::fromLatin1(m_etag) },
+        { "lastModified", QString::fromLatin1(m_lastModified) },
+        { "fileSize", static_cast<double>(m_fileSize) },
+        { "ranges", ranges }
+    };
+    if (!m_validatorMirror.isEmpty()) {
+        obj.insert("mirror", m_validatorMirror);
+    }
+    const QByteArray& info = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+    const QString infoPath = getResumeInfoPath();
+    m_writer->post([info, infoPath](QFile* file) {
+        if (!file->flush()) { // 写线程按顺序执行，先落盘之前的数据再记录区间
+            return false;
+        }
+        QSaveFile infoFile(infoPath);
+        if (infoFile.open(QIODevice::WriteOnly)) {
+            infoFile.write(info);
+            infoFile.commit();
+        }
+        return true;
+    });
+}
+
+void DownloadTask::removeResumeInfo()
+{
+    QFile::remove(getResumeInfoPath());
+}
+
+void DownloadTask::updateValidator(QNetworkReply* reply)
+{
+    m_etag = reply->rawHeader("ETag");
+    if (m_etag.startsWith("W/")) { // 弱校验不能用于If-Range
+        m_etag.clear();
+    }
+    m_lastModified = reply->rawHeader("Last-Modified");
+    m_validatorMirror = m_mirror;
+}
+
+/*** 镜像切换 ***/
+// 首次请求或上次失败时按评分重新选择，重定向后的重试沿用重定向的地址
+void DownloadTask::selectMirror()
+{
+    if (m_mirrors.isEmpty() || (!m_mirror.isEmpty() && !m_mirrorFailed)) {
+        return;
+    }
+    m_mirrorFailed = false;
+    m_failedMirrors.clear();
+    useMirror(MirrorRegistry::instance().rank(m_mirrors).first());
+}
+
+void DownloadTask::useMirror(const QString& mirror)
+{
+    if (mirror != m_mirror) {
+        qInfo() << QStringLiteral("DownloadTask url: %1, use mirror: %2").arg(m_url).arg(mirror);
+    }
+    m_mirror = mirror;
+    m_request.setUrl(QUrl(mirror));
+}
+
+// 本次请求中尚未失败的最优镜像，没有时返回空
+QString DownloadTask::nextMirror()
+{
+    if (m_mirrors.isEmpty() || m_aborted) {
+        return QString();
+    }
+    for (const auto& mirror : MirrorRegistry::instance().rank(m_mirrors)) {
+        if (!m_failedMirrors.contains(mirror)) {
+            return mirror;
+        }
+    }
+    return QString();
+}
+
+void DownloadTask::failMirror(const QString& reason)
+{
+    if (m_mirrors.isEmpty() || m_aborted) {
+        return;
+    }
+    qInfo() << QStringLiteral("DownloadTask url: %1, mirror: %2 failed, reason: %3").arg(m_url).arg(m_mirror).arg(reason);
+    MirrorRegistry::instance().reportFailure(m_mirror);
+    m_failedMirrors.append(m_mirror);
+    m_mirrorFailed = true;
+}
+
+// 出错或被判定停滞且还有可用的镜像时换镜像继续，成功、重定向、取消、写入错误等走通用流程
+void DownloadTask::onMirrorFinished()
+{
+    m_stallTimer.stop();
+    auto reply = m_networkReply;
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    const bool contentReply = httpCode >= 200 && httpCode < 300;
+    if (contentReply && m_mirrorFirstByteTime > 0) { // 停滞前的传输同样计入吞吐
+        MirrorRegistry::instance().reportThroughput(m_mirror, m_mirrorBytes, QDateTime::currentMSecsSinceEpoch() - m_mirrorFirstByteTime);
+    }
+
+    const auto error = reply->error();
+    if (m_aborted || (m_mirrorAbortReason.isEmpty() && (error == QNetworkReply::NoError || error == QNetworkReply::OperationCanceledError))) {
+        onRequestFinished();
+        return;
+    }
+    failMirror(m_mirrorAbortReason.isEmpty() ? reply->errorString() : m_mirrorAbortReason);
+
+    // 下载到文件时可从已写入的位置继续，其他方式已收到的内容无法接续
+    const QString mirror = nextMirror();
+    if (mirror.isEmpty() || (isSaveToFile() && m_writer->hasError()) || (!isSaveToFile() && contentReply && m_mirrorBytes > 0)) {
+        onRequestFinished();
+        return;
+    }
+
+    removeBandwidthConsumer();
+    if (isSaveToFile()) {
+        readAndSaveToFile(reply, true); // 断开前已收到的数据仍然有效
+        m_resumeOffset = m_writer->pos();
+    } else if (!isExtracting()) { // 丢弃错误页的内容
+        m_result->m_byteArr.clear();
+        m_chunks.clear();
+        m_chunksSize = 0;
+    }
+    disconnect(reply, nullptr, this, nullptr);
+    reply->deleteLater();
+    m_networkReply = nullptr;
+
+    qInfo() << QStringLiteral("DownloadTask url: %1, switch mirror, continue from %2 bytes").arg(m_url).arg(m_resumeOffset);
+    useMirror(mirror);
+    startSingleRequest();
+}
+
+void DownloadTask::onStalled()
+{
+    auto reply = m_networkReply;
+    if (reply == nullptr || reply->isFinished()) {
+        return;
+    }
+    if (reply->bytesAvailable() > 0) { // 限速或写入积压时数据留在reply中，不算停滞
+        m_stallTimer.start();
+        return;
+    }
+
+    m_mirrorAbortReason = QStringLiteral("no data received in %1ms").arg(m_stallTimeout);
+    reply->abort();
 }
@@ -1,18 +1,28 @@
 ﻿#ifndef NETWORK_DOWNLOAD_TASK_H
 #define NETWORK_DOWNLOAD_TASK_H
+#include "archiveextractor.h"
+#include "checksum.h"
+#include "downloadsink.h"
+#include "filewriter.h"
 #include "gettask.h"
+#include "progressthrottle.h"
 #include <QFile>
 #include <QTimer>
+#include <vector>
 
 namespace Net {
 class NETWORK_EXPORT DownloadResult : public Result {
 public:
     friend class DownloadTask;
+    friend class DeltaDownloadTask;
     enum class SaveStatus {
         Success = 0,
         SavePathOpenError,
         SaveWriteError,
-        SaveError
+        SaveError,
+        SaveNoSpaceError, // 磁盘空间不足，不会重试
+        SaveChecksumError, // 校验不一致，文件已删除
+        SaveExtractError // 压缩包格式错误、不完整或不支持
     };
     bool isSuccess() override;
     QString errorMsg(const QString& customErrorMsg) override;
@@ -26,14 +36,46 @@ class NETWORK_EXPORT DownloadTask : public GetTask {
 public:
     DownloadTask(const QString& url); // 下载到缓存
     DownloadTask(const QString& url, const QString& savePath); // 下载到文件
+    ~DownloadTask();
     DownloadTask& setCalcSpeed(bool calcSpeed);
+    // 进度、速度信号的最短间隔，默认100ms，<=0时每次回调都发出。结束时总会发出最终的精确进度
+    DownloadTask& setProgressInterval(int ms);
+    // 任务自身限速，可在下载中调整。与BandwidthManager的全局、按host限速共同生效
     DownloadTask& setDownloadLimit(qint64 bytesPerSecond);
+    DownloadTask& setBandwidthWeight(int weight); // 与其他任务争用带宽时的权重，默认1
+    // 分段并发下载的连接数，默认1不分段。仅下载到文件且服务端支持Range时生效，否则回退为单连接下载。限速对所有分段合计生效
+    DownloadTask& setSegmentCount(int segmentCount);
+    // 断点续传，默认false。开启后先下载到 savePath.part，并在 savePath.part.info 中记录校验信息与已下载区间，
+    // 重试或下次下载同一url时通过 Range + If-Range 继续下载，完成后原子重命名为 savePath
+    DownloadTask& setResumeEnable(bool enable);
+    // 下载完成时的落盘策略，默认Flush。文件在独立线程写入，结果在按策略落盘后才通知
+    DownloadTask& setFlushPolicy(FileWriter::FlushPolicy policy);
+    // 内存映射写入，默认false。下载到文件且文件大小已知并预分配成功时，把文件映射到内存，数据直接从reply读入映射区；映射失败时回退为按偏移写入
+    DownloadTask& setMemoryMapEnable(bool enable);
+    // 下载到文件时边写边计算摘要，完成后与expected(十六进制或base64)比较，不一致时删除文件并返回SaveChecksumError。
+    // expected为空时从响应头Digest、x-checksum-<算法>、x-checksum、Content-MD5中读取，都没有则不校验
+    DownloadTask& setChecksum(Checksum::Algorithm algorithm, const QByteArray& expected = QByteArray());
+    // 边下载边解压到dir，压缩包本身不落盘，解压在线程池中进行，全部写入后才通知结果。
+    // 设置后不再保存到savePath，分段、续传、内存映射不生效；setChecksum校验的是压缩包数据，不一致时已解压的文件不删除
+    DownloadTask& setExtractDir(const QString& dir, ArchiveExtractor::Format format = ArchiveExtractor::Format::Auto);
+    // 数据到达即交给sink消费，按sink的isFull反压，内存占用以reply读缓冲为上限。
+    // 设置后不再保存到savePath、解压或累积到结果中，分段、续传、内存映射、setChecksum不生效
+    DownloadTask& setSink(std::shared_ptr<DownloadSink> sink);
+    // 添加同一文件的镜像地址，按调用顺序排列，url本身为第一个(权重1)。weight越大越优先，测得的延迟与吞吐相同时按权重和顺序选择。
+    // 每次请求前按MirrorRegistry中进程内共享的评分从最优的镜像开始；出错、非2xx或停滞时换下一个镜像，
+    // 下载到文件时从已写入的位置用Range继续，其他方式只在尚未收到内容时换镜像，否则走setRerequestCount重试。
+    // 换镜像续传时只核对文件大小，需要保证内容一致时配合setChecksum
+    DownloadTask& addMirror(const QString& url, int weight = 1);
+    // 超过ms没有收到数据视为停滞并换镜像，默认10s，<=0不检测。仅设置了镜像且单连接下载时生效
+    DownloadTask& setStallTimeout(int ms);
     //    DownloadTask &setThreadPoolEnable(bool enable);
+    void abort() override;
 
 public:
 signals:
     void sigDownloadProcess(qint64 bytesReceived, qint64 bytesTotal);
-    void sigDownloadSpeed(qint64 bytesReceived, qint64 ms);
+    void sigDownloadSpeed(qint64 bytesReceived, qint64 ms); // 距上一次进度的字节数与毫秒数
+    void sigDownloadRate(qint64 bytesPerSecond, qint64 remainingMs); // 滑动平均速度与预计剩余时间，未知时remainingMs为-1
 
 protected:
     QNetworkReply* execute() override;
@@ -42,28 +84,135 @@ protected:
     void getBytesFromReply(const ResultPtr& result, QNetworkReply* reply) override;
 
 protected slots:
-    void onDownloadLimitProcess();
     void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
     void onReading();
+    void onProbeFinished();
+    void onMetaDataChanged();
+    void onMirrorFinished();
+    void onStalled();
 
 private:
+    // 分段下载中的一段，[begin, end]为该段负责的字节区间
+    struct Segment {
+        qint64 begin = 0;
+        qint64 end = 0; // 包含end
+        qint64 offset = 0; // 下一个待写入的位置
+        qint64 startOffset = 0; // 本次请求开始时的offset，用于计算速度
+        qint64 startTime = 0;
+        int restartCount = 0;
+        QNetworkReply* reply = nullptr;
+    };
+
     bool isSaveToFile();
-    void readAndSaveToFile(QNetworkReply* reply, QFile* file);
+    bool isExtracting();
+    bool isSinking();
+    void readAndSaveToFile(QNetworkReply* reply, bool force);
+    qint64 readLimited(QNetworkReply* reply, qint64 maxBytes);
+    qint64 readToMemory(QNetworkReply* reply, qint64 maxBytes);
+    void reserveMemory(QNetworkReply* reply);
+    void flattenChunks();
+    void addBandwidthConsumer(QNetworkReply* reply);
+    void updateReadBufferSize(QNetworkReply* reply);
+    void removeBandwidthConsumer();
+    void onWriterReady();
+    std::function<void()> createReadyCallback();
+    void notifyProgress(const ProgressThrottle::Progress& progress);
+    void releaseAndStart();
+    void startDownload();
     bool openFile();
+    void closeFile(const ResultPtr& result);
+    bool openExtractor();
+    void readAndExtract(QNetworkReply* reply, bool force);
+    void setExtractorError();
+    void closeExtractor(const ResultPtr& result);
+    void openSink();
+    void readAndSink(QNetworkReply* reply, bool force);
+    qint64 writeSink(QNetworkReply* reply, qint64 maxBytes);
+    void finishSink(const ResultPtr& result);
+    bool isWritableReply(QNetworkReply* reply);
+    bool isContentReply(QNetworkReply* reply);
+    bool preallocateFile(QNetworkReply* reply, qint64 fileSize);
+    void mapFile(qint64 fileSize);
+    void setWriterError();
+    void updateExpectedChecksum(QNetworkReply* reply);
+    QString getFilePath();
+    QString getResumeInfoPath();
+    bool loadResumeInfo();
+    void saveResumeInfo();
+    void removeResumeInfo();
+    void updateValidator(QNetworkReply* reply);
+    QNetworkReply* startRequest();
+    void startSingleRequest();
+    void startProbe();
+    void selectMirror();
+    void useMirror(const QString& mirror);
+    QString nextMirror();
+    void failMirror(const QString& reason);
+    bool isSegmentEnable();
+    void startSegments(qint64 fileSize, int segmentCount);
+    void startSegment(Segment* segment);
+    void onSegmentReading(Segment* segment);
+    void onSegmentFinished(Segment* segment);
+    bool readSegment(Segment* segment, bool force, qint64 maxBytes = -1);
+    qint64 readSegmentsLimited(qint64 maxBytes);
+    void addSegmentsBandwidthConsumer();
+    void completeSegment(Segment* segment);
+    bool stealSegment();
+    void failSegments(QNetworkReply* reply);
+    void releaseSegmentReply(Segment* segment);
+    void notifySegmentsResult();
 
 private:
     std::shared_ptr<DownloadResult> m_result;
     QString m_savePath;
     bool m_calcSpeed = false;
     //    bool m_threadPoolEnable = true;
-    std::unique_ptr<QFile> m_file;
+    std::shared_ptr<FileWriter> m_writer;
+    FileWriter::FlushPolicy m_flushPolicy = FileWriter::FlushPolicy::Flush;
+    bool m_memoryMapEnable = false;
+    bool m_checksumEnable = false;
+    Checksum::Algorithm m_checksumAlgorithm = Checksum::Algorithm::Sha256;
+    QByteArray m_expectedChecksum; // setChecksum指定的摘要
+    QByteArray m_checksumValue; // 本次下载用于比较的摘要
+    std::shared_ptr<Checksum> m_checksum;
+    Async::Future<bool> m_closeFuture;
+    QString m_extractDir;
+    ArchiveExtractor::Format m_extractFormat = ArchiveExtractor::Format::Auto;
+    std::shared_ptr<ArchiveExtractor> m_extractor;
+    std::shared_ptr<DownloadSink> m_sink;
+    qint64 m_sinkBytes = 0; // 本次请求交给sink的字节数
     qint64 m_maxBandwidth = 0; // 下载限速 每秒字节数 bytes/秒
+    int m_bandwidthWeight = 1;
+    int m_bandwidthId = 0; // BandwidthManager中的consumer id
+    int m_segmentCount = 1;
+    std::vector<std::unique_ptr<Segment>> m_segments;
+    size_t m_segmentCursor = 0; // 限速时下一次从该分段开始读取，各连接轮流分得令牌
+
+    bool m_resumeEnable = false;
+    qint64 m_resumeOffset = 0; // 单连接续传的起始位置
+    std::vector<std::pair<qint64, qint64>> m_resumeRanges; // 上次未下载完的区间 [begin, end]
+    QByteArray m_etag;
+    QByteArray m_lastModified;
+    qint64 m_resumeSaveTime = 0;
+
+    std::vector<QByteArray> m_chunks; // 下载到内存且无法预留容量时的分块，结束时合并到m_result
+    qint64 m_chunksSize = 0;
+
+    QList<QPair<QString, int>> m_mirrors; // 镜像地址与权重，含url本身，为空时不切换
+    QString m_mirror; // 当前使用的镜像
+    QStringList m_failedMirrors; // 本次请求中已失败的镜像
+    bool m_mirrorFailed = false; // 重试前需要重新选择镜像
+    QString m_validatorMirror; // m_etag、m_lastModified来自的镜像，不同镜像的ETag可能不同
+    qint64 m_mirrorStartTime = 0; // 当前请求开始的时间，用于计算延迟
+    qint64 m_mirrorFirstByteTime = 0; // 收到响应头的时间，用于计算吞吐
+    qint64 m_mirrorBytes = 0; // 当前请求已接收的字节数
+    QTimer m_stallTimer;
+    int m_stallTimeout = 10 * 1000;
+    QString m_mirrorAbortReason; // 因停滞或内容不符主动断开当前镜像的原因
+    bool m_aborted = false;
 
     qint64 m_fileSize = 0;
-    qint64 m_receviedBytesSize = 0;
-    qint64 m_prevTime = 0;
-    qint64 m_prevReceiveBytes = 0;
-    QPointer<QTimer> m_calcProcessTimer;
+    ProgressThrottle m_progress;
 };
 }
 #endif // NETWORK_DOWNLOAD_TASK_H
@@ -0,0 +1,118 @@
+﻿#include "executor.h"
+
+using namespace Net;
+
+Executor& Executor::instance()
+{
+    static Executor myInstance;
+    return myInstance;
+}
+
+// 每道最多占用线程池最小线程数的一半，任一道积压时另一道仍有线程。
+// 每道至少1个，最小线程数为1时两道之和为2，多出的由线程池按需增加线程
+Executor::Executor()
+{
+    const int running = qMax(static_cast<int>(Async::ThreadPool::globalInstance()->minWorkerThreads()) / 2, 1);
+    setLaneLimit(Lane::Io, running, 256);
+    setLaneLimit(Lane::Compute, running, 64);
+}
+
+Executor::~Executor()
+{
+}
+
+void Executor::setThreadRange(int minCount, int maxCount)
+{
+    const int minThreads = qMax(minCount, 1);
+    Async::ThreadPool::globalInstance()->setThreadRange(minThreads, qMax(maxCount, minThreads));
+}
+
+int Executor::threadCount() const
+{
+    return static_cast<int>(Async::ThreadPool::globalInstance()->workerThreads());
+}
+
+int Executor::peakThreadCount() const
+{
+    return static_cast<int>(Async::ThreadPool::globalInstance()->peakWorkerThreads());
+}
+
+void Executor::setLaneLimit(Lane lane, int maxRunning, int maxQueued)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    auto& stats = m_lanes[static_cast<int>(lane)].stats;
+    stats.maxRunning = qMax(maxRunning, 1);
+    stats.maxQueued = qMax(maxQueued, 1);
+    dispatch(guard, lane);
+}
+
+Executor::LaneStats Executor::stats(Lane lane) const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_lanes[static_cast<int>(lane)].stats;
+}
+
+bool Executor::hasSpace(Lane lane) const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    const auto& stats = m_lanes[static_cast<int>(lane)].stats;
+    return stats.queued < stats.maxQueued;
+}
+
+void Executor::waitForSpace(Lane lane, QPointer<QObject> context, std::function<void()> callback)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    m_lanes[static_cast<int>(lane)].waiters.push_back(Waiter { context, callback });
+    dispatch(guard, lane);
+}
+
+void Executor::enqueue(Lane lane, std::function<void()> task)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    auto& info = m_lanes[static_cast<int>(lane)];
+    info.tasks.emplace_back(std::move(task));
+    info.stats.queued = static_cast<int>(info.tasks.size());
+    info.stats.peakQueued = qMax(info.stats.peakQueued, info.stats.queued);
+    dispatch(guard, lane);
+}
+
+// 在同时执行数以内把排队的任务交给线程池，再按空位唤醒等待提交的一方。回调在锁外投递
+void Executor::dispatch(std::unique_lock<std::mutex>& guard, Lane lane)
+{
+    auto& info = m_lanes[static_cast<int>(lane)];
+    std::vector<std::function<void()>> tasks;
+    while (!info.tasks.empty() && info.stats.running < info.stats.maxRunning) {
+        tasks.emplace_back(std::move(info.tasks.front()));
+        info.tasks.pop_front();
+        info.stats.running++;
+    }
+    info.stats.queued = static_cast<int>(info.tasks.size());
+
+    std::vector<Waiter> waiters;
+    const size_t space = static_cast<size_t>(qMax(info.stats.maxQueued - info.stats.queued, 0));
+    const size_t count = qMin(space, info.waiters.size());
+    waiters.assign(info.waiters.begin(), info.waiters.begin() + count);
+    info.waiters.erase(info.waiters.begin(), info.waiters.begin() + count);
+    guard.unlock();
+
+    for (auto& task : tasks) {
+        Async::ThreadPool::globalInstance()->execute([this, lane, task = std::move(task)]() {
+            task();
+            onTaskFinished(lane);
+        });
+    }
+    for (const auto& waiter : waiters) {
+        if (waiter.context) {
+            QMetaObject::invokeMethod(waiter.context.data(), waiter.callback, Qt::QueuedConnection);
+        }
+    }
+}
+
+void Executor::onTaskFinished(Lane lane)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    auto& stats = m_lanes[static_cast<int>(lane)].stats;
+    stats.running--;
+    stats.completed++;
+    dispatch(guard, lane);
+}
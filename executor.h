@@ -0,0 +1,102 @@
+﻿#ifndef NETWORK_EXECUTOR_H
+#define NETWORK_EXECUTOR_H
+
+#include "async/threadPool.h"
+#include "network_global.h"
+#include <QObject>
+#include <QPointer>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace Net {
+/*** 后台任务执行：库内所有后台工作都经由此处提交到Async::ThreadPool，按工作类别分道 ***/
+// 每条道有同时执行数上限与队列上限：同时执行数限制一类工作最多占用的线程，大量上传编码时文件写入、解压仍有线程可用；
+// 队列上限用于准入，提交方在hasSpace为false时通过waitForSpace等到有空位再提交。execute本身不拒绝，已开始的流程不会中途失败。
+// stats给出各道当前执行数、排队数与峰值，可用于监控积压
+class NETWORK_EXPORT Executor {
+public:
+    enum class Lane {
+        Io = 0, // 文件写入、解压、读取上传块、清理缓存
+        Compute, // 上传资源编码、摘要计算、增量下载的块匹配
+        Count
+    };
+    struct LaneStats {
+        int maxRunning = 0;
+        int maxQueued = 0;
+        int running = 0;
+        int queued = 0;
+        int peakQueued = 0;
+        qint64 completed = 0;
+    };
+
+    static Executor& instance();
+
+    // 线程池的线程数范围，默认为CPU核数到4倍核数，随时可设置。
+    // 排队的工作超过阈值没有被取走时增加线程，阻塞在文件读写中的线程不计入最小线程数，多出的线程空闲30秒后退出
+    void setThreadRange(int minCount, int maxCount);
+    int threadCount() const; // 当前线程数
+    int peakThreadCount() const; // 线程数峰值
+    // 默认每道同时执行数为最小线程数的一半(至少1)，队列上限Io为256、Compute为64
+    void setLaneLimit(Lane lane, int maxRunning, int maxQueued);
+    LaneStats stats(Lane lane) const;
+    bool hasSpace(Lane lane) const; // 排队数未达到队列上限
+    // 有空位时在context所在线程回调，当前已有空位时也异步回调
+    void waitForSpace(Lane lane, QPointer<QObject> context, std::function<void()> callback);
+
+    template <typename F>
+    auto execute(Lane lane, F&& f) -> Async::Future<typename std::result_of<F()>::type>;
+
+protected:
+    Executor();
+    ~Executor();
+
+    Executor(Executor const&) = delete;
+    Executor(Executor&&) = delete;
+    Executor& operator=(Executor const&) = delete;
+    Executor& operator=(Executor&&) = delete;
+
+private:
+    struct Waiter {
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+    struct LaneInfo {
+        LaneStats stats;
+        std::deque<std::function<void()>> tasks;
+        std::vector<Waiter> waiters;
+    };
+
+    void enqueue(Lane lane, std::function<void()> task);
+    void dispatch(std::unique_lock<std::mutex>& guard, Lane lane);
+    void onTaskFinished(Lane lane);
+
+private:
+    mutable std::mutex m_mutex;
+    LaneInfo m_lanes[static_cast<int>(Lane::Count)];
+};
+
+template <typename F>
+auto Executor::execute(Lane lane, F&& f) -> Async::Future<typename std::result_of<F()>::type>
+{
+    using resultType = typename std::result_of<F()>::type;
+    Async::Promise<resultType> promise;
+    auto future = promise.getFuture();
+    enqueue(lane, [func = std::forward<F>(f), pm = std::move(promise)]() mutable {
+        try {
+            if constexpr (std::is_void<resultType>::value) {
+                func();
+                pm.setValue();
+            } else {
+                pm.setValue(Async::Try<resultType>(func()));
+            }
+        } catch (...) {
+            pm.setException(std::current_exception());
+        }
+    });
+    return future;
+}
+}
+#endif // NETWORK_EXECUTOR_H
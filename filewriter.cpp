@@ -0,0 +1,398 @@
+﻿#include "filewriter.h"
+#include <QDir>
+#include <cerrno>
+#include <cstdio>
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace Net;
+static const qint64 s_blockSize = 1024 * 1024; // 合并到1M再写入
+static const qint64 s_alignment = 4096; // 按4K对齐文件偏移写入
+
+FileWriter::FileWriter(std::unique_ptr<QFile> file)
+    : m_file(std::move(file))
+    , m_queue([this](Command& command) { execute(command); })
+{
+}
+
+FileWriter::~FileWriter()
+{
+}
+
+void FileWriter::write(const QByteArray& bytes)
+{
+    write(m_pos, bytes);
+    m_pos += bytes.size();
+}
+
+void FileWriter::write(qint64 offset, const QByteArray& bytes)
+{
+    if (bytes.isEmpty()) {
+        return;
+    }
+
+    Command command;
+    command.type = Command::Type::Write;
+    command.offset = offset;
+    command.bytes = bytes;
+    enqueue(std::move(command));
+}
+
+qint64 FileWriter::write(QIODevice* device, qint64 maxSize)
+{
+    const qint64 size = write(m_pos, device, maxSize);
+    m_pos += size;
+    return size;
+}
+
+qint64 FileWriter::write(qint64 offset, QIODevice* device, qint64 maxSize)
+{
+    if (m_mapData != nullptr && offset >= 0 && offset + maxSize <= m_mapSize) {
+        const qint64 size = device->read(reinterpret_cast<char*>(m_mapData + offset), maxSize);
+        return qMax<qint64>(size, 0);
+    }
+
+    const auto& bytes = device->read(maxSize);
+    write(offset, bytes);
+    return bytes.size();
+}
+
+void FileWriter::resize(qint64 size)
+{
+    m_mapData = nullptr;
+    m_mapSize = 0;
+    m_mapEpoch++;
+    Command command;
+    command.type = Command::Type::Resize;
+    command.offset = size;
+    enqueue(std::move(command));
+}
+
+void FileWriter::preallocate(qint64 size)
+{
+    Command command;
+    command.type = Command::Type::Preallocate;
+    command.offset = size;
+    enqueue(std::move(command));
+}
+
+// 不等待写线程，映射前提交的数据照常经写线程写入
+Async::Future<bool> FileWriter::map(qint64 size)
+{
+    if (m_mapData != nullptr) {
+        return Async::makeReadyFuture(m_mapSize >= size);
+    }
+
+    auto promise = std::make_shared<Async::Promise<bool>>();
+    auto future = promise->getFuture();
+    const int epoch = m_mapEpoch;
+    post([this, size, promise, epoch](QFile* file) {
+        uchar* data = nullptr;
+        if (m_preallocated && m_fileMap == nullptr && file->flush() && file->size() >= size) {
+            data = file->map(0, size);
+        }
+        m_fileMap = data;
+        {
+            std::unique_lock<std::mutex> guard(m_mutex);
+            m_mappedData = data;
+            m_mappedSize = data != nullptr ? size : 0;
+            m_mappedEpoch = epoch;
+        }
+        promise->setValue(data != nullptr);
+        return true;
+    });
+    return future;
+}
+
+bool FileWriter::enableMap()
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    if (m_mappedData == nullptr || m_mappedEpoch != m_mapEpoch) {
+        return false;
+    }
+
+    m_mapData = m_mappedData;
+    m_mapSize = m_mappedSize;
+    return true;
+}
+
+void FileWriter::setChecksum(std::shared_ptr<Checksum> checksum)
+{
+    post([this, checksum](QFile*) {
+        m_checksum = checksum;
+        m_hashOffset = 0;
+        if (m_checksum) {
+            m_checksum->reset();
+        }
+        return true;
+    });
+}
+
+void FileWriter::hash(qint64 end)
+{
+    post([this, end](QFile*) {
+        hashFile(end);
+        return true;
+    });
+}
+
+void FileWriter::post(std::function<bool(QFile*)> func)
+{
+    Command command;
+    command.type = Command::Type::Call;
+    command.func = std::move(func);
+    enqueue(std::move(command));
+}
+
+Async::Future<bool> FileWriter::close(FlushPolicy policy, std::function<bool()> finisher)
+{
+    if (!m_queue.setClosing()) {
+        return Async::makeReadyFuture(!hasError());
+    }
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_flushPolicy = policy;
+        m_finisher = std::move(finisher);
+    }
+    m_mapData = nullptr;
+    m_mapSize = 0;
+    m_mapEpoch++;
+
+    auto future = m_queue.closedFuture();
+    Command command;
+    command.type = Command::Type::Close;
+    enqueue(std::move(command));
+    return future;
+}
+
+bool FileWriter::replace(const QString& from, const QString& to)
+{
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(from).utf16()),
+               reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(to).utf16()),
+               MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)
+        != 0;
+#else
+    return std::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+void FileWriter::enqueue(Command&& command)
+{
+    m_queue.enqueue(std::move(command), shared_from_this());
+}
+
+void FileWriter::execute(Command& command)
+{
+    switch (command.type) {
+    case Command::Type::Write:
+        if (hasError()) {
+            return;
+        }
+        if (m_checksum && command.offset == m_hashOffset) {
+            m_checksum->addData(command.bytes);
+            m_hashOffset += command.bytes.size();
+        }
+        if (!m_block.isEmpty() && command.offset == m_blockOffset + m_block.size()) {
+            m_block.append(command.bytes);
+        } else {
+            writeBlock(false);
+            m_blockOffset = command.offset;
+            m_block = std::move(command.bytes);
+        }
+        if (m_block.size() >= s_blockSize) {
+            writeBlock(true);
+        }
+        break;
+    case Command::Type::Resize:
+        writeBlock(false);
+        unmapFile();
+        m_preallocated = false;
+        if (m_checksum && command.offset < m_hashOffset) { // 已计算的部分被截掉，重新计算
+            m_checksum->reset();
+            m_hashOffset = 0;
+        }
+        if (!m_file->resize(command.offset)) {
+            setError(Error::WriteError);
+        }
+        break;
+    case Command::Type::Preallocate:
+        writeBlock(false);
+        preallocateFile(command.offset);
+        break;
+    case Command::Type::Call:
+        writeBlock(false);
+        if (!command.func(m_file.get())) {
+            setError(Error::WriteError);
+        }
+        break;
+    case Command::Type::Close:
+        writeBlock(false);
+        closeFile(m_flushPolicy);
+        break;
+    }
+}
+
+// aligned为true时只写到4K对齐的偏移处，余下部分留待与后续数据合并
+void FileWriter::writeBlock(bool aligned)
+{
+    if (m_block.isEmpty()) {
+        return;
+    }
+
+    qint64 length = m_block.size();
+    if (aligned) {
+        length = ((m_blockOffset + length) & ~(s_alignment - 1)) - m_blockOffset;
+        if (length <= 0) {
+            return;
+        }
+    }
+
+    writeAt(m_blockOffset, m_block.constData(), length);
+    m_block = m_block.mid(length);
+    m_blockOffset += length;
+}
+
+// 按偏移写入，不依赖也不改变文件的当前位置
+bool FileWriter::writeAt(qint64 offset, const char* data, qint64 length)
+{
+#ifdef Q_OS_UNIX
+    const int fd = m_file->handle();
+    while (length > 0) {
+        const ssize_t written = ::pwrite(fd, data, static_cast<size_t>(length), static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            setError(errno == ENOSPC ? Error::NoSpaceError : Error::WriteError);
+            return false;
+        }
+        data += written;
+        offset += written;
+        length -= written;
+    }
+    return true;
+#else
+    if (!m_file->seek(offset) || m_file->write(data, length) != length) {
+        setError(Error::WriteError);
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool FileWriter::preallocateFile(qint64 size)
+{
+    if (!m_file->flush()) {
+        setError(Error::WriteError);
+        return false;
+    }
+
+#if defined(Q_OS_LINUX)
+    // 不用posix_fallocate，文件系统不支持时它会逐块写0
+    if (::fallocate(m_file->handle(), 0, 0, static_cast<off_t>(size)) == 0) {
+        m_preallocated = true;
+        return true;
+    }
+    if (errno == ENOSPC) {
+        setError(Error::NoSpaceError);
+        return false;
+    }
+#elif defined(Q_OS_DARWIN)
+    const qint64 curSize = m_file->size();
+    if (size > curSize) {
+        fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, static_cast<off_t>(size - curSize), 0 };
+        if (::fcntl(m_file->handle(), F_PREALLOCATE, &store) == -1) {
+            if (errno == ENOSPC) {
+                setError(Error::NoSpaceError);
+                return false;
+            }
+        } else {
+            m_preallocated = true;
+        }
+    }
+#endif
+
+    if (m_file->size() < size && !m_file->resize(size)) {
+        setError(Error::WriteError);
+        return false;
+    }
+#ifdef Q_OS_WIN
+    m_preallocated = true; // SetEndOfFile会分配磁盘空间
+#endif
+    return true;
+}
+
+// 解除映射，映射区中的数据已在系统缓存中，之后的flush/fsync会一并落盘
+void FileWriter::unmapFile()
+{
+    if (m_fileMap != nullptr) {
+        m_file->unmap(m_fileMap);
+        m_fileMap = nullptr;
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_mappedData = nullptr;
+        m_mappedSize = 0;
+    }
+}
+
+// 读取[m_hashOffset, end)补算checksum
+void FileWriter::hashFile(qint64 end)
+{
+    if (!m_checksum || m_hashOffset >= end) {
+        return;
+    }
+    if (!m_file->flush() || !m_file->seek(m_hashOffset)) {
+        setError(Error::WriteError);
+        return;
+    }
+
+    QByteArray buffer(static_cast<int>(s_blockSize), Qt::Uninitialized);
+    while (m_hashOffset < end) {
+        const qint64 length = m_file->read(buffer.data(), qMin(s_blockSize, end - m_hashOffset));
+        if (length <= 0) {
+            setError(Error::WriteError);
+            return;
+        }
+        m_checksum->addData(buffer.constData(), length);
+        m_hashOffset += length;
+    }
+}
+
+void FileWriter::closeFile(FlushPolicy policy)
+{
+    unmapFile();
+    if (m_checksum && !hasError()) {
+        hashFile(m_file->size());
+    }
+    bool success = !hasError();
+    if (success && policy != FlushPolicy::None) {
+        success = m_file->flush();
+    }
+    if (success && policy == FlushPolicy::Sync) {
+#ifdef Q_OS_WIN
+        success = _commit(m_file->handle()) == 0;
+#else
+        success = ::fsync(m_file->handle()) == 0;
+#endif
+    }
+    if (!success) {
+        setError(Error::WriteError);
+    }
+    m_file->close();
+
+    std::function<bool()> finisher;
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        finisher = std::move(m_finisher);
+    }
+    if (success && finisher) {
+        success = finisher();
+    }
+
+    m_queue.setClosed(success);
+}
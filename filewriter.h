@@ -0,0 +1,109 @@
+﻿#ifndef NETWORK_FILE_WRITER_H
+#define NETWORK_FILE_WRITER_H
+#include "async/future.h"
+#include "checksum.h"
+#include "network_global.h"
+#include "serialqueue.h"
+#include <QFile>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace Net {
+/*** 文件写入器：在线程池中按提交顺序串行写文件，调用线程只负责入队，不被磁盘延迟阻塞 ***/
+// 命令经SerialQueue整批换出后在写线程中处理；连续的数据合并为对齐的大块再写入。
+// 队列中的数据超过上限时isFull()返回true，读端应暂停读取，降到低水位后通过readyCallback通知继续。
+// map()在写线程中映射，完成后调用线程通过enableMap()启用，之后从QIODevice写入的数据直接读到文件映射区，不再经过写线程。
+// 设置checksum后，从文件头开始连续写入的数据在写线程中边写边算，其余部分(乱序分段、映射区写入)在关闭时从文件读取补算。
+class NETWORK_EXPORT FileWriter : public std::enable_shared_from_this<FileWriter> {
+public:
+    enum class FlushPolicy {
+        None = 0, // 只关闭文件
+        Flush, // 关闭前flush到系统缓存
+        Sync // 关闭前fsync到磁盘
+    };
+    enum class Error {
+        NoError = 0,
+        WriteError,
+        NoSpaceError // 磁盘空间不足
+    };
+
+    FileWriter(std::unique_ptr<QFile> file);
+    ~FileWriter();
+
+    // 以下接口只在调用线程(网络线程)使用
+    qint64 pos() const { return m_pos; }
+    void seek(qint64 pos) { m_pos = pos; }
+    void write(const QByteArray& bytes); // 写到pos处并后移pos
+    void write(qint64 offset, const QByteArray& bytes);
+    qint64 write(QIODevice* device, qint64 maxSize); // 从device读取最多maxSize写到pos处并后移pos，返回写入的字节数
+    qint64 write(qint64 offset, QIODevice* device, qint64 maxSize);
+    void resize(qint64 size);
+    void preallocate(qint64 size); // 预分配磁盘空间并扩展到size，文件系统不支持时退化为稀疏文件
+    Async::Future<bool> map(qint64 size); // 已提交的命令执行完后在写线程中映射[0, size)，只映射已真正预分配的文件，失败为false
+    bool enableMap(); // map()成功后启用映射区写入，期间resize、close过时映射已失效，返回false
+    bool isMapped() const { return m_mapData != nullptr; }
+    void setChecksum(std::shared_ptr<Checksum> checksum); // 文件需以可读方式打开，关闭后checksum->result()为整个文件的摘要
+    void hash(qint64 end); // 从文件读取已有的[0, end)计入checksum，用于续传
+    void post(std::function<bool(QFile*)> func); // 在写线程中按顺序执行，返回false视为写入错误
+    Async::Future<bool> close(FlushPolicy policy, std::function<bool()> finisher = nullptr); // finisher在文件关闭后于写线程执行
+    bool isFull() { return m_queue.isFull(); }
+    Error error() const { return m_queue.error(); }
+    bool hasError() const { return m_queue.hasError(); }
+    bool isClosing() const { return m_queue.isClosing(); }
+    void setReadyCallback(std::function<void()> callback) { m_queue.setReadyCallback(std::move(callback)); } // 在写线程中调用
+    // 关闭完成后在写线程中调用，已关闭时立即在调用线程中调用
+    void setClosedCallback(std::function<void()> callback) { m_queue.setClosedCallback(std::move(callback)); }
+
+    static bool replace(const QString& from, const QString& to); // 用from覆盖to，同一文件系统内为原子操作
+
+private:
+    struct Command {
+        enum class Type {
+            Write,
+            Resize,
+            Preallocate,
+            Call,
+            Close
+        };
+        Type type = Type::Write;
+        qint64 offset = 0;
+        QByteArray bytes;
+        std::function<bool(QFile*)> func;
+    };
+
+    void enqueue(Command&& command);
+    void execute(Command& command);
+    void writeBlock(bool aligned);
+    bool writeAt(qint64 offset, const char* data, qint64 length);
+    bool preallocateFile(qint64 size);
+    void hashFile(qint64 end);
+    void unmapFile();
+    void setError(Error error) { m_queue.setError(error); }
+    void closeFile(FlushPolicy policy);
+
+private:
+    std::unique_ptr<QFile> m_file;
+    qint64 m_pos = 0;
+    uchar* m_mapData = nullptr; // resize、close后调用线程不再访问映射区
+    qint64 m_mapSize = 0;
+    int m_mapEpoch = 0; // resize、close时递增，早于它的映射不再启用
+
+    SerialQueue<Command, Error> m_queue;
+    std::mutex m_mutex;
+    FlushPolicy m_flushPolicy = FlushPolicy::Flush;
+    std::function<bool()> m_finisher;
+    uchar* m_mappedData = nullptr; // 写线程完成的映射，由enableMap取用
+    qint64 m_mappedSize = 0;
+    int m_mappedEpoch = -1;
+
+    // 只在写线程中访问
+    QByteArray m_block;
+    qint64 m_blockOffset = 0;
+    bool m_preallocated = false; // 磁盘空间已分配，写入映射区不会因空间不足出错
+    std::shared_ptr<Checksum> m_checksum;
+    qint64 m_hashOffset = 0; // [0, m_hashOffset)已计入checksum
+    uchar* m_fileMap = nullptr;
+};
+}
+#endif // NETWORK_FILE_WRITER_H
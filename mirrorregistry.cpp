@@ -0,0 +1,144 @@
+﻿#include "mirrorregistry.h"
+#include <QDateTime>
+#include <QUrl>
+#include <algorithm>
+#include <vector>
+
+using namespace Net;
+static const double s_alpha = 0.3; // 新样本在滑动平均中的权重
+static const qint64 s_referenceBytes = 4 * 1024 * 1024; // 按下载4M的预计耗时比较镜像
+static const qint64 s_minSampleBytes = 256 * 1024; // 数据太少时吞吐受TCP慢启动影响，不计入
+static const qint64 s_failureCooldown = 10 * 1000; // 失败后的冷却时间 单位: milliseconds
+static const int s_maxCooldownShift = 4; // 连续失败时冷却时间加倍，最多16倍
+
+MirrorRegistry& MirrorRegistry::instance()
+{
+    static MirrorRegistry myInstance;
+    return myInstance;
+}
+
+MirrorRegistry::MirrorRegistry()
+{
+}
+
+MirrorRegistry::~MirrorRegistry()
+{
+}
+
+QStringList MirrorRegistry::rank(const QList<QPair<QString, int>>& mirrors) const
+{
+    struct Candidate {
+        QString url;
+        int weight = 1;
+        int index = 0;
+        double latency = -1;
+        double transfer = -1; // 下载s_referenceBytes的耗时
+        bool coolingDown = false;
+        double cost = 0;
+    };
+
+    std::vector<Candidate> candidates;
+    std::vector<double> latencies;
+    std::vector<double> transfers;
+    const qint64 curTime = QDateTime::currentMSecsSinceEpoch();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& mirror : mirrors) {
+            Candidate candidate;
+            candidate.url = mirror.first;
+            candidate.weight = qMax(1, mirror.second);
+            candidate.index = static_cast<int>(candidates.size());
+            const auto it = m_stats.constFind(key(mirror.first));
+            if (it != m_stats.constEnd()) {
+                const Stats& stats = it.value();
+                candidate.latency = stats.latencyMs;
+                candidate.transfer = stats.bytesPerSecond > 0 ? s_referenceBytes * 1000.0 / stats.bytesPerSecond : -1;
+                candidate.coolingDown = stats.failures > 0
+                    && curTime - stats.failureTime < (s_failureCooldown << qMin(stats.failures - 1, s_maxCooldownShift));
+            }
+            if (candidate.latency >= 0) {
+                latencies.push_back(candidate.latency);
+            }
+            if (candidate.transfer >= 0) {
+                transfers.push_back(candidate.transfer);
+            }
+            candidates.push_back(candidate);
+        }
+    }
+
+    // 未测得的项按同批镜像的中位数估计，既不因未知被优先也不被冷落
+    const auto median = [](std::vector<double>& values) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    };
+    const double medianLatency = median(latencies);
+    const double medianTransfer = median(transfers);
+    for (auto& candidate : candidates) {
+        const double latency = candidate.latency >= 0 ? candidate.latency : medianLatency;
+        const double transfer = candidate.transfer >= 0 ? candidate.transfer : medianTransfer;
+        candidate.cost = (latency + transfer) / candidate.weight;
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.coolingDown != b.coolingDown) {
+            return !a.coolingDown;
+        }
+        if (a.cost != b.cost) {
+            return a.cost < b.cost;
+        }
+        if (a.weight != b.weight) {
+            return a.weight > b.weight;
+        }
+        return a.index < b.index;
+    });
+
+    QStringList urls;
+    for (const auto& candidate : candidates) {
+        urls.append(candidate.url);
+    }
+    return urls;
+}
+
+void MirrorRegistry::reportLatency(const QString& url, qint64 ms)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats& stats = m_stats[key(url)];
+    stats.latencyMs = stats.latencyMs < 0 ? ms : stats.latencyMs + s_alpha * (ms - stats.latencyMs);
+    stats.failures = 0;
+}
+
+void MirrorRegistry::reportThroughput(const QString& url, qint64 bytes, qint64 ms)
+{
+    if (bytes < s_minSampleBytes || ms <= 0) {
+        return;
+    }
+
+    const double bytesPerSecond = bytes * 1000.0 / ms;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats& stats = m_stats[key(url)];
+    stats.bytesPerSecond = stats.bytesPerSecond < 0 ? bytesPerSecond : stats.bytesPerSecond + s_alpha * (bytesPerSecond - stats.bytesPerSecond);
+}
+
+void MirrorRegistry::reportFailure(const QString& url)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats& stats = m_stats[key(url)];
+    stats.failures++;
+    stats.failureTime = QDateTime::currentMSecsSinceEpoch();
+}
+
+void MirrorRegistry::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.clear();
+}
+
+QString MirrorRegistry::key(const QString& url)
+{
+    const QUrl qurl(url);
+    const int defaultPort = qurl.scheme() == "https" ? 443 : 80;
+    return QStringLiteral("%1://%2:%3").arg(qurl.scheme()).arg(qurl.host()).arg(qurl.port(defaultPort));
+}
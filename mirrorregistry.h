@@ -0,0 +1,50 @@
+﻿#ifndef NETWORK_MIRROR_REGISTRY_H
+#define NETWORK_MIRROR_REGISTRY_H
+
+#include "network_global.h"
+#include <QHash>
+#include <QPair>
+#include <QStringList>
+#include <mutex>
+
+namespace Net {
+/*** 镜像评分：进程内所有下载任务共享的各镜像延迟、吞吐与失败记录 ***/
+// 按 scheme://host:port 统计，延迟与吞吐取指数滑动平均，数据太少的传输不计入吞吐。
+// 排序时按下载4M的预计耗时(延迟 + 4M / 吞吐)除以权重比较，未测得的项取同批已知镜像的中位数；
+// 近期失败的镜像处于冷却期(10s，连续失败时加倍，最长160s)，排在其他镜像之后。可在任意线程调用
+class NETWORK_EXPORT MirrorRegistry {
+public:
+    static MirrorRegistry& instance();
+
+    // mirrors为地址与权重，返回从优到劣排列的地址，评分相同时保持原有顺序
+    QStringList rank(const QList<QPair<QString, int>>& mirrors) const;
+    void reportLatency(const QString& url, qint64 ms); // 收到响应头的耗时，同时清除连续失败次数
+    void reportThroughput(const QString& url, qint64 bytes, qint64 ms);
+    void reportFailure(const QString& url); // 连接错误、非2xx响应或停滞
+    void clear();
+
+protected:
+    MirrorRegistry();
+    ~MirrorRegistry();
+
+    MirrorRegistry(MirrorRegistry const&) = delete;
+    MirrorRegistry(MirrorRegistry&&) = delete;
+    MirrorRegistry& operator=(MirrorRegistry const&) = delete;
+    MirrorRegistry& operator=(MirrorRegistry&&) = delete;
+
+private:
+    struct Stats {
+        double latencyMs = -1; // <0表示未知
+        double bytesPerSecond = -1;
+        int failures = 0; // 连续失败次数
+        qint64 failureTime = 0;
+    };
+
+    static QString key(const QString& url);
+
+private:
+    mutable std::mutex m_mutex;
+    QHash<QString, Stats> m_stats;
+};
+}
+#endif // NETWORK_MIRROR_REGISTRY_H
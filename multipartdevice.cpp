@@ -0,0 +1,159 @@
+﻿#include "multipartdevice.h"
+#include <QRandomGenerator>
+#include <cstring>
+
+using namespace Net;
+
+MultiPartDevice::MultiPartDevice(QObject* parent)
+    : QIODevice(parent)
+{
+    // 与QHttpMultiPart相同的形式
+    quint32 random[4];
+    QRandomGenerator::global()->fillRange(random);
+    m_boundary = "boundary_.oOo._" + QByteArray(reinterpret_cast<const char*>(random), sizeof(random)).toBase64();
+}
+
+MultiPartDevice::~MultiPartDevice()
+{
+}
+
+// --boundary\r\n headers \r\n\r\n body \r\n
+void MultiPartDevice::append(const QByteArray& headers, const QByteArray& body)
+{
+    appendSegment("--" + m_boundary + "\r\n" + headers + "\r\n\r\n" + body + "\r\n", nullptr);
+}
+
+void MultiPartDevice::append(const QByteArray& headers, QIODevice* body)
+{
+    body->setParent(this);
+    appendSegment("--" + m_boundary + "\r\n" + headers + "\r\n\r\n", nullptr);
+    appendSegment(QByteArray(), body);
+    appendSegment("\r\n", nullptr);
+}
+
+QByteArray MultiPartDevice::contentType() const
+{
+    return "multipart/form-data; boundary=\"" + m_boundary + "\"";
+}
+
+void MultiPartDevice::setPendingCallback(std::function<void()> callback)
+{
+    m_pendingCallback = callback;
+}
+
+void MultiPartDevice::grant(qint64 bytes)
+{
+    m_allowance += bytes;
+    if (m_waiting && m_allowance > 0) {
+        m_waiting = false;
+        // grant可能在读取的调用栈中发生，异步通知避免重入
+        QMetaObject::invokeMethod(
+            this, [this]() { emit readyRead(); }, Qt::QueuedConnection);
+    }
+}
+
+qint64 MultiPartDevice::pending() const
+{
+    return m_waiting ? m_size - m_pos : 0;
+}
+
+bool MultiPartDevice::open(OpenMode mode)
+{
+    if (mode != QIODevice::ReadOnly) {
+        return false;
+    }
+
+    appendSegment("--" + m_boundary + "--\r\n", nullptr);
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+bool MultiPartDevice::isSequential() const
+{
+    return false;
+}
+
+qint64 MultiPartDevice::size() const
+{
+    return m_size;
+}
+
+bool MultiPartDevice::seek(qint64 pos)
+{
+    if (pos < 0 || pos > m_size || !QIODevice::seek(pos)) {
+        return false;
+    }
+
+    m_pos = pos;
+    m_index = 0;
+    while (m_index + 1 < m_segments.size() && m_segments[m_index].offset + m_segments[m_index].size <= pos) {
+        ++m_index;
+    }
+    return true;
+}
+
+qint64 MultiPartDevice::readData(char* data, qint64 maxSize)
+{
+    if (m_pendingCallback) {
+        if (m_allowance <= 0) {
+            if (m_pos < m_size && !m_waiting) {
+                m_waiting = true;
+                m_pendingCallback();
+            }
+            return 0;
+        }
+        maxSize = qMin(maxSize, m_allowance);
+    }
+
+    qint64 bytesRead = 0;
+    while (bytesRead < maxSize && m_index < m_segments.size()) {
+        const Segment& segment = m_segments[m_index];
+        const qint64 bytes = readSegment(segment, data + bytesRead, maxSize - bytesRead);
+        if (bytes < 0) { // 文件在上传中被截断或删除
+            return bytesRead > 0 ? bytesRead : -1;
+        }
+        bytesRead += bytes;
+        m_pos += bytes;
+        if (m_pos >= segment.offset + segment.size) {
+            ++m_index;
+        }
+    }
+
+    if (m_pendingCallback) {
+        m_allowance -= bytesRead;
+    }
+    return bytesRead;
+}
+
+qint64 MultiPartDevice::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+void MultiPartDevice::appendSegment(const QByteArray& bytes, QIODevice* device)
+{
+    Segment segment;
+    segment.offset = m_size;
+    segment.size = device ? device->size() : bytes.size();
+    segment.bytes = bytes;
+    segment.device = device;
+    m_size += segment.size;
+    m_segments.push_back(segment);
+}
+
+qint64 MultiPartDevice::readSegment(const Segment& segment, char* data, qint64 maxSize)
+{
+    const qint64 offset = m_pos - segment.offset;
+    const qint64 length = qMin(maxSize, segment.size - offset);
+    if (segment.device == nullptr) {
+        std::memcpy(data, segment.bytes.constData() + offset, static_cast<size_t>(length));
+        return length;
+    }
+
+    if (segment.device->pos() != offset && !segment.device->seek(offset)) {
+        return -1;
+    }
+    const qint64 bytes = segment.device->read(data, length);
+    return bytes > 0 || length == 0 ? bytes : -1;
+}
@@ -0,0 +1,59 @@
+﻿#ifndef NETWORK_MULTI_PART_DEVICE_H
+#define NETWORK_MULTI_PART_DEVICE_H
+
+#include "network_global.h"
+#include <QIODevice>
+#include <functional>
+#include <vector>
+
+namespace Net {
+/*** multipart/form-data请求体：编码同QHttpMultiPart，发送时按需从各部分读取，读取端可以控制节奏 ***/
+// 设置pendingCallback后每次读取不超过grant放行的字节数，放行量用完时回调一次，再次grant后异步发出readyRead，
+// QNetworkAccessManager随之继续读取，以此按限速平滑地喂给socket。各部分须可随机访问，以支持重定向、认证时的reset。
+// 在所在线程使用，append须在open之前
+class NETWORK_EXPORT MultiPartDevice : public QIODevice {
+    Q_OBJECT
+public:
+    explicit MultiPartDevice(QObject* parent = nullptr);
+    ~MultiPartDevice();
+    // headers为不含结尾空行的头，如 Content-Disposition: form-data; name="key"
+    void append(const QByteArray& headers, const QByteArray& body);
+    void append(const QByteArray& headers, QIODevice* body); // 已打开且可随机访问，由本对象持有
+    QByteArray contentType() const; // multipart/form-data; boundary="..."
+
+    void setPendingCallback(std::function<void()> callback);
+    void grant(qint64 bytes);
+    qint64 pending() const; // 等待放行的剩余字节数，没有在等待时为0
+
+    bool open(OpenMode mode) override; // 追加结束分隔符，只读且不缓冲
+    bool isSequential() const override;
+    qint64 size() const override;
+    bool seek(qint64 pos) override;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    struct Segment {
+        qint64 offset = 0;
+        qint64 size = 0;
+        QByteArray bytes;
+        QIODevice* device = nullptr;
+    };
+
+    void appendSegment(const QByteArray& bytes, QIODevice* device);
+    qint64 readSegment(const Segment& segment, char* data, qint64 maxSize);
+
+private:
+    QByteArray m_boundary;
+    std::vector<Segment> m_segments;
+    qint64 m_size = 0;
+    qint64 m_pos = 0;
+    size_t m_index = 0; // m_pos所在的片段
+    qint64 m_allowance = 0; // 已放行未读取的字节数
+    bool m_waiting = false;
+    std::function<void()> m_pendingCallback;
+};
+}
+#endif // NETWORK_MULTI_PART_DEVICE_H
@@ -1,5 +1,5 @@
 QT -= gui
-QT += core network svg concurrent
+QT += core network svg
 TEMPLATE = lib
 DEFINES += NETWORK_LIBRARY
 
@@ -17,8 +17,12 @@ unix {
 }
 !isEmpty(target.path): INSTALLS += target
 
+# 边下载边解压使用zlib，Windows上使用Qt自带的zlib
+unix: LIBS += -lz
+
 HEADERS += \
     InstructionForUse.h \
+    archiveextractor.h \
     async/async.h \
     async/future.h \
     async/helper.h \
@@ -26,21 +30,45 @@ HEADERS += \
     async/sharedpromise.h \
     async/threadPool.h \
     async/try.h \
+    bandwidthmanager.h \
     cachemanager.h \
+    checksum.h \
+    chunkeduploadtask.h \
+    deltadownloadtask.h \
+    downloadmanager.h \
+    downloadsink.h \
     downloadtask.h \
+    executor.h \
+    filewriter.h \
     gettask.h \
+    mirrorregistry.h \
+    multipartdevice.h \
     network_global.h \
     posttask.h \
+    progressthrottle.h \
+    serialqueue.h \
     task.h \
     uploadtask.h \
     util.h
 
 SOURCES += \
+    archiveextractor.cpp \
     async/threadPool.cpp \
+    bandwidthmanager.cpp \
     cachemanager.cpp \
+    checksum.cpp \
+    chunkeduploadtask.cpp \
+    deltadownloadtask.cpp \
+    downloadmanager.cpp \
+    downloadsink.cpp \
     downloadtask.cpp \
+    executor.cpp \
+    filewriter.cpp \
     gettask.cpp \
+    mirrorregistry.cpp \
+    multipartdevice.cpp \
     posttask.cpp \
+    progressthrottle.cpp \
     task.cpp \
     uploadtask.cpp \
     util.cpp
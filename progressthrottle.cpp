@@ -0,0 +1,100 @@
+﻿#include "progressthrottle.h"
+#include <cmath>
+
+using namespace Net;
+static const int s_defaultInterval = 100; // 默认每秒最多10次
+static const double s_rateTimeConstant = 3000.0; // 速度平滑的时间常数 单位: milliseconds
+
+ProgressThrottle::ProgressThrottle(QObject* owner, std::function<void(const Progress&)> callback)
+    : m_timer(new QTimer(owner))
+    , m_callback(std::move(callback))
+    , m_interval(s_defaultInterval)
+{
+    m_timer->setSingleShot(true);
+    QObject::connect(m_timer, &QTimer::timeout, m_timer, [this]() {
+        flush();
+    });
+    m_elapsedTimer.start();
+}
+
+void ProgressThrottle::setInterval(int ms)
+{
+    m_interval = qMax(ms, 0);
+}
+
+void ProgressThrottle::reset(qint64 bytes)
+{
+    m_timer->stop();
+    m_elapsedTimer.restart();
+    m_lastTime = 0;
+    m_lastBytes = bytes;
+    m_bytes = bytes;
+    m_bytesTotal = -1;
+    m_pending = false;
+    m_emitted = false;
+    m_rate = -1;
+}
+
+// 本次传输的第一次更新立即发出，之后距上一次发出不足interval的合并到定时器到期时
+void ProgressThrottle::update(qint64 bytes, qint64 bytesTotal)
+{
+    m_bytes = bytes;
+    m_bytesTotal = bytesTotal;
+    m_pending = true;
+    if (m_timer->isActive()) {
+        return;
+    }
+
+    const qint64 elapsed = m_elapsedTimer.elapsed() - m_lastTime;
+    if (!m_emitted || elapsed >= m_interval) {
+        flush();
+    } else {
+        m_timer->start(static_cast<int>(m_interval - elapsed));
+    }
+}
+
+void ProgressThrottle::finish()
+{
+    flush();
+}
+
+void ProgressThrottle::finish(qint64 bytes, qint64 bytesTotal)
+{
+    m_bytes = bytes;
+    m_bytesTotal = bytesTotal;
+    m_pending = true;
+    flush();
+}
+
+// 按间隔长短加权：alpha = 1 - e^(-dt/T)，回调频率不同时平滑程度一致
+void ProgressThrottle::flush()
+{
+    m_timer->stop();
+    if (!m_pending) {
+        return;
+    }
+    m_pending = false;
+
+    const qint64 now = m_elapsedTimer.elapsed();
+    Progress progress;
+    progress.bytes = m_bytes;
+    progress.bytesTotal = m_bytesTotal;
+    progress.deltaBytes = m_bytes - m_lastBytes;
+    progress.deltaMs = now - m_lastTime;
+    if (progress.deltaMs > 0) {
+        const double rate = progress.deltaBytes * 1000.0 / progress.deltaMs;
+        const double alpha = 1.0 - std::exp(-progress.deltaMs / s_rateTimeConstant);
+        m_rate = m_rate < 0 ? rate : m_rate + alpha * (rate - m_rate);
+    }
+    progress.bytesPerSecond = m_rate > 0 ? static_cast<qint64>(m_rate) : 0;
+    if (m_bytesTotal > 0 && m_rate > 0) {
+        progress.remainingMs = static_cast<qint64>(qMax<qint64>(m_bytesTotal - m_bytes, 0) * 1000.0 / m_rate);
+    }
+
+    m_lastTime = now;
+    m_lastBytes = m_bytes;
+    m_emitted = true;
+    if (m_callback) {
+        m_callback(progress);
+    }
+}
@@ -0,0 +1,48 @@
+﻿#ifndef NETWORK_PROGRESS_THROTTLE_H
+#define NETWORK_PROGRESS_THROTTLE_H
+#include "network_global.h"
+#include <QElapsedTimer>
+#include <QTimer>
+#include <functional>
+
+namespace Net {
+/*** 进度节流：合并高频的进度回调，按最短间隔发出，并用指数滑动平均估计速度与剩余时间 ***/
+// 间隔内的多次更新只保留最新一次，在间隔结束时发出；finish立即发出最终的精确进度。
+// 定时器以owner为parent，随owner移动线程，只在owner所在线程使用。
+class NETWORK_EXPORT ProgressThrottle {
+public:
+    struct Progress {
+        qint64 bytes = 0;
+        qint64 bytesTotal = -1;
+        qint64 deltaBytes = 0; // 距上一次发出的字节数
+        qint64 deltaMs = 0; // 距上一次发出的毫秒数
+        qint64 bytesPerSecond = 0; // 滑动平均速度
+        qint64 remainingMs = -1; // 预计剩余时间，总大小或速度未知时为-1
+    };
+
+    ProgressThrottle(QObject* owner, std::function<void(const Progress&)> callback);
+    void setInterval(int ms); // 最短发出间隔，<=0时每次更新都发出
+    int interval() const { return m_interval; }
+    void reset(qint64 bytes = 0); // 开始一次新的传输，bytes为起始位置(续传时不为0)
+    void update(qint64 bytes, qint64 bytesTotal);
+    void finish(); // 立即发出尚未发出的最新进度
+    void finish(qint64 bytes, qint64 bytesTotal);
+
+private:
+    void flush();
+
+private:
+    QTimer* m_timer;
+    std::function<void(const Progress&)> m_callback;
+    int m_interval;
+    QElapsedTimer m_elapsedTimer;
+    qint64 m_lastTime = 0; // 上一次发出的时刻
+    qint64 m_lastBytes = 0;
+    qint64 m_bytes = 0;
+    qint64 m_bytesTotal = -1;
+    bool m_pending = false;
+    bool m_emitted = false; // 本次传输是否已发出过
+    double m_rate = -1; // 每秒字节数，-1表示还没有样本
+};
+}
+#endif // NETWORK_PROGRESS_THROTTLE_H
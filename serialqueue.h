@@ -0,0 +1,205 @@
+﻿#ifndef NETWORK_SERIAL_QUEUE_H
+#define NETWORK_SERIAL_QUEUE_H
+#include "async/future.h"
+#include "executor.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Net {
+/*** 串行队列：调用线程只负责入队，命令在Executor的Io道中按提交顺序串行执行，FileWriter、ArchiveExtractor共用 ***/
+// 每次drain只处理一批命令，之后有新命令时重新排到Io道末尾，让出执行位：同时写入的队列多于Io道的同时执行数时也能轮流执行。
+// 队列中的数据超过上限时isFull()返回true，读端应暂停读取，降到低水位后通过readyCallback通知继续。
+// Command需有QByteArray类型的bytes成员，按其大小计入队列；Error为以NoError = 0开头的枚举，只记录第一个错误。
+template <typename Command, typename Error>
+class SerialQueue {
+public:
+    explicit SerialQueue(std::function<void(Command&)> handler); // handler在执行线程中逐条处理命令
+
+    // holder在命令执行期间保持队列的所有者存活
+    void enqueue(Command&& command, std::shared_ptr<void> holder);
+    bool isFull();
+    bool isClosing() const;
+    bool setClosing(); // 已在关闭中返回false
+    Async::Future<bool> closedFuture(); // setClosing成功后取一次
+    void setClosed(bool success); // 在执行线程中调用，之后调用closedCallback
+    void setReadyCallback(std::function<void()> callback); // 在执行线程中调用
+    void setClosedCallback(std::function<void()> callback); // 关闭完成后在执行线程中调用，已关闭时立即在调用线程中调用
+    Error error() const { return m_error; }
+    bool hasError() const { return m_error != Error::NoError; }
+    void setError(Error error);
+
+private:
+    void schedule(std::shared_ptr<void> holder);
+    void drain(std::shared_ptr<void> holder);
+
+private:
+    static constexpr qint64 s_maxPendingBytes = 32 * 1024 * 1024; // 队列上限32M，超过后读端暂停
+    static constexpr qint64 s_lowPendingBytes = 8 * 1024 * 1024; // 降到8M以下通知读端继续
+
+    std::function<void(Command&)> m_handler;
+    std::atomic<Error> m_error { Error::NoError };
+
+    mutable std::mutex m_mutex;
+    std::vector<Command> m_commands;
+    qint64 m_pendingBytes = 0;
+    bool m_scheduled = false;
+    bool m_waitingReady = false;
+    bool m_closing = false;
+    bool m_closed = false;
+    std::function<void()> m_readyCallback;
+    std::function<void()> m_closedCallback;
+    Async::Promise<bool> m_closePromise;
+};
+
+template <typename Command, typename Error>
+SerialQueue<Command, Error>::SerialQueue(std::function<void(Command&)> handler)
+    : m_handler(std::move(handler))
+{
+}
+
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::enqueue(Command&& command, std::shared_ptr<void> holder)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    m_pendingBytes += command.bytes.size();
+    m_commands.emplace_back(std::move(command));
+    if (m_scheduled) {
+        return;
+    }
+
+    m_scheduled = true;
+    guard.unlock();
+    schedule(std::move(holder));
+}
+
+template <typename Command, typename Error>
+bool SerialQueue<Command, Error>::isFull()
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    if (m_pendingBytes < s_maxPendingBytes) {
+        return false;
+    }
+
+    m_waitingReady = true;
+    return true;
+}
+
+template <typename Command, typename Error>
+bool SerialQueue<Command, Error>::isClosing() const
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    return m_closing;
+}
+
+template <typename Command, typename Error>
+bool SerialQueue<Command, Error>::setClosing()
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    if (m_closing) {
+        return false;
+    }
+
+    m_closing = true;
+    return true;
+}
+
+template <typename Command, typename Error>
+Async::Future<bool> SerialQueue<Command, Error>::closedFuture()
+{
+    return m_closePromise.getFuture();
+}
+
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::setClosed(bool success)
+{
+    std::function<void()> closedCallback;
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_closed = true;
+        closedCallback = std::move(m_closedCallback);
+    }
+    m_closePromise.setValue(success);
+    if (closedCallback) {
+        closedCallback();
+    }
+}
+
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::setReadyCallback(std::function<void()> callback)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    m_readyCallback = std::move(callback);
+}
+
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::setClosedCallback(std::function<void()> callback)
+{
+    std::unique_lock<std::mutex> guard(m_mutex);
+    if (!m_closed) {
+        m_closedCallback = std::move(callback);
+        return;
+    }
+    guard.unlock();
+    if (callback) {
+        callback();
+    }
+}
+
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::setError(Error error)
+{
+    Error expected = Error::NoError;
+    m_error.compare_exchange_strong(expected, error);
+}
+
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::schedule(std::shared_ptr<void> holder)
+{
+    Executor::instance().execute(Executor::Lane::Io, [this, holder = std::move(holder)]() mutable {
+        drain(std::move(holder));
+    });
+}
+
+// 同一时刻只有一个drain在执行或排队，保证按提交顺序处理
+template <typename Command, typename Error>
+void SerialQueue<Command, Error>::drain(std::shared_ptr<void> holder)
+{
+    std::vector<Command> commands;
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        commands.swap(m_commands);
+    }
+
+    qint64 bytes = 0;
+    {
+        Async::ThreadPool::BlockingRegion blocking; // 写盘与fsync可能长时间阻塞
+        for (auto& command : commands) {
+            bytes += command.bytes.size();
+            m_handler(command);
+        }
+    }
+
+    std::function<void()> readyCallback;
+    bool more = false;
+    {
+        std::unique_lock<std::mutex> guard(m_mutex);
+        m_pendingBytes -= bytes;
+        if (m_waitingReady && m_pendingBytes < s_lowPendingBytes) {
+            m_waitingReady = false;
+            readyCallback = m_readyCallback;
+        }
+        more = !m_commands.empty();
+        m_scheduled = more;
+    }
+    if (readyCallback) {
+        readyCallback();
+    }
+    if (more) {
+        schedule(std::move(holder));
+    }
+}
+}
+#endif // NETWORK_SERIAL_QUEUE_H
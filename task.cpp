@@ -135,7 +135,12 @@ void Task::notifyResult(const ResultPtr& result)
 
 void Task::onCopeSslErrors(const QList<QSslError>& errors)
 {
-    if (m_networkReply == nullptr) {
+    // 分段下载等一个任务对应多个reply时，以发出信号的reply为准
+    auto reply = qobject_cast<QNetworkReply*>(sender());
+    if (reply == nullptr) {
+        reply = m_networkReply;
+    }
+    if (reply == nullptr) {
         return;
     }
     static QSet<QSslError::SslError> whiteListErrors;
@@ -151,7 +156,7 @@ void Task::onCopeSslErrors(const QList<QSslError>& errors)
 
     QSet<QSslError::SslError> unexpectedSslErrors = occuredErrors - whiteListErrors;
     if (unexpectedSslErrors.isEmpty()) {
-        m_networkReply->ignoreSslErrors();
+        reply->ignoreSslErrors();
     } else {
         emit sigSslErrors(errors);
     }
@@ -318,15 +323,3 @@ void Task::setAbortWhenTimeout()
         });
     }
 }
-
-Runnable::Runnable(std::function<void()> func)
-    : m_func(func)
-{
-}
-
-void Runnable::run()
-{
-    if (m_func) {
-        m_func();
-    }
-}
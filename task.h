@@ -10,7 +10,6 @@
 #include <QNetworkRequest>
 #include <QObject>
 #include <QPointer>
-#include <QRunnable>
 
 namespace Net {
 class Result;
@@ -25,7 +24,10 @@ public:
     friend class Task;
     friend class GetTask;
     friend class PostTask;
+    friend class ChunkedUploadTask;
+    friend class UploadTask;
     friend class DownloadTask;
+    friend class DeltaDownloadTask;
     friend class Util;
     enum class RequestStatus {
         Success = 0,
@@ -74,7 +76,7 @@ public:
     Task& setTimeout(int timeout); // 单位: milliseconds
     Task& setCacheEnable(bool enable);
     Task& setSignEnable(bool enable);
-    void abort();
+    virtual void abort();
     void retry();
     Async::Future<ResultPtr> run();
     void run(QPointer<QObject> caller, std::function<void(ResultPtr)> completeCallback);
@@ -129,14 +131,5 @@ protected:
     bool m_signEnable = true;
     QAtomicInteger<qint64> m_taskId = 0;
 };
-
-class Runnable : public QRunnable {
-public:
-    Runnable(std::function<void()> func);
-    void run() override;
-
-private:
-    std::function<void()> m_func;
-};
 }
 #endif // NETWORK_TASK_H
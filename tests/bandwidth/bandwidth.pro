@@ -0,0 +1,5 @@
+TARGET = tst_bandwidth
+TEMPLATE = app
+include(../shared/shared.pri)
+
+SOURCES += tst_bandwidth.cpp
@@ -0,0 +1,152 @@
+﻿#include "bandwidthmanager.h"
+#include "downloadtask.h"
+#include "localhttpserver.h"
+#include "testutil.h"
+#include "util.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+using namespace Net;
+static const qint64 s_kb = 1024;
+static const double s_tolerance = 0.15; // 实际速率与限速的允许偏差
+
+/*** 限速精度：本地服务端不限速发送，测量下载任务实际达到的速率 ***/
+// 令牌桶最多积累1/4秒的令牌，开始时会有突发，速率从下载到measureFrom之后开始测量
+class TestBandwidth : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanup();
+    void taskLimit();
+    void hostLimit();
+    void segmentedLimitChanged();
+
+private:
+    ResultPtr download(const std::shared_ptr<DownloadTask>& task, qint64 measureFrom, double* bytesPerSecond,
+        std::function<void(qint64)> onProgress = nullptr);
+    static QByteArray createData(int size);
+
+private:
+    LocalHttpServer m_server;
+    QTemporaryDir m_dir;
+    QByteArray m_data;
+    int m_rangeRequests = 0;
+};
+
+void TestBandwidth::initTestCase()
+{
+    QVERIFY(m_server.start());
+    QVERIFY(m_dir.isValid());
+    m_server.setHandler([this](const LocalHttpServer::Request& request) {
+        if (request.method == "GET" && !request.header("Range").isEmpty()) {
+            ++m_rangeRequests;
+        }
+        return LocalHttpServer::serveFile(request, m_data);
+    });
+}
+
+void TestBandwidth::cleanup()
+{
+    BandwidthManager::instance().setGlobalLimit(BandwidthManager::Direction::Download, 0);
+    BandwidthManager::instance().setHostLimit(BandwidthManager::Direction::Download, QStringLiteral("127.0.0.1"), 0);
+    m_rangeRequests = 0;
+}
+
+void TestBandwidth::taskLimit()
+{
+    const qint64 limit = 256 * s_kb;
+    m_data = createData(1024 * s_kb);
+    auto task = Util::instance().getDownloadTask(m_server.url("/file"));
+    task->setDownloadLimit(limit);
+
+    double rate = 0;
+    const auto result = download(task, m_data.size() / 4, &rate);
+    QVERIFY(result->isSuccess());
+    QCOMPARE(result->getBytesData(), m_data);
+    QVERIFY2(qAbs(rate - limit) <= limit * s_tolerance, qPrintable(QStringLiteral("rate: %1").arg(rate)));
+}
+
+void TestBandwidth::hostLimit()
+{
+    const qint64 limit = 256 * s_kb;
+    m_data = createData(1024 * s_kb);
+    BandwidthManager::instance().setHostLimit(BandwidthManager::Direction::Download, QStringLiteral("127.0.0.1"), limit);
+    auto task = Util::instance().getDownloadTask(m_server.url("/file"));
+
+    double rate = 0;
+    const auto result = download(task, m_data.size() / 4, &rate);
+    QVERIFY(result->isSuccess());
+    QCOMPARE(result->getBytesData(), m_data);
+    QVERIFY2(qAbs(rate - limit) <= limit * s_tolerance, qPrintable(QStringLiteral("rate: %1").arg(rate)));
+}
+
+// 分段下载中调低限速，所有分段合计的速率随之下降
+void TestBandwidth::segmentedLimitChanged()
+{
+    const qint64 limit = 1024 * s_kb;
+    m_data = createData(4096 * s_kb);
+    const QString savePath = m_dir.filePath(QStringLiteral("segmented.bin"));
+    auto task = Util::instance().getDownloadTask(m_server.url("/file"), savePath);
+    task->setSegmentCount(4).setDownloadLimit(limit * 4);
+
+    double rate = 0;
+    bool changed = false;
+    const auto result = download(task, m_data.size() / 2, &rate, [&](qint64 bytesReceived) {
+        if (!changed && bytesReceived >= m_data.size() / 4) {
+            changed = true;
+            task->setDownloadLimit(limit);
+        }
+    });
+    QVERIFY(result->isSuccess());
+    QVERIFY(changed);
+    QVERIFY(m_rangeRequests >= 2);
+    QVERIFY2(qAbs(rate - limit) <= limit * s_tolerance, qPrintable(QStringLiteral("rate: %1").arg(rate)));
+
+    QFile file(savePath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), m_data);
+}
+
+// 从收到measureFrom字节起到结束的平均速率
+ResultPtr TestBandwidth::download(const std::shared_ptr<DownloadTask>& task, qint64 measureFrom, double* bytesPerSecond,
+    std::function<void(qint64)> onProgress)
+{
+    QElapsedTimer timer;
+    qint64 beginMs = -1;
+    qint64 beginBytes = 0;
+    qint64 endMs = 0;
+    qint64 endBytes = 0;
+    const auto connection = connect(task.get(), &DownloadTask::sigDownloadProcess, this, [&](qint64 bytesReceived, qint64) {
+        if (onProgress) {
+            onProgress(bytesReceived);
+        }
+        if (beginMs < 0 && bytesReceived >= measureFrom) {
+            beginMs = timer.elapsed();
+            beginBytes = bytesReceived;
+        }
+        endMs = timer.elapsed();
+        endBytes = bytesReceived;
+    });
+
+    timer.start();
+    task->setTimeout(60 * 1000);
+    const auto result = waitForResult(task, 60 * 1000);
+    disconnect(connection);
+
+    *bytesPerSecond = endMs > beginMs && beginMs >= 0 ? (endBytes - beginBytes) * 1000.0 / (endMs - beginMs) : 0;
+    return result;
+}
+
+QByteArray TestBandwidth::createData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        data[i] = static_cast<char>((i * 131 + i / 4096) & 0xFF);
+    }
+    return data;
+}
+
+QTEST_GUILESS_MAIN(TestBandwidth)
+#include "tst_bandwidth.moc"
@@ -0,0 +1,5 @@
+TARGET = tst_chunkedupload
+TEMPLATE = app
+include(../shared/shared.pri)
+
+SOURCES += tst_chunkedupload.cpp
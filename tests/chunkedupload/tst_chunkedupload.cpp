@@ -0,0 +1,187 @@
+﻿#include "chunkeduploadtask.h"
+#include "localhttpserver.h"
+#include "testutil.h"
+#include "util.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QtTest>
+
+using namespace Net;
+static const qint64 s_chunkSize = 64 * 1024;
+static const int s_fileSize = 10 * s_chunkSize + 1234;
+
+/*** tus断点续传：本地服务端模拟tus 1.0的creation与checksum扩展，中途失败后新任务从服务端确认的偏移继续上传 ***/
+class TestChunkedUpload : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void init();
+    void resumeAfterFailure();
+    void recreateWhenExpired();
+
+private:
+    std::shared_ptr<ChunkedUploadTask> createTask();
+    LocalHttpServer::Response handle(const LocalHttpServer::Request& request);
+
+private:
+    LocalHttpServer m_server;
+    QTemporaryDir m_dir;
+    QByteArray m_data;
+    QString m_filePath;
+    QString m_statePath;
+
+    // 服务端状态
+    bool m_created = false;
+    QByteArray m_stored; // 已确认的内容
+    int m_createRequests = 0;
+    int m_headRequests = 0;
+    int m_patchRequests = 0;
+    qint64 m_patchedBytes = 0; // 所有PATCH请求接受的字节数
+    int m_failAfterPatches = -1; // 接受这么多次PATCH后返回500，<0时不失败
+};
+
+void TestChunkedUpload::initTestCase()
+{
+    QVERIFY(m_server.start());
+    QVERIFY(m_dir.isValid());
+    m_server.setHandler([this](const LocalHttpServer::Request& request) { return handle(request); });
+
+    m_data.resize(s_fileSize);
+    for (int i = 0; i < m_data.size(); ++i) {
+        m_data[i] = static_cast<char>((i * 7 + i / 1000) & 0xFF);
+    }
+    m_filePath = m_dir.filePath(QStringLiteral("upload.bin"));
+    QFile file(m_filePath);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QVERIFY(file.write(m_data) == m_data.size());
+    file.close();
+    m_statePath = m_dir.filePath(QStringLiteral("upload.state.json"));
+}
+
+void TestChunkedUpload::init()
+{
+    QFile::remove(m_statePath);
+    m_created = false;
+    m_stored.clear();
+    m_createRequests = 0;
+    m_headRequests = 0;
+    m_patchRequests = 0;
+    m_patchedBytes = 0;
+    m_failAfterPatches = -1;
+}
+
+// 第一个任务上传4块后服务端出错，状态文件中留下上传地址；新任务HEAD查询偏移后只上传剩余部分
+void TestChunkedUpload::resumeAfterFailure()
+{
+    m_failAfterPatches = 4;
+    const auto failed = waitForResult(createTask(), 30 * 1000);
+    QVERIFY(!failed->isSuccess());
+    QCOMPARE(m_createRequests, 1);
+    QCOMPARE(m_stored.size(), static_cast<int>(4 * s_chunkSize));
+    QVERIFY(QFile::exists(m_statePath));
+
+    m_failAfterPatches = -1;
+    const int patchRequests = m_patchRequests;
+    auto task = createTask();
+    const auto result = waitForResult(task, 30 * 1000);
+    QVERIFY(result->isSuccess());
+    QCOMPARE(m_createRequests, 1);
+    QCOMPARE(m_headRequests, 1);
+    QCOMPARE(m_patchRequests - patchRequests, 7);
+    QCOMPARE(m_patchedBytes, static_cast<qint64>(s_fileSize));
+    QCOMPARE(m_stored, m_data);
+    QCOMPARE(task->uploadUrl(), m_server.url("/files/1"));
+    QVERIFY(!QFile::exists(m_statePath));
+}
+
+// 服务端已删除记录的上传时重新创建并从头上传
+void TestChunkedUpload::recreateWhenExpired()
+{
+    m_failAfterPatches = 2;
+    QVERIFY(!waitForResult(createTask(), 30 * 1000)->isSuccess());
+    QVERIFY(QFile::exists(m_statePath));
+
+    m_failAfterPatches = -1;
+    m_created = false;
+    m_stored.clear();
+    m_patchedBytes = 0;
+    const auto result = waitForResult(createTask(), 30 * 1000);
+    QVERIFY(result->isSuccess());
+    QCOMPARE(m_createRequests, 2);
+    QCOMPARE(m_headRequests, 1);
+    QCOMPARE(m_patchedBytes, static_cast<qint64>(s_fileSize));
+    QCOMPARE(m_stored, m_data);
+    QVERIFY(!QFile::exists(m_statePath));
+}
+
+// 单块不重传、任务不重试，出错即失败
+std::shared_ptr<ChunkedUploadTask> TestChunkedUpload::createTask()
+{
+    auto task = Util::instance().getChunkedUploadTask(m_server.url("/files"), QJsonObject { { "type", "test" } }, m_filePath);
+    task->setChunkSize(s_chunkSize).setChunkRetryCount(0).setStatePath(m_statePath);
+    task->setRerequestCount(0).setTimeout(30 * 1000);
+    return task;
+}
+
+// POST /files创建上传，HEAD /files/1查询偏移，PATCH /files/1在偏移处追加并校验sha1
+LocalHttpServer::Response TestChunkedUpload::handle(const LocalHttpServer::Request& request)
+{
+    LocalHttpServer::Response response;
+    response.headers.append(LocalHttpServer::Header("Tus-Resumable", "1.0.0"));
+    if (request.method == "POST" && request.path == "/files") {
+        ++m_createRequests;
+        if (request.header("Upload-Length").toInt() != s_fileSize || !request.header("Upload-Metadata").contains("filename ")) {
+            response.status = 400;
+            return response;
+        }
+        m_created = true;
+        m_stored.clear();
+        response.status = 201;
+        response.headers.append(LocalHttpServer::Header("Location", "/files/1"));
+        return response;
+    }
+    if (request.method == "HEAD") {
+        ++m_headRequests;
+    }
+    if (request.path != "/files/1" || !m_created) {
+        response.status = 404;
+        return response;
+    }
+
+    if (request.method == "HEAD") {
+        response.headers.append(LocalHttpServer::Header("Upload-Offset", QByteArray::number(m_stored.size())));
+        response.headers.append(LocalHttpServer::Header("Upload-Length", QByteArray::number(s_fileSize)));
+        response.headers.append(LocalHttpServer::Header("Cache-Control", "no-store"));
+        return response;
+    }
+    if (request.method != "PATCH") {
+        response.status = 405;
+        return response;
+    }
+
+    ++m_patchRequests;
+    if (request.header("Upload-Offset").toInt() != m_stored.size()) {
+        response.status = 409;
+        return response;
+    }
+    if (m_failAfterPatches >= 0 && m_patchRequests > m_failAfterPatches) {
+        response.status = 500;
+        return response;
+    }
+    const QByteArray expected = "sha1 " + QCryptographicHash::hash(request.body, QCryptographicHash::Sha1).toBase64();
+    if (request.header("Upload-Checksum") != expected) {
+        response.status = 460;
+        return response;
+    }
+
+    m_stored += request.body;
+    m_patchedBytes += request.body.size();
+    response.status = 204;
+    response.headers.append(LocalHttpServer::Header("Upload-Offset", QByteArray::number(m_stored.size())));
+    return response;
+}
+
+QTEST_GUILESS_MAIN(TestChunkedUpload)
+#include "tst_chunkedupload.moc"
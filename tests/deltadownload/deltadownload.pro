@@ -0,0 +1,5 @@
+TARGET = tst_deltadownload
+TEMPLATE = app
+include(../shared/shared.pri)
+
+SOURCES += tst_deltadownload.cpp
@@ -0,0 +1,177 @@
+﻿#include "deltadownloadtask.h"
+#include "localhttpserver.h"
+#include "testutil.h"
+#include "util.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+using namespace Net;
+static const int s_blockSize = 2048;
+static const int s_fileSize = 1024 * 1024;
+static const int s_changeCount = 40; // 多于一个请求的区间数上限(32)，需要分两次请求
+
+/*** 增量下载：本地静态文件服务端提供新版本与zsync清单，检查只下载变化的块并正确拼出新文件 ***/
+class TestDeltaDownload : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void init();
+    void assembleFromSeed();
+    void seedUpToDate();
+    void fallbackWithoutSeed();
+
+private:
+    ResultPtr download(const QString& savePath);
+    static QByteArray createManifest(const QByteArray& data);
+
+private:
+    LocalHttpServer m_server;
+    QTemporaryDir m_dir;
+    QByteArray m_oldData;
+    QByteArray m_newData;
+    QByteArray m_manifest;
+    QList<QByteArray> m_ranges; // 各Range请求的Range头
+    qint64 m_sentBytes = 0; // 新版本文件的响应体字节数
+};
+
+void TestDeltaDownload::initTestCase()
+{
+    QVERIFY(m_server.start());
+    QVERIFY(m_dir.isValid());
+
+    // 旧版本为伪随机数据，避免无关位置的块碰巧匹配
+    m_oldData.resize(s_fileSize);
+    quint32 seed = 12345;
+    for (int i = 0; i < m_oldData.size(); ++i) {
+        seed = seed * 1103515245u + 12345u;
+        m_oldData[i] = static_cast<char>(seed >> 24);
+    }
+
+    // 新版本：分散修改若干处，并在中间插入一段使之后的块整体偏移
+    m_newData = m_oldData;
+    for (int i = 0; i < s_changeCount; ++i) {
+        const int pos = (i * 2 + 1) * (s_fileSize / (s_changeCount * 2));
+        m_newData[pos] = static_cast<char>(~m_newData[pos]);
+    }
+    m_newData.insert(s_fileSize / 2 + 17, QByteArray(777, 'x'));
+    m_manifest = createManifest(m_newData);
+
+    m_server.setHandler([this](const LocalHttpServer::Request& request) {
+        if (request.path == "/pkg.bin.zsync") {
+            return LocalHttpServer::serveFile(request, m_manifest);
+        }
+        if (request.path != "/pkg.bin") {
+            LocalHttpServer::Response response;
+            response.status = 404;
+            return response;
+        }
+
+        const auto response = LocalHttpServer::serveFile(request, m_newData);
+        if (request.method == "GET") {
+            if (!request.header("Range").isEmpty()) {
+                m_ranges.append(request.header("Range"));
+            }
+            m_sentBytes += response.body.size();
+        }
+        return response;
+    });
+}
+
+void TestDeltaDownload::init()
+{
+    m_ranges.clear();
+    m_sentBytes = 0;
+}
+
+// 变化的块合并为区间，超过单个请求的区间数时分多次请求，multipart/byteranges按偏移写入
+void TestDeltaDownload::assembleFromSeed()
+{
+    const QString savePath = m_dir.filePath(QStringLiteral("assemble.bin"));
+    QFile seed(savePath);
+    QVERIFY(seed.open(QIODevice::WriteOnly));
+    QVERIFY(seed.write(m_oldData) == m_oldData.size());
+    seed.close();
+
+    const auto result = download(savePath);
+    QVERIFY(result->isSuccess());
+    QCOMPARE(m_ranges.size(), 2);
+    QVERIFY(m_ranges.first().contains(','));
+    QVERIFY2(m_sentBytes < m_newData.size() / 4, qPrintable(QStringLiteral("sent bytes: %1").arg(m_sentBytes)));
+
+    QFile file(savePath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), m_newData);
+    QVERIFY(!QFile::exists(savePath + QStringLiteral(".delta.part")));
+}
+
+// 旧文件已是最新版本时不发Range请求
+void TestDeltaDownload::seedUpToDate()
+{
+    const QString savePath = m_dir.filePath(QStringLiteral("uptodate.bin"));
+    QFile seed(savePath);
+    QVERIFY(seed.open(QIODevice::WriteOnly));
+    QVERIFY(seed.write(m_newData) == m_newData.size());
+    seed.close();
+
+    const auto result = download(savePath);
+    QVERIFY(result->isSuccess());
+    QVERIFY(m_ranges.isEmpty());
+    QCOMPARE(m_sentBytes, static_cast<qint64>(0));
+
+    QFile file(savePath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), m_newData);
+}
+
+// 没有旧文件时回退为完整下载
+void TestDeltaDownload::fallbackWithoutSeed()
+{
+    const QString savePath = m_dir.filePath(QStringLiteral("fallback.bin"));
+    QFile::remove(savePath);
+
+    const auto result = download(savePath);
+    QVERIFY(result->isSuccess());
+    QVERIFY(m_sentBytes >= m_newData.size());
+
+    QFile file(savePath);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), m_newData);
+}
+
+ResultPtr TestDeltaDownload::download(const QString& savePath)
+{
+    return waitForResult(Util::instance().getDeltaDownloadTask(m_server.url("/pkg.bin"), savePath), 30 * 1000);
+}
+
+// 与zsyncmake相同的格式：每块4字节rsum(a、b各2字节大端)与16字节MD4，最后一块按0补齐
+QByteArray TestDeltaDownload::createManifest(const QByteArray& data)
+{
+    QByteArray manifest;
+    manifest += "zsync: 0.6.2\n";
+    manifest += "Filename: pkg.bin\n";
+    manifest += "Blocksize: " + QByteArray::number(s_blockSize) + "\n";
+    manifest += "Length: " + QByteArray::number(static_cast<qint64>(data.size())) + "\n";
+    manifest += "Hash-Lengths: 1,4,16\n";
+    manifest += "URL: pkg.bin\n";
+    manifest += "SHA-1: " + QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex() + "\n\n";
+    for (int offset = 0; offset < data.size(); offset += s_blockSize) {
+        QByteArray block = data.mid(offset, s_blockSize);
+        block.append(QByteArray(s_blockSize - block.size(), 0));
+        quint16 a = 0;
+        quint16 b = 0;
+        for (int i = 0; i < s_blockSize; ++i) {
+            const quint32 c = static_cast<uchar>(block[i]);
+            a = static_cast<quint16>(a + c);
+            b = static_cast<quint16>(b + (s_blockSize - i) * c);
+        }
+        manifest.append(static_cast<char>(a >> 8)).append(static_cast<char>(a & 0xFF));
+        manifest.append(static_cast<char>(b >> 8)).append(static_cast<char>(b & 0xFF));
+        manifest += QCryptographicHash::hash(block, QCryptographicHash::Md4);
+    }
+    return manifest;
+}
+
+QTEST_GUILESS_MAIN(TestDeltaDownload)
+#include "tst_deltadownload.moc"
@@ -0,0 +1,5 @@
+TARGET = tst_filewriter
+TEMPLATE = app
+include(../shared/shared.pri)
+
+SOURCES += tst_filewriter.cpp
@@ -0,0 +1,142 @@
+﻿#include "filewriter.h"
+#include <QBuffer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+using namespace Net;
+static const int s_segmentCount = 4;
+static const qint64 s_fileSize = 64 * 1024 * 1024;
+static const qint64 s_chunkSize = 64 * 1024; // 一次readyRead大约读到的数据量
+
+/*** FileWriter：内存映射写入与按偏移写入的结果一致，并与直接QFile::write对比耗时 ***/
+// 模拟分段下载：各分段轮流写入自己区间内的下一块
+class TestFileWriter : public QObject {
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void mappedWrite();
+    void queuedWrite();
+    void benchmarkQFileWrite();
+    void benchmarkQueuedWrite();
+    void benchmarkMappedWrite();
+
+private:
+    enum class Mode {
+        QFileWrite,
+        Queued,
+        Mapped
+    };
+    bool writeFile(const QString& path, Mode mode);
+    bool verifyFile(const QString& path);
+
+private:
+    QTemporaryDir m_dir;
+    QByteArray m_data;
+};
+
+void TestFileWriter::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_data.resize(static_cast<int>(s_fileSize));
+    for (int i = 0; i < m_data.size(); ++i) {
+        m_data[i] = static_cast<char>((i * 31 + i / 65536) & 0xFF);
+    }
+}
+
+void TestFileWriter::mappedWrite()
+{
+    const QString path = m_dir.filePath(QStringLiteral("mapped.bin"));
+    if (!writeFile(path, Mode::Mapped)) {
+        QSKIP("file system does not support preallocation or mapping");
+    }
+    QVERIFY(verifyFile(path));
+}
+
+void TestFileWriter::queuedWrite()
+{
+    const QString path = m_dir.filePath(QStringLiteral("queued.bin"));
+    QVERIFY(writeFile(path, Mode::Queued));
+    QVERIFY(verifyFile(path));
+}
+
+void TestFileWriter::benchmarkQFileWrite()
+{
+    const QString path = m_dir.filePath(QStringLiteral("bench_qfile.bin"));
+    QBENCHMARK {
+        QVERIFY(writeFile(path, Mode::QFileWrite));
+    }
+}
+
+void TestFileWriter::benchmarkQueuedWrite()
+{
+    const QString path = m_dir.filePath(QStringLiteral("bench_queued.bin"));
+    QBENCHMARK {
+        QVERIFY(writeFile(path, Mode::Queued));
+    }
+}
+
+void TestFileWriter::benchmarkMappedWrite()
+{
+    const QString path = m_dir.filePath(QStringLiteral("bench_mapped.bin"));
+    QBENCHMARK {
+        if (!writeFile(path, Mode::Mapped)) {
+            QSKIP("file system does not support preallocation or mapping");
+        }
+    }
+}
+
+// 映射失败时返回false。QFileWrite为FileWriter之前的做法：在调用线程中seek后写入
+bool TestFileWriter::writeFile(const QString& path, Mode mode)
+{
+    QFile::remove(path);
+    auto file = std::make_unique<QFile>(path);
+    if (!file->open(QIODevice::ReadWrite)) {
+        return false;
+    }
+
+    QBuffer source(&m_data);
+    source.open(QIODevice::ReadOnly);
+    const qint64 segmentSize = s_fileSize / s_segmentCount;
+    const auto forEachChunk = [&](const std::function<void(qint64 offset)>& write) {
+        for (qint64 pos = 0; pos < segmentSize; pos += s_chunkSize) {
+            for (int i = 0; i < s_segmentCount; ++i) {
+                write(i * segmentSize + pos);
+            }
+        }
+    };
+
+    if (mode == Mode::QFileWrite) {
+        bool success = file->resize(s_fileSize);
+        forEachChunk([&](qint64 offset) {
+            success = success && file->seek(offset) && file->write(m_data.constData() + offset, s_chunkSize) == s_chunkSize;
+        });
+        file->close();
+        return success;
+    }
+
+    auto writer = std::make_shared<FileWriter>(std::move(file));
+    if (mode == Mode::Mapped) {
+        writer->preallocate(s_fileSize);
+        if (!writer->map(s_fileSize).wait().value() || !writer->enableMap()) {
+            writer->close(FileWriter::FlushPolicy::None).wait();
+            return false;
+        }
+    } else {
+        writer->resize(s_fileSize);
+    }
+    forEachChunk([&](qint64 offset) {
+        source.seek(offset);
+        writer->write(offset, &source, s_chunkSize);
+    });
+    return writer->close(FileWriter::FlushPolicy::Flush).wait().value() && !writer->hasError();
+}
+
+bool TestFileWriter::verifyFile(const QString& path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) && file.readAll() == m_data;
+}
+
+QTEST_GUILESS_MAIN(TestFileWriter)
+#include "tst_filewriter.moc"
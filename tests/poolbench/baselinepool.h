@@ -0,0 +1,109 @@
+﻿#ifndef NETWORK_TEST_BASELINE_POOL_H
+#define NETWORK_TEST_BASELINE_POOL_H
+#include "future.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/*** 改为工作窃取之前的Async::ThreadPool(基线提交41a7b5b)，仅作对比 ***/
+// 一把锁、一个条件变量与一个共享deque，线程数固定。execute与原实现相同，每个任务同样创建Promise/Future；
+// 只保留基准用到的void版本，去掉了全局实例与主线程检查
+class BaselineThreadPool {
+public:
+    explicit BaselineThreadPool(int numThreads)
+        : numThreads_(numThreads)
+    {
+    }
+    ~BaselineThreadPool() { joinAll(); }
+
+    BaselineThreadPool(const BaselineThreadPool&) = delete;
+    void operator=(const BaselineThreadPool&) = delete;
+
+    template <typename F, typename... Args>
+    auto execute(F&& f, Args&&... args) -> Async::Future<void>
+    {
+        std::unique_lock<std::mutex> guard(mutex_);
+        if (shutdown_)
+            return Async::makeReadyFuture();
+
+        if (workers_.empty()) {
+            _start();
+        }
+
+        Async::Promise<void> promise;
+        auto future = promise.getFuture();
+
+        auto func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        auto task = [t = std::move(func), pm = std::move(promise)]() mutable {
+            try {
+                t();
+                pm.setValue();
+            } catch (...) {
+                pm.setException(std::current_exception());
+            }
+        };
+
+        tasks_.emplace_back(std::move(task));
+        cond_.notify_one();
+
+        return future;
+    }
+
+    void joinAll()
+    {
+        decltype(workers_) tmp;
+        {
+            std::unique_lock<std::mutex> guard(mutex_);
+            if (shutdown_)
+                return;
+
+            shutdown_ = true;
+            cond_.notify_all();
+
+            tmp.swap(workers_);
+        }
+
+        for (auto& t : tmp) {
+            if (t.joinable())
+                t.join();
+        }
+    }
+
+private:
+    void _start()
+    {
+        for (int i = 0; i < numThreads_; i++) {
+            workers_.emplace_back([this]() { this->_workerRoutine(); });
+        }
+    }
+
+    void _workerRoutine()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard(mutex_);
+                cond_.wait(guard, [this]() { return shutdown_ || !tasks_.empty(); });
+                if (shutdown_ && tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+private:
+    int numThreads_;
+    std::deque<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool shutdown_ { false };
+    std::deque<std::function<void()>> tasks_;
+};
+#endif // NETWORK_TEST_BASELINE_POOL_H
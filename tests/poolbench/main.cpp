@@ -0,0 +1,131 @@
+﻿#include "baselinepool.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*** 线程池基准：当前的Async::ThreadPool与改为工作窃取之前的实现(BaselineThreadPool)对比 ***/
+// external：若干外部线程同时逐个提交大量极小的任务；recursive：任务在池内递归派生子任务(二叉树)，
+// 对应Future::then在工作线程中调度的后续任务。两者的execute都创建Promise/Future，每项取若干轮的最好与中位耗时
+static const int s_rounds = 7;
+static const int s_externalTasks = 200000;
+static const int s_submitters = 4; // external负载的提交线程数
+static const int s_treeDepth = 17; // 2^18 - 1个任务
+
+// 等待count个任务完成，最后一个完成的任务唤醒调用线程
+class Latch {
+public:
+    explicit Latch(int count)
+        : m_count(count)
+    {
+    }
+    void countDown()
+    {
+        if (m_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done = true;
+            m_cond.notify_all();
+        }
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]() { return m_done; });
+    }
+
+private:
+    std::atomic<int> m_count;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_done = false;
+};
+
+template <typename Pool>
+static void spawnTree(Pool* pool, int depth, Latch* latch)
+{
+    if (depth > 0) {
+        pool->execute([=]() { spawnTree(pool, depth - 1, latch); });
+        pool->execute([=]() { spawnTree(pool, depth - 1, latch); });
+    }
+    latch->countDown();
+}
+
+template <typename Pool>
+static double runExternal(Pool* pool)
+{
+    Latch latch(s_externalTasks);
+    const auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> submitters;
+    for (int i = 0; i < s_submitters; ++i) {
+        submitters.emplace_back([pool, &latch]() {
+            for (int j = 0; j < s_externalTasks / s_submitters; ++j) {
+                pool->execute([&latch]() { latch.countDown(); });
+            }
+        });
+    }
+    for (auto& thread : submitters) {
+        thread.join();
+    }
+    latch.wait();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+template <typename Pool>
+static double runRecursive(Pool* pool)
+{
+    Latch latch((1 << (s_treeDepth + 1)) - 1);
+    const auto begin = std::chrono::steady_clock::now();
+    pool->execute([&]() { spawnTree(pool, s_treeDepth, &latch); });
+    latch.wait();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// 打印最好与中位耗时(ms)及按中位耗时计的吞吐
+static void report(const char* pool, const char* workload, int tasks, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    const double median = samples[samples.size() / 2];
+    std::printf("%-12s %-10s %8d tasks  best %8.2f ms  median %8.2f ms  %6.2f Mtask/s\n", pool, workload, tasks, samples.front(), median,
+        tasks / median / 1000.0);
+}
+
+template <typename Pool>
+static void benchmark(const char* name, Pool* pool)
+{
+    runExternal(pool); // 预热：启动线程、扩充队列
+    std::vector<double> external;
+    std::vector<double> recursive;
+    for (int i = 0; i < s_rounds; ++i) {
+        external.push_back(runExternal(pool));
+        recursive.push_back(runRecursive(pool));
+    }
+    report(name, "external", s_externalTasks, external);
+    report(name, "recursive", (1 << (s_treeDepth + 1)) - 1, recursive);
+}
+
+int main(int argc, char* argv[])
+{
+    int numThreads = argc > 1 ? std::atoi(argv[1]) : 0;
+    if (numThreads <= 0) {
+        numThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    std::printf("threads: %d, submitters: %d, rounds: %d\n", numThreads, s_submitters, s_rounds);
+
+    {
+        BaselineThreadPool pool(numThreads);
+        benchmark("baseline", &pool);
+    }
+    {
+        Async::ThreadPool pool(numThreads);
+        pool.setNumOfThreads(numThreads); // 固定线程数，与参照实现一致
+        benchmark("ThreadPool", &pool);
+        pool.joinAll();
+    }
+    return 0;
+}
@@ -0,0 +1,17 @@
+# 线程池基准，不属于make check，构建后直接运行: ./poolbench [线程数]
+TARGET = poolbench
+TEMPLATE = app
+QT -= gui
+QT += core
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+NETWORK_DIR = $$PWD/../..
+INCLUDEPATH += $$NETWORK_DIR/async
+
+HEADERS += \
+    baselinepool.h \
+    $$files($$NETWORK_DIR/async/*.h)
+SOURCES += \
+    main.cpp \
+    $$NETWORK_DIR/async/threadPool.cpp
@@ -0,0 +1,184 @@
+﻿#include "localhttpserver.h"
+#include <QHostAddress>
+#include <QTcpSocket>
+#include <QUrl>
+
+static const char* const s_boundary = "LOCAL_HTTP_SERVER_BOUNDARY";
+
+static QByteArray reasonPhrase(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 201:
+        return "Created";
+    case 204:
+        return "No Content";
+    case 206:
+        return "Partial Content";
+    case 404:
+        return "Not Found";
+    case 409:
+        return "Conflict";
+    case 416:
+        return "Range Not Satisfiable";
+    case 500:
+        return "Internal Server Error";
+    default:
+        return "Status";
+    }
+}
+
+LocalHttpServer::LocalHttpServer(QObject* parent)
+    : QTcpServer(parent)
+{
+    connect(this, &QTcpServer::newConnection, this, &LocalHttpServer::onNewConnection);
+}
+
+bool LocalHttpServer::start()
+{
+    return listen(QHostAddress::LocalHost, 0);
+}
+
+QString LocalHttpServer::url(const QString& path) const
+{
+    return QStringLiteral("http://127.0.0.1:%1%2").arg(serverPort()).arg(path);
+}
+
+void LocalHttpServer::setHandler(Handler handler)
+{
+    m_handler = std::move(handler);
+}
+
+// Range: bytes=0-99,200-299,-100，超出文件的部分截掉，没有有效区间时返回416
+LocalHttpServer::Response LocalHttpServer::serveFile(const Request& request, const QByteArray& data)
+{
+    Response response;
+    response.headers.append(Header("Accept-Ranges", "bytes"));
+    const QByteArray& range = request.header("Range").trimmed();
+    if (!range.startsWith("bytes=")) {
+        response.body = data;
+        return response;
+    }
+
+    const qint64 size = data.size();
+    QList<QPair<qint64, qint64>> ranges;
+    for (const auto& item : range.mid(6).split(',')) {
+        const QByteArray& spec = item.trimmed();
+        const int dash = spec.indexOf('-');
+        if (dash < 0) {
+            continue;
+        }
+        qint64 begin = 0;
+        qint64 end = size - 1;
+        if (dash == 0) {
+            begin = qMax<qint64>(size - spec.mid(1).toLongLong(), 0);
+        } else {
+            begin = spec.left(dash).toLongLong();
+            if (dash + 1 < spec.size()) {
+                end = qMin(spec.mid(dash + 1).toLongLong(), size - 1);
+            }
+        }
+        if (begin <= end && begin < size) {
+            ranges.append({ begin, end });
+        }
+    }
+
+    if (ranges.isEmpty()) {
+        response.status = 416;
+        response.headers.append(Header("Content-Range", "bytes */" + QByteArray::number(size)));
+        return response;
+    }
+
+    response.status = 206;
+    if (ranges.size() == 1) {
+        const auto& item = ranges.first();
+        response.headers.append(Header("Content-Range", QStringLiteral("bytes %1-%2/%3").arg(item.first).arg(item.second).arg(size).toLatin1()));
+        response.body = data.mid(static_cast<int>(item.first), static_cast<int>(item.second + 1 - item.first));
+        return response;
+    }
+
+    response.headers.append(Header("Content-Type", QByteArray("multipart/byteranges; boundary=") + s_boundary));
+    for (const auto& item : ranges) {
+        response.body += QByteArray("\r\n--") + s_boundary + "\r\n";
+        response.body += "Content-Type: application/octet-stream\r\n";
+        response.body += QStringLiteral("Content-Range: bytes %1-%2/%3\r\n\r\n").arg(item.first).arg(item.second).arg(size).toLatin1();
+        response.body += data.mid(static_cast<int>(item.first), static_cast<int>(item.second + 1 - item.first));
+    }
+    response.body += QByteArray("\r\n--") + s_boundary + "--\r\n";
+    return response;
+}
+
+void LocalHttpServer::onNewConnection()
+{
+    while (hasPendingConnections()) {
+        QTcpSocket* socket = nextPendingConnection();
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            m_buffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+}
+
+// 收齐请求头与Content-Length指定的请求体后再处理
+void LocalHttpServer::onReadyRead(QTcpSocket* socket)
+{
+    auto& buffer = m_buffers[socket];
+    buffer += socket->readAll();
+    const int headerEnd = buffer.indexOf("\r\n\r\n");
+    if (headerEnd < 0) {
+        return;
+    }
+
+    Request request;
+    const auto& lines = buffer.left(headerEnd).split('\n');
+    const auto& requestLine = lines.first().trimmed().split(' ');
+    if (requestLine.size() < 2) {
+        socket->abort();
+        return;
+    }
+    request.method = requestLine[0];
+    request.path = requestLine[1];
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines[i].indexOf(':');
+        if (colon > 0) {
+            request.headers.insert(lines[i].left(colon).trimmed().toLower(), lines[i].mid(colon + 1).trimmed());
+        }
+    }
+
+    const int length = request.header("Content-Length").toInt();
+    if (buffer.size() < headerEnd + 4 + length) {
+        return;
+    }
+    request.body = buffer.mid(headerEnd + 4, length);
+    m_buffers.remove(socket);
+    disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+    respond(socket, request);
+}
+
+void LocalHttpServer::respond(QTcpSocket* socket, const Request& request)
+{
+    Response response;
+    if (m_handler) {
+        response = m_handler(request);
+    } else {
+        response.status = 404;
+    }
+    if (response.drop) {
+        socket->abort();
+        return;
+    }
+
+    QByteArray head = "HTTP/1.1 " + QByteArray::number(response.status) + " " + reasonPhrase(response.status) + "\r\n";
+    for (const auto& header : response.headers) {
+        head += header.first + ": " + header.second + "\r\n";
+    }
+    head += "Content-Length: " + QByteArray::number(response.body.size()) + "\r\n";
+    head += "Connection: close\r\n\r\n";
+    socket->write(head);
+    if (request.method != "HEAD") {
+        socket->write(response.body);
+    }
+    socket->disconnectFromHost(); // 缓冲中的数据发完后才断开
+}
@@ -0,0 +1,50 @@
+﻿#ifndef NETWORK_TEST_LOCAL_HTTP_SERVER_H
+#define NETWORK_TEST_LOCAL_HTTP_SERVER_H
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QTcpServer>
+#include <functional>
+
+class QTcpSocket;
+
+/*** 测试用的本地HTTP/1.1服务端：监听127.0.0.1，每个连接处理一个请求后关闭，响应由handler生成 ***/
+// serveFile支持HEAD与Range(单个区间返回206，多个区间返回multipart/byteranges)，可作为静态文件服务
+class LocalHttpServer : public QTcpServer {
+    Q_OBJECT
+public:
+    struct Request {
+        QByteArray method;
+        QByteArray path;
+        QHash<QByteArray, QByteArray> headers; // 名称为小写
+        QByteArray body;
+
+        QByteArray header(const QByteArray& name) const { return headers.value(name.toLower()); }
+    };
+    using Header = QPair<QByteArray, QByteArray>;
+    struct Response {
+        int status = 200;
+        QList<Header> headers;
+        QByteArray body; // HEAD请求只发送Content-Length，不发送body
+        bool drop = false; // 不响应，直接断开连接
+    };
+    using Handler = std::function<Response(const Request&)>;
+
+    explicit LocalHttpServer(QObject* parent = nullptr);
+    bool start(); // 随机端口
+    QString url(const QString& path) const;
+    void setHandler(Handler handler);
+
+    static Response serveFile(const Request& request, const QByteArray& data);
+
+private:
+    void onNewConnection();
+    void onReadyRead(QTcpSocket* socket);
+    void respond(QTcpSocket* socket, const Request& request);
+
+private:
+    Handler m_handler;
+    QHash<QTcpSocket*, QByteArray> m_buffers; // 尚未收完的请求
+};
+#endif // NETWORK_TEST_LOCAL_HTTP_SERVER_H
@@ -0,0 +1,23 @@
+# 测试直接编译库的源文件，不必先构建、安装libnet
+QT -= gui
+QT += core network svg testlib
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+DEFINES += NETWORK_LIBRARY
+
+unix: LIBS += -lz
+
+NETWORK_DIR = $$PWD/../..
+INCLUDEPATH += $$NETWORK_DIR $$PWD
+
+HEADERS += \
+    $$files($$NETWORK_DIR/*.h) \
+    $$files($$NETWORK_DIR/async/*.h) \
+    $$PWD/localhttpserver.h \
+    $$PWD/testutil.h
+
+SOURCES += \
+    $$files($$NETWORK_DIR/*.cpp) \
+    $$NETWORK_DIR/async/threadPool.cpp \
+    $$PWD/localhttpserver.cpp \
+    $$PWD/testutil.cpp
@@ -0,0 +1,12 @@
+﻿#include "testutil.h"
+#include <QtTest>
+
+Net::ResultPtr waitForResult(const std::shared_ptr<Net::Task>& task, int timeoutMs)
+{
+    // 超时返回后任务可能仍在执行，回调随context销毁而不再调用
+    QObject context;
+    Net::ResultPtr result;
+    task->run(&context, [&](Net::ResultPtr taskResult) { result = taskResult; });
+    [&]() { QTRY_VERIFY_WITH_TIMEOUT(result != nullptr, timeoutMs); }();
+    return result ? result : std::make_shared<Net::Result>();
+}
@@ -0,0 +1,9 @@
+﻿#ifndef NETWORK_TEST_UTIL_H
+#define NETWORK_TEST_UTIL_H
+#include "task.h"
+#include <memory>
+
+/*** 测试共用：执行任务并在事件循环中等待结果 ***/
+// 超时记为当前测试失败，返回一个未成功的空结果，调用处照常检查isSuccess即可
+Net::ResultPtr waitForResult(const std::shared_ptr<Net::Task>& task, int timeoutMs);
+#endif // NETWORK_TEST_UTIL_H
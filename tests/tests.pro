@@ -0,0 +1,8 @@
+# qmake && make && make check
+TEMPLATE = subdirs
+SUBDIRS += \
+    bandwidth \
+    chunkedupload \
+    deltadownload \
+    filewriter \
+    poolbench
@@ -1,11 +1,18 @@
 ﻿#include "uploadtask.h"
+#include "bandwidthmanager.h"
+#include "executor.h"
 #include <QBuffer>
 #include <QFile>
 #include <QFileInfo>
-#include <QHttpMultiPart>
-#include <QThreadPool>
+#include <QImageWriter>
+#include <QJsonDocument>
+#include <mutex>
 
 using namespace Net;
+static const qint64 s_maxGrant = 256 * 1024; // 单次最多放行的字节数，不限速时上传中开启的限速也能很快生效
+static const qint64 s_hashBlockSize = 1024 * 1024; // 计算摘要时每次读取的字节数
+static std::mutex s_dedupMutex;
+static UploadTask::DedupStats s_dedupStats;
 UploadResourceParam::UploadResourceParam(const QString& name, const QString& filename, const QString& type)
     : fileKey(name)
     , fileName(filename)
@@ -13,8 +20,19 @@ UploadResourceParam::UploadResourceParam(const QString& name, const QString& fil
 {
 }
 
+QIODevice* UploadResourceParam::createDevice()
+{
+    return nullptr;
+}
+
+UploadResourceParamPtr UploadResourceParam::threadPoolParam()
+{
+    return shared_from_this();
+}
+
 QByteArray UploadFilePathParam::getByteArray()
 {
+    Async::ThreadPool::BlockingRegion blocking; // 在线程池中读取大文件时，线程池可补充线程执行其它工作
     auto file = std::make_unique<QFile>(m_resource);
     if (!file->exists()) {
         return "";
@@ -25,6 +43,16 @@ QByteArray UploadFilePathParam::getByteArray()
     return file->readAll();
 }
 
+QIODevice* UploadFilePathParam::createDevice()
+{
+    auto file = std::make_unique<QFile>(m_resource);
+    if (!file->open(QIODevice::ReadOnly)) {
+        return nullptr;
+    }
+
+    return file.release();
+}
+
 UploadResourceParamPtr UploadFilePathParam::setResource(const QString& filePath)
 {
     m_resource = filePath;
@@ -52,6 +80,13 @@ QByteArray UploadPixmapParam::getByteArray()
     return buffer.buffer();
 }
 
+UploadResourceParamPtr UploadPixmapParam::threadPoolParam()
+{
+    auto param = std::make_shared<UploadImageParam>(fileKey, fileName, contentType);
+    param->setResource(m_resource.toImage(), m_format.isEmpty() ? QStringLiteral("png") : m_format);
+    return param;
+}
+
 UploadResourceParamPtr UploadPixmapParam::setResource(const QPixmap& pix, const QString& format)
 {
     m_resource = pix;
@@ -66,73 +101,432 @@ UploadResourceParamPtr UploadPixmapParam::setResource(QPixmap&& pix, const QStri
     return shared_from_this();
 }
 
-// Todo: 将QImage转换为QByteArray
-// QByteArray UploadImageParam::getByteArray()
-//{
-//    return QByteArray();
-//}
+// 在线程池中调用，缩放与编码都不涉及GUI线程
+QByteArray UploadImageParam::getByteArray()
+{
+    QImage image = m_resource;
+    if (m_maxSize.isValid() && (image.width() > m_maxSize.width() || image.height() > m_maxSize.height())) {
+        image = image.scaled(m_maxSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    QByteArray format = m_format.toLatin1();
+    if (!QImageWriter::supportedImageFormats().contains(format)) {
+        qInfo() << QStringLiteral("UploadImageParam image format %1 not supported, use png").arg(m_format);
+        format = "png";
+    }
+
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, format);
+    writer.setQuality(m_quality);
+    if (!writer.write(image)) {
+        qInfo() << QStringLiteral("UploadImageParam encode failed: %1").arg(writer.errorString());
+        return QByteArray();
+    }
+    buffer.close();
+
+    return bytes;
+}
+
+UploadResourceParamPtr UploadImageParam::setResource(const QImage& image, const QString& format, int quality)
+{
+    m_resource = image;
+    m_format = format;
+    m_quality = quality;
+    return shared_from_this();
+}
+
+UploadResourceParamPtr UploadImageParam::setResource(QImage&& image, const QString& format, int quality)
+{
+    m_resource = std::move(image);
+    m_format = format;
+    m_quality = quality;
+    return shared_from_this();
+}
+
+UploadResourceParamPtr UploadImageParam::setMaxSize(const QSize& size)
+{
+    m_maxSize = size;
+    return shared_from_this();
+}
 
 /*** Upload请求 ***/
 UploadTask::UploadTask(const QString& url, const QJsonObject& params, const std::vector<UploadResourceParamPtr>& resourceParams)
     : PostMultiPartTask(url, params)
     , m_resourceParams(resourceParams)
+    , m_progress(this, [this](const ProgressThrottle::Progress& progress) {
+        emit sigUploadProgress(progress.bytes, progress.bytesTotal);
+        emit sigUploadRate(progress.bytesPerSecond, progress.remainingMs);
+    })
 {
     m_timeout = 0;
 }
 
 UploadTask::UploadTask(const QString& url, const QJsonObject& params, const UploadResourceParamPtr& resourceParam)
-    : PostMultiPartTask(url, params)
+    : UploadTask(url, params, std::vector<UploadResourceParamPtr>())
 {
-    m_timeout = 0;
     m_resourceParams.emplace_back(resourceParam);
 }
 
+UploadTask::~UploadTask()
+{
+    removeBandwidthConsumer();
+}
+
 UploadTask& UploadTask::setThreadPoolEnable(bool enable)
 {
     m_threadPoolEnable = enable;
     return *this;
 }
 
+UploadTask& UploadTask::setProgressInterval(int ms)
+{
+    m_progress.setInterval(ms);
+    return *this;
+}
+
+UploadTask& UploadTask::setUploadLimit(qint64 bytesPerSecond)
+{
+    m_maxBandwidth = bytesPerSecond;
+    if (m_bandwidthId != 0) {
+        BandwidthManager::instance().setConsumerLimit(m_bandwidthId, bytesPerSecond);
+    }
+    return *this;
+}
+
+UploadTask& UploadTask::setBandwidthWeight(int weight)
+{
+    m_bandwidthWeight = qMax(weight, 1);
+    if (m_bandwidthId != 0) {
+        BandwidthManager::instance().setConsumerWeight(m_bandwidthId, m_bandwidthWeight);
+    }
+    return *this;
+}
+
+UploadTask& UploadTask::setDedupCheck(const QString& checkUrl, Checksum::Algorithm algorithm)
+{
+    m_dedupUrl = checkUrl;
+    m_dedupAlgorithm = algorithm;
+    return *this;
+}
+
+UploadTask::DedupStats UploadTask::dedupStats()
+{
+    std::lock_guard<std::mutex> lock(s_dedupMutex);
+    return s_dedupStats;
+}
+
 QNetworkReply* UploadTask::execute()
 {
-    m_multiPart = std::make_unique<QHttpMultiPart>(QHttpMultiPart::FormDataType);
-    auto threadFunc = [=]() {
-        addHttpParamPart(m_multiPart, m_params);
+    // 编码道积压时等有空位再开始，大量排队的上传不会一次把资源都读入内存
+    if (m_threadPoolEnable && !Executor::instance().hasSpace(Executor::Lane::Compute)) {
+        Executor::instance().waitForSpace(Executor::Lane::Compute, this, [this]() { execute(); });
+        return nullptr;
+    }
+    if (!m_dedupUrl.isEmpty() && !m_dedupChecked) {
+        startDedupCheck();
+    } else {
+        startUpload();
+    }
+    return nullptr;
+}
+
+void UploadTask::startUpload()
+{
+    m_body = std::make_unique<MultiPartDevice>();
+    const auto& keys = m_params.keys();
+    for (const auto& key : keys) {
+        m_body->append(QString(R"(Content-Disposition: form-data; name="%1")").arg(key).toUtf8(), m_params.value(key).toString().toUtf8());
+    }
+
+    if (!m_threadPoolEnable) {
         for (const auto& resourseParam : m_resourceParams) {
-            addResourceMultiPart(m_multiPart, resourseParam);
+            addResourceMultiPart(m_body.get(), resourseParam);
         }
+        QMetaObject::invokeMethod(this, &UploadTask::postMultiPart, Qt::QueuedConnection);
+        return;
+    }
 
-        QMetaObject::invokeMethod(
-            this, [=]() {
-                m_networkReply = getNetworkAccessManager()->post(m_request, m_multiPart.get());
-                connect(m_networkReply, &QNetworkReply::uploadProgress, this, &UploadTask::sigUploadProgress);
-                connect(m_networkReply, &QNetworkReply::finished, this, &UploadTask::onRequestFinished);
-                connect(m_networkReply, &QNetworkReply::sslErrors, this, &UploadTask::onCopeSslErrors);
-            },
-            Qt::QueuedConnection);
-    };
+    // 每个资源一个任务，多张图片的编码分散到多个线程
+    QThread* thread = m_body->thread();
+    std::vector<Async::Future<ResourcePart>> futures;
+    for (const auto& param : m_resourceParams) {
+        const auto resourseParam = param->threadPoolParam();
+        futures.emplace_back(Executor::instance().execute(Executor::Lane::Compute, [=]() {
+            return createResourcePart(resourseParam, thread);
+        }));
+    }
+    // 任一资源读取或编码失败时整个上传失败，不能缺少文件发出请求
+    Async::whenAll(futures.begin(), futures.end()).then(this, [this](std::vector<Async::Try<ResourcePart>> resourceParts) {
+        for (const auto& resourcePart : resourceParts) {
+            if (resourcePart.hasException()) {
+                QString reason = QStringLiteral("resource part failed");
+                try {
+                    std::rethrow_exception(resourcePart.exception());
+                } catch (const std::exception& e) {
+                    reason = QStringLiteral("resource part failed: %1").arg(QString::fromUtf8(e.what()));
+                } catch (...) {
+                }
+                failUpload(reason);
+                return;
+            }
+        }
+        for (const auto& resourcePart : resourceParts) {
+            appendResourcePart(m_body.get(), resourcePart.value());
+        }
+        postMultiPart();
+    });
+}
 
-    if (m_threadPoolEnable) {
-        QThreadPool::globalInstance()->start(new Runnable(threadFunc));
+void UploadTask::failUpload(const QString& reason)
+{
+    m_body.reset();
+    qInfo() << QStringLiteral("UploadTask url: %1, failed: %2").arg(m_url).arg(reason);
+    auto result = createResult();
+    result->m_httpCode = -1;
+    result->m_qtNetworkError = QNetworkReply::ProtocolFailure;
+    result->m_qtErrorString = reason;
+    result->m_statusCode = Result::RequestStatus::UnknowError;
+    result->m_taskId = m_taskId;
+    printResultLog(result);
+    notifyResult(result);
+}
+
+// 节流中尚未发出的进度在结果之前发出
+void UploadTask::notifyResult(const ResultPtr& result)
+{
+    removeBandwidthConsumer();
+    m_progress.finish();
+    PostMultiPartTask::notifyResult(result);
+}
+
+// 与上传共用线程池，摘要按块流式计算，不把整个文件读入内存
+void UploadTask::startDedupCheck()
+{
+    std::vector<UploadResourceParamPtr> resourceParams;
+    for (const auto& param : m_resourceParams) {
+        resourceParams.push_back(param->threadPoolParam());
+    }
+    const auto algorithm = m_dedupAlgorithm;
+    auto future = Executor::instance().execute(Executor::Lane::Compute, [resourceParams, algorithm]() {
+        return hashResources(resourceParams, algorithm);
+    });
+    future.then(this, [this](DedupFiles dedupFiles) {
+        onResourcesHashed(dedupFiles);
+    });
+}
+
+UploadTask::DedupFiles UploadTask::hashResources(const std::vector<UploadResourceParamPtr>& resourceParams, Checksum::Algorithm algorithm)
+{
+    QElapsedTimer timer;
+    timer.start();
+    DedupFiles dedupFiles;
+    for (const auto& resourceParam : resourceParams) {
+        if (resourceParam->isEmpty()) {
+            continue;
+        }
+
+        qint64 size = 0;
+        const QByteArray& hash = hashResource(resourceParam, algorithm, size);
+        if (hash.isEmpty()) {
+            dedupFiles.valid = false;
+            break;
+        }
+        dedupFiles.bytes += size;
+        dedupFiles.files.append(QJsonObject {
+            { "name", resourceParam->fileKey },
+            { "filename", resourceParam->fileName },
+            { "size", static_cast<double>(size) },
+            { "hash", QString::fromLatin1(hash.toHex()) } });
+    }
+    dedupFiles.hashMs = timer.elapsed();
+    return dedupFiles;
+}
+
+// 可流式读取的资源按块计算，否则对getByteArray的结果计算。读取失败时返回空
+QByteArray UploadTask::hashResource(const UploadResourceParamPtr& resourceParam, Checksum::Algorithm algorithm, qint64& size)
+{
+    Checksum checksum(algorithm);
+    std::unique_ptr<QIODevice> device(resourceParam->createDevice());
+    if (device) {
+        Async::ThreadPool::BlockingRegion blocking;
+        size = 0;
+        QByteArray block(static_cast<int>(s_hashBlockSize), Qt::Uninitialized);
+        qint64 bytes = 0;
+        while ((bytes = device->read(block.data(), block.size())) > 0) {
+            checksum.addData(block.constData(), bytes);
+            size += bytes;
+        }
+        if (bytes < 0) {
+            return QByteArray();
+        }
     } else {
-        threadFunc();
+        const QByteArray& bytes = resourceParam->getByteArray();
+        checksum.addData(bytes);
+        size = bytes.size();
     }
+    return checksum.result();
+}
 
-    return nullptr;
+void UploadTask::onResourcesHashed(const DedupFiles& dedupFiles)
+{
+    if (!dedupFiles.valid || dedupFiles.files.isEmpty()) {
+        m_dedupChecked = true;
+        startUpload();
+        return;
+    }
+
+    static const char* const s_algorithmNames[] = { "md5", "sha1", "sha256", "crc32c" };
+    QJsonObject obj = m_params;
+    obj.insert("algorithm", s_algorithmNames[static_cast<int>(m_dedupAlgorithm)]);
+    obj.insert("files", dedupFiles.files);
+
+    QNetworkRequest request(m_request);
+    request.setUrl(QUrl(m_dedupUrl));
+    request.setHeader(QNetworkRequest::ContentTypeHeader, QStringLiteral("application/json"));
+    request.setHeader(QNetworkRequest::ContentLengthHeader, QVariant());
+    m_networkReply = getNetworkAccessManager()->post(request, QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    const qint64 bytes = dedupFiles.bytes;
+    const qint64 hashMs = dedupFiles.hashMs;
+    connect(m_networkReply, &QNetworkReply::finished, this, [=]() { onDedupFinished(bytes, hashMs); });
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &UploadTask::onCopeSslErrors);
 }
 
-void UploadTask::addResourceMultiPart(const std::unique_ptr<QHttpMultiPart>& multiPart, const UploadResourceParamPtr& resourceParam)
+// 命中时预检的响应即为结果；取消时照常结束；其余情况(未命中、预检接口出错)继续上传。
+// 只认响应中明确的"exists": true，地址配错落到通用的200处理时不会被当成命中而丢掉上传
+void UploadTask::onDedupFinished(qint64 bytes, qint64 hashMs)
 {
+    auto reply = m_networkReply;
+    if (reply->error() == QNetworkReply::OperationCanceledError) {
+        onRequestFinished();
+        return;
+    }
+
+    const int httpCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    bool hit = false;
+    if (reply->error() == QNetworkReply::NoError && httpCode >= 200 && httpCode < 300) {
+        const auto& obj = QJsonDocument::fromJson(reply->peek(reply->bytesAvailable())).object(); // 命中时响应还要作为结果读取
+        hit = obj.value("exists").toBool(false);
+    }
+    {
+        std::lock_guard<std::mutex> lock(s_dedupMutex);
+        s_dedupStats.checks++;
+        s_dedupStats.hashBytes += bytes;
+        s_dedupStats.hashMs += hashMs;
+        if (hit) {
+            s_dedupStats.hits++;
+            s_dedupStats.skippedBytes += bytes;
+        }
+    }
+    qInfo() << QStringLiteral("UploadTask url: %1, dedup check %2, httpCode: %3, bytes: %4, hash elapsedTime: %5ms").arg(m_url).arg(hit ? "hit" : "miss").arg(httpCode).arg(bytes).arg(hashMs);
+    emit sigDedupChecked(hit, bytes, hashMs);
+    if (hit) {
+        onRequestFinished();
+        return;
+    }
+
+    m_dedupChecked = true;
+    m_networkReply = nullptr;
+    disconnect(reply, nullptr, this, nullptr);
+    reply->deleteLater();
+    startUpload();
+}
+
+void UploadTask::addResourceMultiPart(MultiPartDevice* device, const UploadResourceParamPtr& resourceParam)
+{
+    appendResourcePart(device, createResourcePart(resourceParam, device->thread()));
+}
+
+// 可能在线程池中调用，设备先移到请求体所在线程，组装时再设置父对象。请求体需随机访问，顺序设备读入内存
+UploadTask::ResourcePart UploadTask::createResourcePart(const UploadResourceParamPtr& resourceParam, QThread* thread)
+{
+    ResourcePart resourcePart;
     if (resourceParam->isEmpty()) {
+        return resourcePart;
+    }
+
+    resourcePart.isEmpty = false;
+    const QString header = QString("Content-Type: %1\r\n" R"(Content-Disposition: form-data; name="%2"; filename="%3")").arg(resourceParam->contentType).arg(resourceParam->fileKey).arg(resourceParam->fileName);
+    resourcePart.headers = header.toUtf8();
+
+    std::unique_ptr<QIODevice> device(resourceParam->createDevice());
+    if (device && device->isSequential()) {
+        resourcePart.body = device->readAll();
+    } else if (device) {
+        device->moveToThread(thread);
+        resourcePart.device.reset(device.release(), [](QIODevice* device) {
+            if (device->parent() == nullptr) {
+                device->deleteLater();
+            }
+        });
+    } else {
+        resourcePart.body = resourceParam->getByteArray();
+    }
+
+    return resourcePart;
+}
+
+void UploadTask::appendResourcePart(MultiPartDevice* device, const ResourcePart& resourcePart)
+{
+    if (resourcePart.isEmpty) {
         return;
     }
 
-    QHttpPart filePart;
-    filePart.setHeader(QNetworkRequest::ContentTypeHeader, resourceParam->contentType);
-    QString header = QString(R"(form-data; name="%1"; filename="%2")").arg(resourceParam->fileKey).arg(resourceParam->fileName);
-    filePart.setHeader(QNetworkRequest::ContentDispositionHeader, header);
+    if (resourcePart.device) {
+        device->append(resourcePart.headers, resourcePart.device.get());
+    } else {
+        device->append(resourcePart.headers, resourcePart.body);
+    }
+}
+
+void UploadTask::postMultiPart()
+{
+    m_body->open(QIODevice::ReadOnly);
+    m_request.setHeader(QNetworkRequest::ContentTypeHeader, m_body->contentType());
+    m_request.setHeader(QNetworkRequest::ContentLengthHeader, m_body->size());
+    addBandwidthConsumer();
+
+    m_networkReply = getNetworkAccessManager()->post(m_request, m_body.get());
+    m_progress.reset();
+    connect(m_networkReply, &QNetworkReply::uploadProgress, this, [this](qint64 bytesSent, qint64 bytesTotal) {
+        m_progress.update(bytesSent, bytesTotal);
+    });
+    connect(m_networkReply, &QNetworkReply::finished, this, &UploadTask::onRequestFinished);
+    connect(m_networkReply, &QNetworkReply::sslErrors, this, &UploadTask::onCopeSslErrors);
+}
 
-    filePart.setBody(resourceParam->getByteArray());
+// 请求体都登记到BandwidthManager，上传中开启全局、host限速或setUploadLimit都能立即生效
+void UploadTask::addBandwidthConsumer()
+{
+    removeBandwidthConsumer();
+    QPointer<MultiPartDevice> body(m_body.get());
+    BandwidthManager::Consumer consumer;
+    consumer.direction = BandwidthManager::Direction::Upload;
+    consumer.host = m_request.url().host();
+    consumer.limit = m_maxBandwidth;
+    consumer.weight = m_bandwidthWeight;
+    consumer.pending = [body]() {
+        return body ? body->pending() : 0;
+    };
+    consumer.transfer = [body](qint64 maxBytes) {
+        const qint64 bytes = body ? qMin(qMin(maxBytes, body->pending()), s_maxGrant) : 0;
+        if (bytes > 0) {
+            body->grant(bytes);
+        }
+        return bytes;
+    };
+    m_bandwidthId = BandwidthManager::instance().addConsumer(consumer);
+    const int id = m_bandwidthId;
+    m_body->setPendingCallback([id]() {
+        BandwidthManager::instance().notifyPending(id);
+    });
+}
 
-    multiPart->append(filePart);
+void UploadTask::removeBandwidthConsumer()
+{
+    if (m_bandwidthId != 0) {
+        BandwidthManager::instance().removeConsumer(m_bandwidthId);
+        m_bandwidthId = 0;
+    }
 }
@@ -1,27 +1,39 @@
 ﻿#ifndef NETWORK_UPLOAD_TASK_H
 #define NETWORK_UPLOAD_TASK_H
+#include "checksum.h"
+#include "multipartdevice.h"
 #include "posttask.h"
+#include "progressthrottle.h"
 #include <QImage>
+#include <QJsonArray>
 #include <QPixmap>
 #include <memory>
 
 namespace Net {
+struct UploadResourceParam;
+typedef std::shared_ptr<UploadResourceParam> UploadResourceParamPtr;
+
 struct NETWORK_EXPORT UploadResourceParam : public std::enable_shared_from_this<UploadResourceParam> {
     UploadResourceParam(const QString& name, const QString& filename, const QString& type);
     virtual bool isEmpty() = 0;
     virtual QByteArray getByteArray() = 0;
+    // 流式上传：返回已打开的可读设备，由请求体持有并在发送时按需读取，资源不必整体读入内存(顺序设备会先读入内存)。
+    // 在组装multipart的线程中调用，默认返回nullptr，改用getByteArray
+    virtual QIODevice* createDevice();
+    // 交给线程池读取或编码前在任务线程中调用，默认返回自身
+    virtual UploadResourceParamPtr threadPoolParam();
     QString fileKey;
     QString fileName;
     // multipart/form-data; image/jpeg;  application/octet-stream
     QString contentType;
 };
-typedef std::shared_ptr<UploadResourceParam> UploadResourceParamPtr;
 
 /*** 通过文件路径上传 ***/
 struct NETWORK_EXPORT UploadFilePathParam : public UploadResourceParam {
     using UploadResourceParam::UploadResourceParam;
     bool isEmpty() override { return m_resource.isEmpty(); }
     QByteArray getByteArray() override;
+    QIODevice* createDevice() override; // 以QFile流式上传，峰值内存与文件大小无关
     UploadResourceParamPtr setResource(const QString& filePath);
 
 protected:
@@ -44,6 +56,8 @@ struct NETWORK_EXPORT UploadPixmapParam : public UploadResourceParam {
     using UploadResourceParam::UploadResourceParam;
     bool isEmpty() override { return m_resource.isNull(); }
     QByteArray getByteArray() override;
+    // QPixmap只能在GUI线程使用，转为QImage后交给线程池编码，未指定格式时为png
+    UploadResourceParamPtr threadPoolParam() override;
     UploadResourceParamPtr setResource(const QPixmap& pix, const QString& format = QString());
     UploadResourceParamPtr setResource(QPixmap&& pix, const QString& format = QString());
 
@@ -52,33 +66,103 @@ protected:
     QString m_format;
 };
 
-/*** 上传QIMage，getByteArray还未实现。QImage转换到Byte有不同方式，应该还需额外一个参数来控制转换方式 ***/
-// struct NETWORK_EXPORT UploadImageParam : public UploadResourceParam<QImage>
-//{
-//     using UploadResourceParam<QImage>::UploadResourceParam;
-//     bool isEmpty() override { return resource.isNull(); }
-//     QByteArray getByteArray() override;
-// };
+/*** 上传QImage：与QPixmap不同可在线程池中安全编码，截图等多张图片并行编码。可选格式、质量与缩小尺寸 ***/
+struct NETWORK_EXPORT UploadImageParam : public UploadResourceParam {
+    using UploadResourceParam::UploadResourceParam;
+    bool isEmpty() override { return m_resource.isNull(); }
+    QByteArray getByteArray() override; // 直接编码到返回的字节数组，交给请求体时不再拷贝
+    // format为jpg、png、webp等QImageWriter支持的格式，不支持时改用png。
+    // quality为0-100，jpg、webp为画质；png为压缩程度，越小压缩率越高、编码越慢。-1为编码器默认
+    UploadResourceParamPtr setResource(const QImage& image, const QString& format = "jpg", int quality = -1);
+    UploadResourceParamPtr setResource(QImage&& image, const QString& format = "jpg", int quality = -1);
+    UploadResourceParamPtr setMaxSize(const QSize& size); // 宽或高超过时在编码前等比缩小，默认不缩放
+
+protected:
+    QImage m_resource;
+    QString m_format;
+    int m_quality = -1;
+    QSize m_maxSize;
+};
 
 class NETWORK_EXPORT UploadTask : public PostMultiPartTask {
     Q_OBJECT
 public:
     UploadTask(const QString& url, const QJsonObject& params, const std::vector<UploadResourceParamPtr>& resourceParams);
     UploadTask(const QString& url, const QJsonObject& params, const UploadResourceParamPtr& resourceParams);
+    ~UploadTask();
+    // 默认true，各资源在线程池中并行读取或编码，全部完成后按原顺序组装multipart再发送。false时在调用线程中依次组装
     UploadTask& setThreadPoolEnable(bool enable);
+    // 进度信号的最短间隔，默认100ms，<=0时每次回调都发出。结束时总会发出最后一次进度
+    UploadTask& setProgressInterval(int ms);
+    // 任务自身限速，可在上传中调整。与BandwidthManager的全局、按host上传限速共同生效
+    UploadTask& setUploadLimit(qint64 bytesPerSecond);
+    UploadTask& setBandwidthWeight(int weight); // 与其他任务争用带宽时的权重，默认1
+    // 秒传：先在线程池中流式计算各资源的摘要，POST json到checkUrl预检({参数..., "algorithm", "files": [{name, filename, size, hash}]})。
+    // 预检返回2xx且响应为{"exists": true, ...}表示服务端已有全部内容，以预检的响应作为结果直接完成，不再上传；
+    // 其他响应(包括2xx但没有exists为true)或预检失败时照常上传
+    UploadTask& setDedupCheck(const QString& checkUrl, Checksum::Algorithm algorithm = Checksum::Algorithm::Sha256);
+
+    // 秒传的累计统计，所有UploadTask共享
+    struct DedupStats {
+        qint64 checks = 0; // 预检次数
+        qint64 hits = 0; // 服务端已有内容、跳过上传的次数
+        qint64 hashBytes = 0; // 计算摘要的字节数
+        qint64 hashMs = 0; // 计算摘要的耗时
+        qint64 skippedBytes = 0; // 跳过上传的字节数
+    };
+    static DedupStats dedupStats();
 
 signals:
     void sigUploadProgress(qint64 bytesSent, qint64 bytesTotal);
+    void sigUploadRate(qint64 bytesPerSecond, qint64 remainingMs); // 滑动平均速度与预计剩余时间，未知时remainingMs为-1
+    void sigDedupChecked(bool hit, qint64 bytes, qint64 hashMs); // 预检结束，bytes为各资源的总大小
 
 protected:
     QNetworkReply* execute() override;
+    void notifyResult(const ResultPtr& result) override;
 
 protected:
-    void addResourceMultiPart(const std::unique_ptr<QHttpMultiPart>& multiPart, const UploadResourceParamPtr& resourceParam);
+    void addResourceMultiPart(MultiPartDevice* device, const UploadResourceParamPtr& resourceParam);
+
+private:
+    struct ResourcePart {
+        bool isEmpty = true;
+        QByteArray headers;
+        QByteArray body;
+        std::shared_ptr<QIODevice> device; // 组装前意外结束时释放，组装后由请求体持有
+    };
+
+    struct DedupFiles {
+        QJsonArray files;
+        qint64 bytes = 0;
+        qint64 hashMs = 0;
+        bool valid = true; // 有资源读取失败时不预检
+    };
+
+    static DedupFiles hashResources(const std::vector<UploadResourceParamPtr>& resourceParams, Checksum::Algorithm algorithm);
+    static QByteArray hashResource(const UploadResourceParamPtr& resourceParam, Checksum::Algorithm algorithm, qint64& size);
+    void startDedupCheck();
+    void onResourcesHashed(const DedupFiles& dedupFiles);
+    void onDedupFinished(qint64 bytes, qint64 hashMs);
+    void startUpload();
+    static ResourcePart createResourcePart(const UploadResourceParamPtr& resourceParam, QThread* thread);
+    static void appendResourcePart(MultiPartDevice* device, const ResourcePart& resourcePart);
+    void postMultiPart();
+    void failUpload(const QString& reason);
+    void addBandwidthConsumer();
+    void removeBandwidthConsumer();
 
 private:
     std::vector<UploadResourceParamPtr> m_resourceParams;
     bool m_threadPoolEnable = true;
+    std::unique_ptr<MultiPartDevice> m_body; // 请求体，按BandwidthManager分配的字节数读取
+    qint64 m_maxBandwidth = 0; // 上传限速 每秒字节数 bytes/秒
+    int m_bandwidthWeight = 1;
+    int m_bandwidthId = 0; // BandwidthManager中的consumer id
+    QString m_dedupUrl;
+    Checksum::Algorithm m_dedupAlgorithm = Checksum::Algorithm::Sha256;
+    bool m_dedupChecked = false; // 预检未命中后重试时直接上传
+    ProgressThrottle m_progress;
 };
 }
 #endif // NETWORK_UPLOAD_TASK_H
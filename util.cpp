@@ -51,6 +51,11 @@ std::shared_ptr<DownloadTask> Util::getDownloadTask(const QString& url, const QS
     return createTask<DownloadTask>(url, savePath);
 }
 
+std::shared_ptr<DeltaDownloadTask> Util::getDeltaDownloadTask(const QString& url, const QString& savePath)
+{
+    return createTask<DeltaDownloadTask>(url, savePath);
+}
+
 std::shared_ptr<UploadTask> Util::getUploadTask(const QString& url, const QJsonObject& obj, const std::vector<UploadResourceParamPtr>& resourceParams)
 {
     return createTask<UploadTask>(url, obj, resourceParams);
@@ -61,6 +66,11 @@ std::shared_ptr<UploadTask> Util::getUploadTask(const QString& url, const QJsonO
     return createTask<UploadTask>(url, obj, resourceParam);
 }
 
+std::shared_ptr<ChunkedUploadTask> Util::getChunkedUploadTask(const QString& url, const QJsonObject& metadata, const QString& filePath)
+{
+    return createTask<ChunkedUploadTask>(url, metadata, filePath);
+}
+
 Util::Util()
     : QObject(nullptr)
 {
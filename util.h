@@ -1,6 +1,8 @@
 ﻿#ifndef NETWORK_UTIL_H
 #define NETWORK_UTIL_H
 
+#include "chunkeduploadtask.h"
+#include "deltadownloadtask.h"
 #include "downloadtask.h"
 #include "gettask.h"
 #include "network_global.h"
@@ -31,8 +33,12 @@ public:
     std::shared_ptr<DownloadTask> getDownloadTask(const QString& url);
     /*** 下载到本地文件 ***/
     std::shared_ptr<DownloadTask> getDownloadTask(const QString& url, const QString& savePath);
+    /*** 增量下载：复用savePath处的旧版本，只下载变化的块，需服务端提供zsync清单 ***/
+    std::shared_ptr<DeltaDownloadTask> getDeltaDownloadTask(const QString& url, const QString& savePath);
     std::shared_ptr<UploadTask> getUploadTask(const QString& url, const QJsonObject& obj, const std::vector<UploadResourceParamPtr>& resourceParams);
     std::shared_ptr<UploadTask> getUploadTask(const QString& url, const QJsonObject& obj, const UploadResourceParamPtr& resourceParam);
+    /*** 分块断点续传上传(tus协议)：失败或重启后从服务端已确认的偏移继续 ***/
+    std::shared_ptr<ChunkedUploadTask> getChunkedUploadTask(const QString& url, const QJsonObject& metadata, const QString& filePath);
 
     static Util& instance()
     {